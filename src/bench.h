@@ -43,6 +43,9 @@ typedef unsigned char bool_t;
 #ifdef HAVE_SCHED_SETAFFINITY
 #include	<sched.h>
 #endif
+#ifdef HAVE_PTHREAD
+#include	<pthread.h>
+#endif
 #define PORTMAP
 #include	<rpc/rpc.h>
 #endif
@@ -77,6 +80,8 @@ typedef long long int64;
 #include	"lib_tcp.h"
 #include	"lib_udp.h"
 #include	"lib_unix.h"
+#include	"lib_uring.h"
+#include	"lib_shm.h"
 
 
 #ifdef	DEBUG
@@ -115,6 +120,7 @@ typedef long long int64;
 #define	SOCKOPT_RDWR	0x0003
 #define	SOCKOPT_PID	0x0004
 #define	SOCKOPT_REUSE	0x0008
+#define	SOCKOPT_REUSEPORT	0x0010
 #define	SOCKOPT_NONE	0
 
 #ifndef SOCKBUF
@@ -303,12 +309,23 @@ extern void benchmp(benchmp_f initialize,
 extern void* benchmp_getstate();
 extern iter_t benchmp_interval(void* _state);
 
+/*
+ * Run the benchmp() children as threads in this process instead of
+ * as forked processes, so they share one address space (and its VM
+ * locks).  enable is set by the benchmark's -T option; LMBENCH_EXEC=threads
+ * has the same effect.  Each thread is handed a private copy of the
+ * cookie, cookie_size bytes long, so benchmarks must opt in by calling
+ * this before benchmp(); otherwise children are always processes.
+ */
+extern void benchmp_threads(int enable, size_t cookie_size);
+
 /*
  * Which child process is this?
  * Returns a number in the range [0, ..., N-1], where N is the
  * total number of children (parallelism)
  */
 extern int benchmp_childid();
+extern int benchmp_timing();
 
 /*
  * harvest dead children to prevent zombies
@@ -319,6 +336,55 @@ extern void sigchld_wait_handler(int signo);
  * Handle optional pinning/placement of processes on an SMP machine.
  */
 extern int handle_scheduler(int childno, int benchproc, int nbenchprocs);
+extern void sched_init();
+extern int sched_ncpus();
+extern int sched_pin(int cpu);
+extern int numa_nodes();
+extern int numa_has_memory(int node);
+
+/*
+ * Hardware performance counters sampled around each timed interval
+ * (see lib_perf.c and LMBENCH_PERF).
+ */
+#define	PERF_MAX_EVENTS	8
+#define	PERF_NAME_LEN	20
+
+typedef struct {
+	int	nevents;
+	uint64	iterations;
+	char	name[PERF_MAX_EVENTS][PERF_NAME_LEN];
+	uint64	count[PERF_MAX_EVENTS];
+} perf_counts_t;
+
+extern void perf_begin();
+extern void perf_end();
+extern void perf_accumulate(uint64 iterations);
+extern void perf_close();
+extern perf_counts_t* perf_get_counts();
+extern void perf_merge(perf_counts_t* p, int first);
+extern void perf_report(char *s, double ops);
+
+/*
+ * Latency histograms, see lib_hist.c
+ */
+#define	HIST_SUB	32
+#define	HIST_BUCKETS	(48 * HIST_SUB)
+
+typedef struct {
+	uint64	count;
+	uint64	min;
+	uint64	max;
+	double	sum;
+	uint64	lost;		/* requests which never completed */
+	uint64	bucket[HIST_BUCKETS];
+} histogram_t;
+
+extern histogram_t* hist_alloc(int n);
+extern void hist_free(histogram_t* h, int n);
+extern void hist_add(histogram_t* h, uint64 ns);
+extern void hist_merge(histogram_t* dst, histogram_t* src);
+extern uint64 hist_percentile(histogram_t* h, double p);
+extern void hist_report(char *s, histogram_t* h);
 
 #include	"lib_mem.h"
 
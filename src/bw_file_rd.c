@@ -1,11 +1,16 @@
 /*
  * bw_file_rd.c - time reading & summing of a file
  *
- * Usage: bw_file_rd [-C] [-P <parallelism] [-W <warmup>] [-N <repetitions>] size file
+ * Usage: bw_file_rd [-C] [-D] [-q <depth>] [-P <parallelism] [-W <warmup>] [-N <repetitions>] size open2close|io_only|uring_open2close|uring_io_only file
  *
  * The intent is that the file is in memory.
  * Disk benchmarking is done with lmdd.
  *
+ * The uring_ variants read the file with io_uring instead of read(),
+ * keeping up to depth reads in flight, into buffers and a file which
+ * are registered with the ring.  -D opens the file with O_DIRECT.
+ * They also report the io_uring system calls and reads per file.
+ *
  * Copyright (c) 1994 Larry McVoy.  Distributed under the FSF GPL with
  * additional restriction that results may published only if
  * (1) the benchmark is unmodified, and
@@ -28,10 +33,33 @@ void	*buf;		/* do the I/O here */
 size_t	xfersize;	/* do it in units of this */
 size_t	count;		/* bytes to move (can't be modified) */
 
+#define	DIRECT_ALIGN	4096
+
+/* io_uring system calls made by the children, per child */
+typedef struct {
+	uint64	files;		/* times the file was read */
+	uint64	submits;	/* io_uring_enter()s which submitted reads */
+	uint64	waits;		/* io_uring_enter()s which only waited */
+	uint64	reads;		/* reads completed */
+} uring_stats_t;
+
 typedef struct _state {
 	char filename[256];
 	int fd;
 	int clone;
+	int oflags;
+	int depth;
+	uring_stats_t* stats;
+#ifdef HAVE_IO_URING
+	uring_t	ring;
+	int	fixed;		/* buffers are registered */
+	int	registered;	/* file is registered */
+	char**	bufs;
+	int*	free;
+	size_t*	offs;		/* file offset of each buffer's read */
+	size_t*	lens;		/* bytes wanted in each buffer */
+	size_t*	got;		/* bytes each buffer has so far */
+#endif
 } state_t;
 
 void doit(int fd)
@@ -85,10 +113,184 @@ init_open(iter_t iterations, void * cookie)
 	if (iterations) return;
 
 	initialize(0, cookie);
-	CHK(ofd = open(state->filename, O_RDONLY));
+	CHK(ofd = open(state->filename, O_RDONLY|state->oflags));
 	state->fd = ofd;
 }
 
+#ifdef HAVE_IO_URING
+/*
+ * Queue a read of the rest of buffer i
+ */
+static void
+uring_read(state_t* state, int fd, int i)
+{
+	struct io_uring_sqe *sqe = uring_sqe(&state->ring);
+
+	sqe->opcode = state->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	sqe->buf_index = state->fixed ? i : 0;
+	sqe->fd = state->registered ? 0 : fd;
+	sqe->flags = state->registered ? IOSQE_FIXED_FILE : 0;
+	sqe->addr = (unsigned long)(state->bufs[i] + state->got[i]);
+	sqe->len = state->lens[i] - state->got[i];
+	sqe->off = state->offs[i] + state->got[i];
+	sqe->user_data = i;
+}
+
+/*
+ * Read the file with up to state->depth reads in flight, summing
+ * each buffer as it completes.  Short reads are resubmitted for the
+ * rest of the buffer.
+ */
+void
+uring_doit(state_t* state, int fd)
+{
+	uring_t	*r = &state->ring;
+	uring_stats_t *stats = &state->stats[benchmp_childid()];
+	struct io_uring_cqe *cqe;
+	size_t	off = 0;
+	int	i, ret, inflight = 0, nfree = state->depth;
+	int	timed = benchmp_timing();
+
+	for (i = 0; i < nfree; ++i)
+		state->free[i] = i;
+	for (;;) {
+		while (nfree > 0 && off < count) {
+			i = state->free[--nfree];
+			state->offs[i] = off;
+			state->lens[i] = MIN(count - off, xfersize);
+			state->got[i] = 0;
+			uring_read(state, fd, i);
+			off += state->lens[i];
+			inflight++;
+		}
+		if (inflight == 0) break;
+		/* new reads and reissued short ones both count as submits */
+		if (timed) {
+			if (r->sq_queued) stats->submits++;
+			else stats->waits++;
+		}
+		uring_submit(r, 1);
+		while ((cqe = uring_cqe(r)) != NULL) {
+			i = (int)cqe->user_data;
+			ret = cqe->res;
+			uring_cqe_seen(r);
+			if (ret < 0) {
+				fprintf(stderr, "bw_file_rd: read at %lu: %s\n",
+					(unsigned long)state->offs[i],
+					strerror(-ret));
+				exit(1);
+			}
+			if (ret == 0) {
+				fprintf(stderr, "bw_file_rd: %s is shorter than %lu bytes\n",
+					state->filename, (unsigned long)count);
+				exit(1);
+			}
+			if (timed) stats->reads++;
+			if ((state->got[i] += ret) < state->lens[i]) {
+				uring_read(state, fd, i);
+				continue;
+			}
+			inflight--;
+			bread(state->bufs[i], state->lens[i]);
+			state->free[nfree++] = i;
+		}
+	}
+	if (timed) stats->files++;
+}
+
+/*
+ * Set up the ring, the buffers and the file (for open2close just an
+ * empty slot).  If the kernel will not register them, fall back to
+ * unregistered reads.
+ */
+void
+uring_setup(state_t* state)
+{
+	struct iovec *iov;
+	int	i;
+
+	if (uring_init(&state->ring, state->depth, 0) < 0) {
+		perror("bw_file_rd: io_uring_setup");
+		exit(1);
+	}
+	state->bufs = (char**)malloc(state->depth * sizeof(char*));
+	state->free = (int*)malloc(state->depth * sizeof(int));
+	state->offs = (size_t*)malloc(state->depth * sizeof(size_t));
+	state->lens = (size_t*)malloc(state->depth * sizeof(size_t));
+	state->got = (size_t*)malloc(state->depth * sizeof(size_t));
+	iov = (struct iovec*)malloc(state->depth * sizeof(struct iovec));
+	if (!state->bufs || !state->free || !state->offs || !state->lens
+	    || !state->got || !iov) {
+		perror("bw_file_rd: malloc");
+		exit(1);
+	}
+	for (i = 0; i < state->depth; ++i) {
+		state->bufs[i] = (char*)valloc(XFERSIZE);
+		if (!state->bufs[i]) {
+			perror("bw_file_rd: valloc");
+			exit(1);
+		}
+		bzero(state->bufs[i], XFERSIZE);
+		iov[i].iov_base = state->bufs[i];
+		iov[i].iov_len = XFERSIZE;
+	}
+	state->fixed = uring_register(&state->ring, IORING_REGISTER_BUFFERS,
+				      iov, state->depth) == 0;
+	free(iov);
+	state->registered = uring_register(&state->ring,
+				IORING_REGISTER_FILES, &state->fd, 1) == 0;
+}
+
+void
+init_uring(iter_t iterations, void * cookie)
+{
+	if (iterations) return;
+
+	initialize(0, cookie);
+	uring_setup((state_t *) cookie);
+}
+
+void
+init_uring_open(iter_t iterations, void * cookie)
+{
+	if (iterations) return;
+
+	init_open(0, cookie);
+	uring_setup((state_t *) cookie);
+}
+
+void
+time_uring_with_open(iter_t iterations, void * cookie)
+{
+	state_t	*state = (state_t *) cookie;
+	struct io_uring_files_update up;
+	int	fd;
+
+	while (iterations-- > 0) {
+		fd = open(state->filename, O_RDONLY|state->oflags);
+		if (state->registered) {
+			bzero(&up, sizeof(up));
+			up.fds = (unsigned long)&fd;
+			if (uring_register(&state->ring,
+			    IORING_REGISTER_FILES_UPDATE, &up, 1) != 1)
+				state->registered = 0;
+		}
+		uring_doit(state, fd);
+		close(fd);
+	}
+}
+
+void
+time_uring_io_only(iter_t iterations,void * cookie)
+{
+	state_t *state = (state_t *) cookie;
+
+	while (iterations-- > 0) {
+		uring_doit(state, state->fd);
+	}
+}
+#endif /* HAVE_IO_URING */
+
 void
 time_with_open(iter_t iterations, void * cookie)
 {
@@ -97,7 +299,7 @@ time_with_open(iter_t iterations, void * cookie)
 	int	fd;
 
 	while (iterations-- > 0) {
-		fd= open(filename, O_RDONLY);
+		fd= open(filename, O_RDONLY|state->oflags);
 		doit(fd);
 		close(fd);
 	}
@@ -122,6 +324,21 @@ cleanup(iter_t iterations, void * cookie)
 
 	if (iterations) return;
 
+#ifdef HAVE_IO_URING
+	if (state->bufs) {
+		int	i;
+
+		uring_exit(&state->ring);
+		for (i = 0; i < state->depth; ++i)
+			free(state->bufs[i]);
+		free(state->bufs);
+		free(state->free);
+		free(state->offs);
+		free(state->lens);
+		free(state->got);
+		state->bufs = NULL;
+	}
+#endif
 	if (state->fd >= 0) close(state->fd);
 	if (state->clone) unlink(state->filename);
 }
@@ -137,13 +354,27 @@ main(int ac, char **av)
 	int	c;
 	char	usage[1024];
 	
-	sprintf(usage,"[-C] [-P <parallelism>] [-W <warmup>] [-N <repetitions>] <size> open2close|io_only <filename>"
+	sprintf(usage,"[-C] [-D] [-q <depth>] [-P <parallelism>] [-W <warmup>] [-N <repetitions>] <size> open2close|io_only|uring_open2close|uring_io_only <filename>"
 		"\nmin size=%d\n",(int) (XFERSIZE>>10)) ;
 
+	bzero(&state, sizeof(state));
 	state.clone = 0;
+	state.depth = 8;
 
-	while (( c = getopt(ac, av, "P:W:N:C")) != EOF) {
+	while (( c = getopt(ac, av, "P:W:N:Cq:D")) != EOF) {
 		switch(c) {
+		case 'q':
+			state.depth = atoi(optarg);
+			if (state.depth <= 0) lmbench_usage(ac, av, usage);
+			break;
+		case 'D':
+#ifdef O_DIRECT
+			state.oflags |= O_DIRECT;
+#else
+			fprintf(stderr, "bw_file_rd: no O_DIRECT on this system\n");
+			exit(1);
+#endif
+			break;
 		case 'P':
 			parallel = atoi(optarg);
 			if (parallel <= 0) lmbench_usage(ac, av, usage);
@@ -172,6 +403,10 @@ main(int ac, char **av)
 	if (count < MINSZ) {
 		exit(1);	/* I want this to be quiet */
 	}
+	if (state.oflags && count % DIRECT_ALIGN) {
+		fprintf(stderr, "bw_file_rd: O_DIRECT needs a size which is a multiple of %d\n", DIRECT_ALIGN);
+		exit(1);
+	}
 	if (count < XFERSIZE) {
 		xfersize = count;
 	} else {
@@ -186,7 +421,47 @@ main(int ac, char **av)
 	} else if (!strcmp("io_only", av[optind+1])) {
 		benchmp(init_open, time_io_only, cleanup,
 			0, parallel, warmup, repetitions, &state);
+	} else if (!strncmp("uring_", av[optind+1], 6)) {
+#ifdef HAVE_IO_URING
+		state.stats = (uring_stats_t*)mmap(0,
+			parallel * sizeof(uring_stats_t), PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+		if (state.stats == (uring_stats_t*)MAP_FAILED) {
+			perror("bw_file_rd: mmap");
+			exit(1);
+		}
+		bzero(state.stats, parallel * sizeof(uring_stats_t));
+		if (!strcmp("uring_open2close", av[optind+1])) {
+			benchmp(init_uring, time_uring_with_open, cleanup,
+				0, parallel, warmup, repetitions, &state);
+		} else if (!strcmp("uring_io_only", av[optind+1])) {
+			benchmp(init_uring_open, time_uring_io_only, cleanup,
+				0, parallel, warmup, repetitions, &state);
+		} else lmbench_usage(ac, av, usage);
+#else
+		fprintf(stderr, "bw_file_rd: no io_uring on this system\n");
+		exit(1);
+#endif
 	} else lmbench_usage(ac, av, usage);
+	if (gettime() == 0) exit(1);
 	bandwidth(count, get_n() * parallel, 0);
+	/* after the result, so it stays out of the data scripts parse */
+	if (state.stats) {
+		uring_stats_t total;
+
+		bzero(&total, sizeof(total));
+		for (c = 0; c < parallel; ++c) {
+			total.files += state.stats[c].files;
+			total.submits += state.stats[c].submits;
+			total.waits += state.stats[c].waits;
+			total.reads += state.stats[c].reads;
+		}
+		if (total.files && get_n()) {
+			fprintf(stderr, "io_uring depth %d: %.2f submit + %.2f wait syscalls, %.2f reads per file\n",
+				state.depth, total.submits / (double)total.files,
+				total.waits / (double)total.files,
+				total.reads / (double)total.files);
+		}
+	}
 	return (0);
 }
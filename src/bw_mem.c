@@ -1,8 +1,9 @@
 /*
  * bw_mem.c - simple memory write bandwidth benchmark
  *
- * Usage: bw_mem [-P <parallelism>] [-W <warmup>] [-N <repetitions>] size what
+ * Usage: bw_mem [-P <parallelism>] [-W <warmup>] [-N <repetitions>] [-T] size what
  *        what: rd wr rdwr cp fwr frd fcp bzero bcopy
+ *              vrd vwr vcp vwrnt vcpnt vrdpf vcppf[128|256|512]
  *
  * Copyright (c) 1994-1996 Larry McVoy.  Distributed under the FSF GPL with
  * additional restriction that results may published only if
@@ -14,6 +15,10 @@ char	*id = "$Id$";
 
 #include "bench.h"
 
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
 #define TYPE    int
 
 /*
@@ -27,6 +32,17 @@ char	*id = "$Id$";
  *
  * All tests do 512 byte chunks in a loop.
  *
+ * The v* tests use vector registers and touch every byte:
+ * vrd - vector loads
+ * vwr - vector stores
+ * vcp - vector loads then vector stores to a different place
+ * vwrnt - non-temporal (streaming) vector stores
+ * vcpnt - vector loads then non-temporal vector stores
+ * vrdpf - vector loads, software prefetching ahead
+ * vcppf - prefetchnta of the source, non-temporal vector stores
+ * The width is the widest the cpu supports, or may be given as a
+ * suffix of 128, 256 or 512 bits (e.g. vcpnt256).
+ *
  * XXX - do a 64bit version of this.
  */
 void	rd(iter_t iterations, void *cookie);
@@ -38,6 +54,7 @@ void	frd(iter_t iterations, void *cookie);
 void	fcp(iter_t iterations, void *cookie);
 void	loop_bzero(iter_t iterations, void *cookie);
 void	loop_bcopy(iter_t iterations, void *cookie);
+benchmp_f	simd_kernel(char *what);
 void	init_overhead(iter_t iterations, void *cookie);
 void	init_loop(iter_t iterations, void *cookie);
 void	cleanup(iter_t iterations, void *cookie);
@@ -54,7 +71,7 @@ typedef struct _state {
 	size_t	N;
 } state_t;
 
-void	adjusted_bandwidth(uint64 t, uint64 b, uint64 iter, int parallel, double ovrhd, double avg_time_per_iter, double stddev_pct, int verbose);
+double	adjusted_bandwidth(uint64 t, uint64 b, uint64 iter, int parallel, double ovrhd, double avg_time_per_iter, double stddev_pct, int verbose);
 void	print_child_bandwidth(uint64 bytes, int parallel, double overhd);
 
 int
@@ -64,14 +81,16 @@ main(int ac, char **av)
 	int	warmup = 0;
 	int	repetitions = TRIES;
 	int	verbose = 0;
+	int	threads = 0;
 	size_t	nbytes;
+	double	bw;
 	state_t	state;
 	int	c;
-	char	*usage = "[-P <parallelism>] [-W <warmup>] [-N <repetitions>] [-v] <size> what [conflict]\nwhat: rd wr rdwr cp fwr frd fcp bzero bcopy\n<size> must be larger than 512";
+	char	*usage = "[-P <parallelism>] [-W <warmup>] [-N <repetitions>] [-v] [-T] <size> what [conflict]\nwhat: rd wr rdwr cp fwr frd fcp bzero bcopy\n      vrd vwr vcp vwrnt vcpnt vrdpf vcppf[128|256|512]\n<size> must be larger than 512";
 
 	state.overhead = 0;
 
-	while (( c = getopt(ac, av, "P:W:N:v")) != EOF) {
+	while (( c = getopt(ac, av, "P:W:N:vT")) != EOF) {
 		switch(c) {
 		case 'P':
 			parallel = atoi(optarg);
@@ -86,6 +105,9 @@ main(int ac, char **av)
 		case 'v':
 			verbose = 1;
 			break;
+		case 'T':
+			threads = 1;
+			break;
 		default:
 			lmbench_usage(ac, av, usage);
 			break;
@@ -106,9 +128,11 @@ main(int ac, char **av)
 	}
 
 	if (streq(av[optind+1], "cp") ||
-	    streq(av[optind+1], "fcp") || streq(av[optind+1], "bcopy")) {
+	    streq(av[optind+1], "fcp") || streq(av[optind+1], "bcopy") ||
+	    !strncmp(av[optind+1], "vcp", 3)) {
 		state.need_buf2 = 1;
 	}
+	benchmp_threads(threads, sizeof(state));
 		
 	if (streq(av[optind+1], "rd")) {
 		benchmp(init_loop, rd, cleanup, 0, parallel, 
@@ -137,11 +161,19 @@ main(int ac, char **av)
 	} else if (streq(av[optind+1], "bcopy")) {
 		benchmp(init_loop, loop_bcopy, cleanup, 0, parallel, 
 			warmup, repetitions, &state);
+	} else if (av[optind+1][0] == 'v' && simd_kernel(av[optind+1])) {
+		benchmp(init_loop, simd_kernel(av[optind+1]), cleanup, 0, 
+			parallel, warmup, repetitions, &state);
 	} else {
 		lmbench_usage(ac, av, usage);
 	}
-	adjusted_bandwidth(gettime(), nbytes, get_n(), parallel, state.overhead,
-			   get_avg_time_per_iter(), get_stddev_percent(), verbose);
+	bw = adjusted_bandwidth(gettime(), nbytes, get_n(), parallel, 
+				state.overhead, get_avg_time_per_iter(), 
+				get_stddev_percent(), verbose);
+	if (bw > 0.)
+		json_result(av[optind+1], bw, "MB/sec");
+	/* counters are per 64 byte cache line moved */
+	perf_report(av[optind+1], (double)nbytes / 64.);
 	if (verbose) {
 		print_child_bandwidth(nbytes, parallel, state.overhead);
 	}
@@ -444,11 +476,266 @@ loop_bcopy(iter_t iterations, void *cookie)
 	}
 }
 
+#ifdef HAVE_X86_SIMD
+/*
+ * Vector kernels, one set per register width.  Each walks the buffer
+ * in 512 byte chunks like the scalar tests, eight registers at a
+ * time.  They are compiled for their own instruction set with the
+ * target attribute and only called if cpuid says the cpu has it.
+ */
+#define	PREFETCH_AHEAD	1024
+
+#define	SIMD_KERNELS(W, T, ISA, LOAD, STORE, STREAM, XOR, SET1, TOINT)	\
+__attribute__((target(ISA))) static void				\
+vrd##W(iter_t iterations, void *cookie)					\
+{									\
+	state_t *state = (state_t *) cookie;				\
+	char	*lastone = (char*)state->lastone;			\
+	T	sum = SET1(0);						\
+									\
+	while (iterations-- > 0) {					\
+	    register T *p = (T*)state->buf;				\
+	    while ((char*)p <= lastone) {				\
+		T *end = (T*)((char*)p + 512);				\
+		for (; p < end; p += 8) {				\
+			sum = XOR(sum, XOR(XOR(XOR(LOAD(p), LOAD(p+1)),	\
+				XOR(LOAD(p+2), LOAD(p+3))),		\
+				XOR(XOR(LOAD(p+4), LOAD(p+5)),		\
+				XOR(LOAD(p+6), LOAD(p+7)))));		\
+		}							\
+	    }								\
+	}								\
+	use_int(TOINT(sum));						\
+}									\
+									\
+__attribute__((target(ISA))) static void				\
+vrdpf##W(iter_t iterations, void *cookie)				\
+{									\
+	state_t *state = (state_t *) cookie;				\
+	char	*lastone = (char*)state->lastone;			\
+	T	sum = SET1(0);						\
+									\
+	while (iterations-- > 0) {					\
+	    register T *p = (T*)state->buf;				\
+	    while ((char*)p <= lastone) {				\
+		T *end = (T*)((char*)p + 512);				\
+		for (; p < end; p += 8) {				\
+			char *a = (char*)p + PREFETCH_AHEAD;		\
+			_mm_prefetch(a, _MM_HINT_T0);			\
+			_mm_prefetch(a + 64, _MM_HINT_T0);		\
+			_mm_prefetch(a + 128, _MM_HINT_T0);		\
+			_mm_prefetch(a + 192, _MM_HINT_T0);		\
+			sum = XOR(sum, XOR(XOR(XOR(LOAD(p), LOAD(p+1)),	\
+				XOR(LOAD(p+2), LOAD(p+3))),		\
+				XOR(XOR(LOAD(p+4), LOAD(p+5)),		\
+				XOR(LOAD(p+6), LOAD(p+7)))));		\
+		}							\
+	    }								\
+	}								\
+	use_int(TOINT(sum));						\
+}									\
+									\
+__attribute__((target(ISA))) static void				\
+vwr##W(iter_t iterations, void *cookie)					\
+{									\
+	state_t *state = (state_t *) cookie;				\
+	char	*lastone = (char*)state->lastone;			\
+	T	one = SET1(1);						\
+									\
+	while (iterations-- > 0) {					\
+	    register T *p = (T*)state->buf;				\
+	    while ((char*)p <= lastone) {				\
+		T *end = (T*)((char*)p + 512);				\
+		for (; p < end; p += 8) {				\
+			STORE(p, one); STORE(p+1, one);			\
+			STORE(p+2, one); STORE(p+3, one);		\
+			STORE(p+4, one); STORE(p+5, one);		\
+			STORE(p+6, one); STORE(p+7, one);		\
+		}							\
+	    }								\
+	}								\
+}									\
+									\
+__attribute__((target(ISA))) static void				\
+vwrnt##W(iter_t iterations, void *cookie)				\
+{									\
+	state_t *state = (state_t *) cookie;				\
+	char	*lastone = (char*)state->lastone;			\
+	T	one = SET1(1);						\
+									\
+	while (iterations-- > 0) {					\
+	    register T *p = (T*)state->buf;				\
+	    while ((char*)p <= lastone) {				\
+		T *end = (T*)((char*)p + 512);				\
+		for (; p < end; p += 8) {				\
+			STREAM(p, one); STREAM(p+1, one);		\
+			STREAM(p+2, one); STREAM(p+3, one);		\
+			STREAM(p+4, one); STREAM(p+5, one);		\
+			STREAM(p+6, one); STREAM(p+7, one);		\
+		}							\
+	    }								\
+	    _mm_sfence();						\
+	}								\
+}									\
+									\
+__attribute__((target(ISA))) static void				\
+vcp##W(iter_t iterations, void *cookie)					\
+{									\
+	state_t *state = (state_t *) cookie;				\
+	char	*lastone = (char*)state->lastone;			\
+									\
+	while (iterations-- > 0) {					\
+	    register T *p = (T*)state->buf;				\
+	    register T *dst = (T*)state->buf2;				\
+	    while ((char*)p <= lastone) {				\
+		T *end = (T*)((char*)p + 512);				\
+		for (; p < end; p += 8, dst += 8) {			\
+			STORE(dst, LOAD(p)); STORE(dst+1, LOAD(p+1));	\
+			STORE(dst+2, LOAD(p+2)); STORE(dst+3, LOAD(p+3));\
+			STORE(dst+4, LOAD(p+4)); STORE(dst+5, LOAD(p+5));\
+			STORE(dst+6, LOAD(p+6)); STORE(dst+7, LOAD(p+7));\
+		}							\
+	    }								\
+	}								\
+}									\
+									\
+__attribute__((target(ISA))) static void				\
+vcpnt##W(iter_t iterations, void *cookie)				\
+{									\
+	state_t *state = (state_t *) cookie;				\
+	char	*lastone = (char*)state->lastone;			\
+									\
+	while (iterations-- > 0) {					\
+	    register T *p = (T*)state->buf;				\
+	    register T *dst = (T*)state->buf2;				\
+	    while ((char*)p <= lastone) {				\
+		T *end = (T*)((char*)p + 512);				\
+		for (; p < end; p += 8, dst += 8) {			\
+			STREAM(dst, LOAD(p)); STREAM(dst+1, LOAD(p+1));	\
+			STREAM(dst+2, LOAD(p+2)); STREAM(dst+3, LOAD(p+3));\
+			STREAM(dst+4, LOAD(p+4)); STREAM(dst+5, LOAD(p+5));\
+			STREAM(dst+6, LOAD(p+6)); STREAM(dst+7, LOAD(p+7));\
+		}							\
+	    }								\
+	    _mm_sfence();						\
+	}								\
+}									\
+									\
+__attribute__((target(ISA))) static void				\
+vcppf##W(iter_t iterations, void *cookie)				\
+{									\
+	state_t *state = (state_t *) cookie;				\
+	char	*lastone = (char*)state->lastone;			\
+									\
+	while (iterations-- > 0) {					\
+	    register T *p = (T*)state->buf;				\
+	    register T *dst = (T*)state->buf2;				\
+	    while ((char*)p <= lastone) {				\
+		T *end = (T*)((char*)p + 512);				\
+		for (; p < end; p += 8, dst += 8) {			\
+			char *a = (char*)p + PREFETCH_AHEAD;		\
+			_mm_prefetch(a, _MM_HINT_NTA);			\
+			_mm_prefetch(a + 64, _MM_HINT_NTA);		\
+			_mm_prefetch(a + 128, _MM_HINT_NTA);		\
+			_mm_prefetch(a + 192, _MM_HINT_NTA);		\
+			STREAM(dst, LOAD(p)); STREAM(dst+1, LOAD(p+1));	\
+			STREAM(dst+2, LOAD(p+2)); STREAM(dst+3, LOAD(p+3));\
+			STREAM(dst+4, LOAD(p+4)); STREAM(dst+5, LOAD(p+5));\
+			STREAM(dst+6, LOAD(p+6)); STREAM(dst+7, LOAD(p+7));\
+		}							\
+	    }								\
+	    _mm_sfence();						\
+	}								\
+}
+
+#define	LOAD128(p)	_mm_load_si128(p)
+#define	TOINT128(v)	_mm_cvtsi128_si32(v)
+SIMD_KERNELS(128, __m128i, "sse2", LOAD128, _mm_store_si128, 
+	     _mm_stream_si128, _mm_xor_si128, _mm_set1_epi32, TOINT128)
+
+#define	LOAD256(p)	_mm256_load_si256(p)
+#define	TOINT256(v)	_mm_cvtsi128_si32(_mm256_castsi256_si128(v))
+SIMD_KERNELS(256, __m256i, "avx2", LOAD256, _mm256_store_si256, 
+	     _mm256_stream_si256, _mm256_xor_si256, _mm256_set1_epi32, TOINT256)
+
+#define	LOAD512(p)	_mm512_load_si512((void*)(p))
+#define	STORE512(p, v)	_mm512_store_si512((void*)(p), v)
+#define	TOINT512(v)	_mm_cvtsi128_si32(_mm512_castsi512_si128(v))
+SIMD_KERNELS(512, __m512i, "avx512f", LOAD512, STORE512, 
+	     _mm512_stream_si512, _mm512_xor_si512, _mm512_set1_epi32, TOINT512)
+
+struct simd_kernel {
+	char		*name;
+	int		width;
+	benchmp_f	kernel;
+};
+
+static struct simd_kernel simd_kernels[] = {
+	{ "vrd", 128, vrd128 }, { "vrd", 256, vrd256 }, { "vrd", 512, vrd512 },
+	{ "vwr", 128, vwr128 }, { "vwr", 256, vwr256 }, { "vwr", 512, vwr512 },
+	{ "vcp", 128, vcp128 }, { "vcp", 256, vcp256 }, { "vcp", 512, vcp512 },
+	{ "vwrnt", 128, vwrnt128 }, { "vwrnt", 256, vwrnt256 }, 
+	{ "vwrnt", 512, vwrnt512 },
+	{ "vcpnt", 128, vcpnt128 }, { "vcpnt", 256, vcpnt256 }, 
+	{ "vcpnt", 512, vcpnt512 },
+	{ "vrdpf", 128, vrdpf128 }, { "vrdpf", 256, vrdpf256 }, 
+	{ "vrdpf", 512, vrdpf512 },
+	{ "vcppf", 128, vcppf128 }, { "vcppf", 256, vcppf256 }, 
+	{ "vcppf", 512, vcppf512 },
+	{ NULL, 0, NULL }
+};
+
+/*
+ * Widest vector width, in bits, that both the cpu and the OS support.
+ */
+static int
+simd_width()
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) return (512);
+	if (__builtin_cpu_supports("avx2")) return (256);
+	if (__builtin_cpu_supports("sse2")) return (128);
+	return (0);
+}
+
+/*
+ * Map "vcpnt" or "vcpnt256" to its kernel, or NULL if there is no such
+ * test or this cpu cannot run it.
+ */
+benchmp_f
+simd_kernel(char *what)
+{
+	int	i, width, max = simd_width();
+	size_t	len = strlen(what);
+
+	while (len > 0 && isdigit((int)what[len - 1])) --len;
+	width = what[len] ? atoi(&what[len]) : max;
+	if (width > max) {
+		fprintf(stderr, "bw_mem: %s needs %d bit vectors, "
+			"this cpu has %d\n", what, width, max);
+		exit(1);
+	}
+	for (i = 0; simd_kernels[i].name; ++i) {
+		if (strlen(simd_kernels[i].name) == len
+		    && !strncmp(simd_kernels[i].name, what, len)
+		    && simd_kernels[i].width == width)
+			return (simd_kernels[i].kernel);
+	}
+	return (NULL);
+}
+#else
+benchmp_f
+simd_kernel(char *what)
+{
+	return (NULL);
+}
+#endif /* HAVE_X86_SIMD */
+
 /*
  * Almost like bandwidth() in lib_timing.c, but we need to adjust
  * bandwidth based upon loop overhead.
  */
-void adjusted_bandwidth(uint64 time, uint64 bytes, uint64 iter, int parallel, double overhd, double avg_time_per_iter, double stddev_pct, int verbose)
+double adjusted_bandwidth(uint64 time, uint64 bytes, uint64 iter, int parallel, double overhd, double avg_time_per_iter, double stddev_pct, int verbose)
 {
 #define MB	(1000. * 1000.)
 	extern FILE *ftiming;
@@ -460,7 +747,7 @@ void adjusted_bandwidth(uint64 time, uint64 bytes, uint64 iter, int parallel, do
         mb = bytes / MB;
 
 	if (secs <= 0.)
-		return;
+		return (0.);
 
         if (!ftiming) ftiming = stderr;
 	if (mb < 1.) {
@@ -482,6 +769,7 @@ void adjusted_bandwidth(uint64 time, uint64 bytes, uint64 iter, int parallel, do
 		(void) fprintf(ftiming, " time_per_iter_stddev=%.2f%%", stddev_pct);
 	}
 	(void) fprintf(ftiming, "\n");
+	return (mb/secs);
 }
 
 void print_child_bandwidth(uint64 bytes, int parallel, double overhd)
@@ -52,7 +52,7 @@ typedef struct _state {
 	size_t	N;
 } state_t;
 
-void	adjusted_bandwidth(uint64 t, uint64 b, uint64 iter, int parallel, double ovrhd, double avg_time_per_iter, double stddev_pct, int verbose);
+double	adjusted_bandwidth(uint64 t, uint64 b, uint64 iter, int parallel, double ovrhd, double avg_time_per_iter, double stddev_pct, int verbose);
 void	print_child_bandwidth(uint64 bytes, int parallel, double overhd);
 
 int
@@ -63,6 +63,7 @@ main(int ac, char **av)
 	int	repetitions = TRIES;
 	int	verbose = 0;
 	size_t	nbytes;
+	double	bw;
 	state_t	state;
 	int	c;
 	char	*usage = "[-P <parallelism>] [-W <warmup>] [-N <repetitions>] [-v] <size> what [conflict]\nwhat: rd wr rdwr cp fwr frd fcp bzero bcopy\n<size> must be larger than 512\n";
@@ -138,8 +139,11 @@ main(int ac, char **av)
 	} else {
 		lmbench_usage(ac, av, usage);
 	}
-	adjusted_bandwidth(gettime(), nbytes, get_n(), parallel, state.overhead,
-			   get_avg_time_per_iter(), get_stddev_percent(), verbose);
+	bw = adjusted_bandwidth(gettime(), nbytes, get_n(), parallel, 
+				state.overhead, get_avg_time_per_iter(), 
+				get_stddev_percent(), verbose);
+	if (bw > 0.)
+		json_result(av[optind+1], bw, "MB/sec");
 	if (verbose) {
 		print_child_bandwidth(nbytes, parallel, state.overhead);
 	}
@@ -414,7 +418,7 @@ loop_bcopy(iter_t iterations, void *cookie)
  * Almost like bandwidth() in lib_timing.c, but we need to adjust
  * bandwidth based upon loop overhead.
  */
-void adjusted_bandwidth(uint64 time, uint64 bytes, uint64 iter, int parallel, double overhd, double avg_time_per_iter, double stddev_pct, int verbose)
+double adjusted_bandwidth(uint64 time, uint64 bytes, uint64 iter, int parallel, double overhd, double avg_time_per_iter, double stddev_pct, int verbose)
 {
 #define MB	(1000. * 1000.)
 	extern FILE *ftiming;
@@ -426,7 +430,7 @@ void adjusted_bandwidth(uint64 time, uint64 bytes, uint64 iter, int parallel, do
         mb = bytes / MB;
 
 	if (secs <= 0.)
-		return;
+		return (0.);
 
         if (!ftiming) ftiming = stderr;
 	if (mb < 1.) {
@@ -448,6 +452,7 @@ void adjusted_bandwidth(uint64 time, uint64 bytes, uint64 iter, int parallel, do
 		(void) fprintf(ftiming, " time_per_iter_stddev=%.2f%%", stddev_pct);
 	}
 	(void) fprintf(ftiming, "\n");
+	return (mb/secs);
 }
 
 void print_child_bandwidth(uint64 bytes, int parallel, double overhd)
@@ -2,8 +2,14 @@
  * bw_pipe.c - pipe bandwidth benchmark.
  *
  * Usage: bw_pipe [-m <message size>] [-M <total bytes>] \
+ *		[-x read|vmsplice|splice] \
  *		[-P <parallelism>] [-W <warmup>] [-N <repetitions>]
  *
+ * -x vmsplice has the writer map its buffer into the pipe with
+ * vmsplice() instead of copying it, and the reader read() it as usual.
+ * -x splice does the same, but the reader splice()s the data on to
+ * /dev/null, so nothing is copied at all.
+ *
  * Copyright (c) 1994 Larry McVoy.  
  * Copyright (c) 2002 Carl Staelin.
  * Distributed under the FSF GPL with additional restriction that results 
@@ -17,7 +23,11 @@ char	*id = "$Id$\n";
 #include "bench.h"
 
 void	reader(iter_t iterations, void* cookie);
-void	writer(int writefd, char* buf, size_t xfer);
+void	writer(int writefd, char* buf, size_t xfer, int mode);
+
+/* how the data is moved */
+enum { M_READ, M_VMSPLICE, M_SPLICE };
+char	*modes[] = { "read", "vmsplice", "splice", NULL };
 
 int	XFER	= 10*1024*1024;
 
@@ -27,6 +37,8 @@ struct _state {
 	size_t	bytes;	/* bytes to read/write in one iteration */
 	char	*buf;	/* buffer memory space */
 	int	readfd;
+	int	devnull;	/* where -x splice sends the data */
+	int	mode;
 	int	initerr;
 };
 
@@ -56,7 +68,7 @@ initialize(iter_t iterations, void *cookie)
 			return;
 		}
 		touch(state->buf, state->xfer);
-		writer(pipes[1], state->buf, state->xfer);
+		writer(pipes[1], state->buf, state->xfer, state->mode);
 		return;
 		/*NOTREACHED*/
 	    
@@ -71,6 +83,13 @@ initialize(iter_t iterations, void *cookie)
 	}
 	close(pipes[1]);
 	state->readfd = pipes[0];
+	state->devnull = -1;
+	if (state->mode == M_SPLICE
+	    && (state->devnull = open("/dev/null", O_WRONLY)) == -1) {
+		perror("/dev/null");
+		state->initerr = 5;
+		return;
+	}
 	state->buf = valloc(state->xfer + getpagesize());
 	if (state->buf == NULL) {
 		perror("parent: no memory");
@@ -89,6 +108,7 @@ cleanup(iter_t iterations, void * cookie)
 	if (iterations) return;
 
 	close(state->readfd);
+	if (state->devnull >= 0) close(state->devnull);
 	if (state->pid > 0) {
 		kill(state->pid, SIGKILL);
 		waitpid(state->pid, NULL, 0);
@@ -103,6 +123,21 @@ reader(iter_t iterations, void * cookie)
 	ssize_t	n;
 	struct _state* state = (struct _state*)cookie;
 
+#ifdef __linux__
+	if (state->mode == M_SPLICE) {
+		while (iterations-- > 0) {
+			for (done = 0; done < state->bytes; done += n) {
+				if ((n = splice(state->readfd, NULL,
+						state->devnull, NULL,
+						state->xfer, SPLICE_F_MOVE)) < 0) {
+					perror("bw_pipe: reader: error in splice");
+					exit(1);
+				}
+			}
+		}
+		return;
+	}
+#endif
 	while (iterations-- > 0) {
 		for (done = 0; done < state->bytes; done += n) {
 			if ((n = read(state->readfd, state->buf, state->xfer)) < 0) {
@@ -114,16 +149,30 @@ reader(iter_t iterations, void * cookie)
 }
 
 void
-writer(int writefd, char* buf, size_t xfer)
+writer(int writefd, char* buf, size_t xfer, int mode)
 {
 	size_t	done;
 	ssize_t	n;
+#ifdef __linux__
+	struct iovec iov;
+#endif
 
 	for ( ;; ) {
 #ifdef TOUCH
 		touch(buf, xfer);
 #endif
 		for (done = 0; done < xfer; done += n) {
+#ifdef __linux__
+			if (mode != M_READ) {
+				/* the pipe refers to buf's pages */
+				iov.iov_base = buf + done;
+				iov.iov_len = xfer - done;
+				if ((n = vmsplice(writefd, &iov, 1, 0)) < 0) {
+					exit(0);
+				}
+				continue;
+			}
+#endif
 			if ((n = write(writefd, buf, xfer - done)) < 0) {
 				exit(0);
 			}
@@ -139,13 +188,20 @@ main(int ac, char *av[])
 	int warmup = 0;
 	int repetitions = TRIES;
 	int c;
-	char* usage = "[-m <message size>] [-M <total bytes>] [-P <parallelism>] [-W <warmup>] [-N <repetitions>]\n";
+	char* usage = "[-m <message size>] [-M <total bytes>] [-x read|vmsplice|splice] [-P <parallelism>] [-W <warmup>] [-N <repetitions>]\n";
 
 	state.xfer = XFERSIZE;	/* per-packet size */
 	state.bytes = XFER;	/* total bytes per call */
+	state.mode = M_READ;
 
-	while (( c = getopt(ac, av, "m:M:P:W:N:")) != EOF) {
+	while (( c = getopt(ac, av, "m:M:x:P:W:N:")) != EOF) {
 		switch(c) {
+		case 'x':
+			for (c = 0; modes[c] && strcmp(modes[c], optarg); ++c)
+				;
+			if (!modes[c]) lmbench_usage(ac, av, usage);
+			state.mode = c;
+			break;
 		case 'm':
 			state.xfer = bytes(optarg);
 			break;
@@ -170,17 +226,27 @@ main(int ac, char *av[])
 	if (optind < ac) {
 		lmbench_usage(ac, av, usage);
 	}
+#ifndef __linux__
+	if (state.mode != M_READ) {
+		fprintf(stderr, "bw_pipe: -x %s needs Linux\n", modes[state.mode]);
+		exit(1);
+	}
+#endif
 	/* round up total byte count to a multiple of xfer */
 	if (state.bytes < state.xfer) {
 		state.bytes = state.xfer;
 	} else if (state.bytes % state.xfer) {
-		state.bytes += state.bytes - state.bytes % state.xfer;
+		state.bytes += state.xfer - state.bytes % state.xfer;
 	}
 	benchmp(initialize, reader, cleanup, MEDIUM, parallel, 
 		warmup, repetitions, &state);
 
 	if (gettime() > 0) {
-		fprintf(stderr, "Pipe bandwidth: ");
+		if (state.mode == M_READ) {
+			fprintf(stderr, "Pipe bandwidth: ");
+		} else {
+			fprintf(stderr, "Pipe %s bandwidth: ", modes[state.mode]);
+		}
 		mb(get_n() * parallel * state.bytes);
 	}
 	return(0);
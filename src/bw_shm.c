@@ -0,0 +1,221 @@
+/*
+ * bw_shm.c - shared memory ring bandwidth benchmark.
+ *
+ * Usage: bw_shm [-m <message size>] [-M <total bytes>] [-s <slots>] \
+ *		[-p <producers>] [-w spin|futex|eventfd] \
+ *		[-P <parallelism>] [-W <warmup>] [-N <repetitions>]
+ *
+ * The writers copy messages into a ring in shared memory (see
+ * lib_shm.c) and the reader copies them out again, which is the least
+ * work any message passing scheme can do if the data has to end up
+ * in a private buffer.  With -p greater than one, several writer
+ * processes share the ring.
+ *
+ * Copyright (c) 1994 Larry McVoy.  
+ * Copyright (c) 2002 Carl Staelin.
+ * Distributed under the FSF GPL with additional restriction that results 
+ * may published only if:
+ * (1) the benchmark is unmodified, and
+ * (2) the version in the sccsid below is included in the report.
+ */
+char	*id = "$Id$\n";
+
+#include "bench.h"
+
+void	reader(iter_t iterations, void* cookie);
+void	writer(shm_ring_t* ring, char* buf, int xfer);
+
+int	XFER	= 10*1024*1024;
+
+struct _state {
+	int	*pids;
+	int	producers;
+	int	nslots;
+	int	wait;
+	int	xfer;	/* bytes per message */
+	size_t	bytes;	/* bytes to read in one iteration */
+	char	*buf;	/* buffer memory space */
+	shm_ring_t *ring;
+	int	initerr;
+};
+
+void
+initialize(iter_t iterations, void *cookie)
+{
+	int	i;
+	struct _state* state = (struct _state*)cookie;
+
+	if (iterations) return;
+
+	state->initerr = 0;
+	state->ring = shm_ring_create(state->nslots, state->xfer,
+				      state->wait, state->producers > 1);
+	state->pids = (int*)calloc(state->producers, sizeof(int));
+	if (!state->ring || !state->pids) {
+		state->initerr = 1;
+		return;
+	}
+	handle_scheduler(benchmp_childid(), 0, state->producers);
+	for (i = 0; i < state->producers; ++i) {
+		switch (state->pids[i] = fork()) {
+		    case 0:
+			handle_scheduler(benchmp_childid(), i + 1,
+					 state->producers);
+			state->buf = valloc(state->xfer);
+			if (state->buf == NULL) {
+				perror("child: no memory");
+				exit(1);
+			}
+			touch(state->buf, state->xfer);
+			writer(state->ring, state->buf, state->xfer);
+			exit(0);
+			/*NOTREACHED*/
+
+		    case -1:
+			perror("fork");
+			state->initerr = 3;
+			return;
+			/*NOTREACHED*/
+
+		    default:
+			break;
+		}
+	}
+	state->buf = valloc(state->xfer + getpagesize());
+	if (state->buf == NULL) {
+		perror("parent: no memory");
+		state->initerr = 4;
+		return;
+	}
+	touch(state->buf, state->xfer + getpagesize());
+	state->buf += 128; /* destroy page alignment */
+}
+
+void
+cleanup(iter_t iterations, void * cookie)
+{
+	int	i;
+	struct _state* state = (struct _state*)cookie;
+
+	if (iterations) return;
+
+	for (i = 0; state->pids && i < state->producers; ++i) {
+		if (state->pids[i] > 0) {
+			kill(state->pids[i], SIGKILL);
+			waitpid(state->pids[i], NULL, 0);
+		}
+	}
+	if (state->pids) free(state->pids);
+	state->pids = NULL;
+	if (state->ring) shm_ring_destroy(state->ring);
+	state->ring = NULL;
+}
+
+void
+reader(iter_t iterations, void * cookie)
+{
+	size_t	done;
+	struct _state* state = (struct _state*)cookie;
+
+	while (iterations-- > 0) {
+		for (done = 0; done < state->bytes; ) {
+			done += shm_recv(state->ring, state->buf);
+		}
+	}
+}
+
+void
+writer(shm_ring_t* ring, char* buf, int xfer)
+{
+	for ( ;; ) {
+		shm_send(ring, buf, xfer);
+	}
+}
+
+int
+main(int ac, char *av[])
+{
+	struct _state state;
+	int	parallel = 1;
+	int	warmup = 0;
+	int	repetitions = TRIES;
+	int	c;
+	char	buf[256];
+	char*	usage = "[-m <message size>] [-M <total bytes>] [-s <slots>] [-p <producers>] [-w spin|futex|eventfd] [-P <parallelism>] [-W <warmup>] [-N <repetitions>]\n";
+
+	bzero(&state, sizeof(state));
+	state.xfer = XFERSIZE;	/* per-message size */
+	state.bytes = XFER;	/* total amount of data */
+	state.nslots = 16;
+	state.producers = 1;
+#ifdef __linux__
+	state.wait = SHM_FUTEX;
+#else
+	state.wait = SHM_SPIN;
+#endif
+
+	while (( c = getopt(ac, av, "m:M:s:p:w:P:W:N:")) != EOF) {
+		switch(c) {
+		case 'm':
+			state.xfer = bytes(optarg);
+			if (state.xfer <= 0) lmbench_usage(ac, av, usage);
+			break;
+		case 'M':
+			state.bytes = bytes(optarg);
+			break;
+		case 's':
+			state.nslots = atoi(optarg);
+			if (state.nslots <= 0) lmbench_usage(ac, av, usage);
+			break;
+		case 'p':
+			state.producers = atoi(optarg);
+			if (state.producers <= 0)
+				lmbench_usage(ac, av, usage);
+			break;
+		case 'w':
+			state.wait = shm_wait_mode(optarg);
+			if (state.wait < 0) lmbench_usage(ac, av, usage);
+			break;
+		case 'P':
+			parallel = atoi(optarg);
+			if (parallel <= 0)
+				lmbench_usage(ac, av, usage);
+			break;
+		case 'W':
+			warmup = atoi(optarg);
+			break;
+		case 'N':
+			repetitions = atoi(optarg);
+			break;
+		default:
+			lmbench_usage(ac, av, usage);
+			break;
+		}
+	}
+	if (optind < ac) {
+		lmbench_usage(ac, av, usage);
+	}
+
+	/* round up total byte count to a multiple of xfer */
+	if (state.bytes < state.xfer) {
+		state.bytes = state.xfer;
+	} else if (state.bytes % state.xfer) {
+		state.bytes += state.xfer - state.bytes % state.xfer;
+	}
+
+	benchmp(initialize, reader, cleanup, MEDIUM, parallel, 
+		warmup, repetitions, &state);
+
+	if (gettime() > 0) {
+		if (state.producers > 1) {
+			sprintf(buf, "Shared memory bandwidth using %s, %d writers",
+				shm_wait_modes[state.wait], state.producers);
+		} else {
+			sprintf(buf, "Shared memory bandwidth using %s",
+				shm_wait_modes[state.wait]);
+		}
+		fprintf(stderr, "%s: ", buf);
+		mb(get_n() * parallel * state.bytes);
+	}
+	return(0);
+}
@@ -2,9 +2,16 @@
  * bw_tcp.c - simple TCP bandwidth test
  *
  * Three programs in one -
- *	server usage:	bw_tcp -s
- *	client usage:	bw_tcp [-m <message size>] [-M <total bytes>] [-P <parallelism>] [-W <warmup>] [-N <repetitions>] hostname 
- *	shutdown:	bw_tcp -hostname
+ *	server usage:	bw_tcp [-e] -s
+ *	client usage:	bw_tcp [-m <message size>] [-M <total bytes>] [-c <connections>] [-b <socket buffer>] [-D] [-x write|zerocopy|sendfile|splice] [-P <parallelism>] [-W <warmup>] [-N <repetitions>] hostname
+ *	shutdown:	bw_tcp -S hostname
+ *
+ * The server forks a process per connection, or with -e handles all
+ * of them in one process with epoll.  Each client child may open
+ * several connections (-c), and reads from whichever are ready.  The
+ * client tells the server how to send on each connection: the socket
+ * buffer size, TCP_NODELAY and whether to use write(), MSG_ZEROCOPY,
+ * sendfile() or splice().
  *
  * Copyright (c) 2000 Carl Staelin.
  * Copyright (c) 1994 Larry McVoy.  Distributed under the FSF GPL with
@@ -16,6 +23,17 @@
 char	*id = "$Id$\n";
 #include "bench.h"
 
+#include <netinet/tcp.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#endif
+
+/* how the server sends */
+enum { SRC_WRITE, SRC_ZEROCOPY, SRC_SENDFILE, SRC_SPLICE };
+char	*sources[] = { "write", "zerocopy", "sendfile", "splice", NULL };
+
 typedef struct _state {
 	int	sock;
 	uint64	move;
@@ -23,14 +41,40 @@ typedef struct _state {
 	char	*server;
 	int	fd;
 	char	*buf;
+	int	conns;		/* connections per child */
+	int	sockbuf;	/* SO_SNDBUF/SO_RCVBUF, 0 for the default */
+	int	nodelay;
+	int	src;
+	int	*socks;
+	int	epfd;
 } state_t;
 
-void	server_main();
+/* one connection on the server */
+typedef struct _conn {
+	int	sock;
+	int	src;
+	size_t	m;
+	char	*buf;
+	int	file;		/* m bytes to sendfile() or splice() from */
+	off_t	off;
+	int	pipe[2];	/* for splice() */
+	size_t	inpipe;
+	char	ctl[100];
+	int	nctl;
+} conn_t;
+
+void	server_main(int epoll);
+void	server_epoll(int data);
 void	client_main(int parallel, state_t *state);
 void	source(int data);
+int	source_setup(conn_t *c);
+ssize_t	source_send(conn_t *c, int nonblock);
+void	source_reap(conn_t *c);
+void	source_close(conn_t *c);
 
 void	initialize(iter_t iterations, void* cookie);
 void	loop_transfer(iter_t iterations, void *cookie);
+void	loop_transfer_many(iter_t iterations, void *cookie);
 void	cleanup(iter_t iterations, void* cookie);
 
 int
@@ -40,21 +84,24 @@ main(int ac, char **av)
 	int	warmup = LONGER;
 	int	repetitions = TRIES;
 	int	shutdown = 0;
+	int	server = 0, epoll = 0;
 	state_t state;
-	char	*usage = "-s\n OR [-m <message size>] [-M <bytes to move>] [-P <parallelism>] [-W <warmup>] [-N <repetitions>] server\n OR -S serverhost\n";
+	char	*usage = "[-e] -s\n OR [-m <message size>] [-M <bytes to move>] [-c <connections>] [-b <socket buffer>] [-D] [-x write|zerocopy|sendfile|splice] [-P <parallelism>] [-W <warmup>] [-N <repetitions>] server\n OR -S serverhost\n";
 	int	c;
-	
+
+	bzero(&state, sizeof(state));
 	state.msize = 0;
 	state.move = 0;
+	state.conns = 1;
 
 	/* Rest is client argument processing */
-	while (( c = getopt(ac, av, "sS:m:M:P:W:N:")) != EOF) {
+	while (( c = getopt(ac, av, "esS:m:M:P:W:N:c:b:Dx:")) != EOF) {
 		switch(c) {
+		case 'e': /* epoll server */
+			epoll = 1;
+			break;
 		case 's': /* Server */
-			if (fork() == 0) {
-				server_main();
-			}
-			exit(0);
+			server = 1;
 			break;
 		case 'S': /* shutdown serverhost */
 		{
@@ -69,6 +116,22 @@ main(int ac, char **av)
 		case 'M':
 			state.move = bytes(optarg);
 			break;
+		case 'c':
+			state.conns = atoi(optarg);
+			if (state.conns <= 0) lmbench_usage(ac, av, usage);
+			break;
+		case 'b':
+			state.sockbuf = bytes(optarg);
+			break;
+		case 'D':
+			state.nodelay = 1;
+			break;
+		case 'x':
+			for (c = 0; sources[c] && !streq(sources[c], optarg); ++c)
+				;
+			if (!sources[c]) lmbench_usage(ac, av, usage);
+			state.src = c;
+			break;
 		case 'P':
 			parallel = atoi(optarg);
 			if (parallel <= 0) lmbench_usage(ac, av, usage);
@@ -85,6 +148,13 @@ main(int ac, char **av)
 		}
 	}
 
+	if (server) {
+		if (fork() == 0) {
+			server_main(epoll);
+		}
+		exit(0);
+	}
+
 	if (optind < ac - 2 || optind >= ac) {
 		lmbench_usage(ac, av, usage);
 	}
@@ -104,13 +174,22 @@ main(int ac, char **av)
 		state.move += state.msize - state.move % state.msize;
 	}
 
+#ifndef __linux__
+	if (state.conns > 1) {
+		fprintf(stderr, "bw_tcp: -c needs epoll\n");
+		exit(1);
+	}
+#endif
+	if (state.conns > 1) morefds();
+
 	/*
-	 * Default is to warmup the connection for seven seconds, 
+	 * Default is to warmup the connection for seven seconds,
 	 * then measure performance over each timing interval.
-	 * This minimizes the effect of opening and initializing TCP 
+	 * This minimizes the effect of opening and initializing TCP
 	 * connections.
 	 */
-	benchmp(initialize, loop_transfer, cleanup, 
+	benchmp(initialize,
+		state.conns > 1 ? loop_transfer_many : loop_transfer, cleanup,
 		0, parallel, warmup, repetitions, &state);
 	if (gettime() > 0) {
 		fprintf(stderr, "%.6f ", state.msize / (1000. * 1000.));
@@ -121,7 +200,7 @@ main(int ac, char **av)
 void
 initialize(iter_t iterations, void *cookie)
 {
-	int	c;
+	int	i, sock;
 	char	buf[100];
 	state_t *state = (state_t *) cookie;
 
@@ -134,19 +213,60 @@ initialize(iter_t iterations, void *cookie)
 	}
 	touch(state->buf, state->msize);
 
-	state->sock = tcp_connect(state->server, TCP_DATA, SOCKOPT_READ|SOCKOPT_WRITE|SOCKOPT_REUSE);
-	if (state->sock < 0) {
-		perror("socket connection");
+	state->socks = (int*)malloc(state->conns * sizeof(int));
+	if (!state->socks) {
+		perror("malloc");
 		exit(1);
 	}
-	sprintf(buf, "%lu", state->msize);
-	if (write(state->sock, buf, strlen(buf) + 1) != strlen(buf) + 1) {
-		perror("control write");
-		exit(1);
+	for (i = 0; i < state->conns; ++i) {
+		sock = tcp_connect(state->server, TCP_DATA,
+			state->sockbuf ? SOCKOPT_REUSE
+			: SOCKOPT_READ|SOCKOPT_WRITE|SOCKOPT_REUSE);
+		if (sock < 0) {
+			perror("socket connection");
+			exit(1);
+		}
+		if (state->sockbuf)
+			setsockopt(sock, SOL_SOCKET, SO_RCVBUF,
+				   &state->sockbuf, sizeof(int));
+		if (state->nodelay)
+			setsockopt(sock, IPPROTO_TCP, TCP_NODELAY,
+				   &state->nodelay, sizeof(int));
+		sprintf(buf, "%lu %d %d %d", (unsigned long)state->msize,
+			state->src, state->sockbuf, state->nodelay);
+		if (write(sock, buf, strlen(buf) + 1) != strlen(buf) + 1) {
+			perror("control write");
+			exit(1);
+		}
+		state->socks[i] = sock;
+	}
+	state->sock = state->socks[0];
+	state->epfd = -1;
+
+#ifdef __linux__
+	if (state->conns > 1) {
+		struct epoll_event ev;
+
+		state->epfd = epoll_create(state->conns);
+		if (state->epfd < 0) {
+			perror("epoll_create");
+			exit(1);
+		}
+		for (i = 0; i < state->conns; ++i) {
+			fcntl(state->socks[i], F_SETFL, O_NONBLOCK);
+			ev.events = EPOLLIN;
+			ev.data.fd = state->socks[i];
+			if (epoll_ctl(state->epfd, EPOLL_CTL_ADD,
+				      state->socks[i], &ev) < 0) {
+				perror("epoll_ctl");
+				exit(1);
+			}
+		}
 	}
+#endif
 }
 
-void 
+void
 loop_transfer(iter_t iterations, void *cookie)
 {
 	int	c;
@@ -163,19 +283,52 @@ loop_transfer(iter_t iterations, void *cookie)
 	}
 }
 
+/*
+ * Move state->move bytes in all, from whichever connections are ready
+ */
+void
+loop_transfer_many(iter_t iterations, void *cookie)
+{
+#ifdef __linux__
+	int	c, i, n;
+	uint64	todo;
+	state_t *state = (state_t *) cookie;
+	struct epoll_event ev[256];
+
+	while (iterations-- > 0) {
+		for (todo = state->move; todo > 0; ) {
+			n = epoll_wait(state->epfd, ev, 256, -1);
+			for (i = 0; i < n && todo > 0; ++i) {
+				c = read(ev[i].data.fd, state->buf, state->msize);
+				if (c <= 0) {
+					if (c < 0 && errno == EAGAIN) continue;
+					exit(1);
+				}
+				todo -= (c > todo) ? todo : c;
+			}
+		}
+	}
+#endif
+}
+
 void
 cleanup(iter_t iterations, void* cookie)
 {
+	int	i;
 	state_t *state = (state_t *) cookie;
 
 	if (iterations) return;
 
-	/* close connection */
-	(void)close(state->sock);
+	/* close connections */
+	if (state->epfd >= 0) close(state->epfd);
+	for (i = 0; i < state->conns; ++i)
+		(void)close(state->socks[i]);
+	free(state->socks);
+	state->socks = NULL;
 }
 
 void
-server_main()
+server_main(int epoll)
 {
 	int	data, newdata;
 
@@ -187,6 +340,10 @@ server_main()
 		exit(1);
 	}
 
+#ifdef __linux__
+	if (epoll) server_epoll(data);
+#endif
+
 	signal(SIGCHLD, sigchld_wait_handler);
 	for ( ;; ) {
 		newdata = tcp_accept(data, SOCKOPT_WRITE);
@@ -205,47 +362,274 @@ server_main()
 }
 
 /*
- * Read the message size.  Keep transferring 
+ * A single process server: every connection is non-blocking and is
+ * sent to whenever it has room.
+ */
+void
+server_epoll(int data)
+{
+#ifdef __linux__
+	int	i, n, sock, epfd;
+	ssize_t	c;
+	conn_t	*conn;
+	struct epoll_event ev, events[256];
+
+	morefds();
+	signal(SIGPIPE, SIG_IGN);
+	fcntl(data, F_SETFL, O_NONBLOCK);
+	epfd = epoll_create(256);
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, data, &ev) < 0) {
+		perror("epoll");
+		exit(1);
+	}
+
+	for ( ;; ) {
+		n = epoll_wait(epfd, events, 256, -1);
+		for (i = 0; i < n; ++i) {
+			conn = (conn_t*)events[i].data.ptr;
+			if (conn == NULL) {
+				/* new connections */
+				while ((sock = accept(data, 0, 0)) >= 0) {
+					conn = (conn_t*)calloc(1, sizeof(conn_t));
+					if (!conn) {
+						close(sock);
+						continue;
+					}
+					conn->sock = sock;
+					conn->file = conn->pipe[0] = conn->pipe[1] = -1;
+					fcntl(sock, F_SETFL, O_NONBLOCK);
+					ev.events = EPOLLIN;
+					ev.data.ptr = conn;
+					epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev);
+				}
+				continue;
+			}
+			if (conn->m == 0) {
+				/* read the control message */
+				c = read(conn->sock, conn->ctl + conn->nctl,
+					 sizeof(conn->ctl) - 1 - conn->nctl);
+				if (c < 0 && errno == EAGAIN) continue;
+				if (c > 0) conn->nctl += c;
+				if (c > 0 && !memchr(conn->ctl, '\0', conn->nctl)
+				    && conn->nctl < sizeof(conn->ctl) - 1)
+					continue;
+				/* old clients (and -S) send no NUL and hang up */
+				if (c <= 0 && conn->nctl == 0) {
+					source_close(conn);
+					free(conn);
+					continue;
+				}
+				if (source_setup(conn) < 0) {
+					/* a request to shut down the server */
+					tcp_done(TCP_DATA);
+					exit(0);
+				}
+				ev.events = EPOLLOUT;
+				ev.data.ptr = conn;
+				epoll_ctl(epfd, EPOLL_CTL_MOD, conn->sock, &ev);
+				continue;
+			}
+			/* send until the socket is full, but not forever */
+			for (sock = 0; sock < 16; ++sock) {
+				if ((c = source_send(conn, 1)) > 0) continue;
+				if (c < 0 && (errno == EAGAIN || errno == ENOBUFS))
+					break;
+				source_close(conn);
+				free(conn);
+				break;
+			}
+		}
+	}
+#endif
+}
+
+/*
+ * Read the message size.  Keep transferring
  * data in message-size sized packets until
  * the socket goes away.
  */
 void
 source(int data)
 {
-	size_t	count, m;
-	unsigned long	nbytes;
-	char	*buf, scratch[100];
+	ssize_t	n;
+	conn_t	conn;
 
 	/*
 	 * read the message size
 	 */
-	bzero(scratch, 100);
-	if (read(data, scratch, 100) <= 0) {
+	bzero(&conn, sizeof(conn));
+	conn.sock = data;
+	conn.file = conn.pipe[0] = conn.pipe[1] = -1;
+	if (read(data, conn.ctl, sizeof(conn.ctl) - 1) <= 0) {
 		perror("control nbytes");
 		exit(7);
 	}
-	sscanf(scratch, "%lu", &nbytes);
-	m = nbytes;
 
 	/*
 	 * A hack to allow turning off the absorb daemon.
 	 */
-     	if (m == 0) {
+     	if (source_setup(&conn) < 0) {
 		tcp_done(TCP_DATA);
 		kill(getppid(), SIGTERM);
 		exit(0);
 	}
 
-	buf = valloc(m);
-	bzero(buf, m);
-
 	/*
 	 * Keep sending messages until the connection is closed
 	 */
-	while (write(data, buf, m) == m) {
+	for ( ;; ) {
+		if ((n = source_send(&conn, 0)) > 0) {
 #ifdef	TOUCH
-		touch(buf, m);
+			touch(conn.buf, conn.m);
+#endif
+			continue;
+		}
+		if (n < 0 && errno == ENOBUFS) {
+			/* too many zerocopy sends in flight */
+			struct pollfd p;
+			p.fd = data;
+			p.events = 0;
+			poll(&p, 1, 10);
+			continue;
+		}
+		break;
+	}
+	source_close(&conn);
+}
+
+/*
+ * Parse the control message, "<size> [<source> <sockbuf> <nodelay>]",
+ * and get ready to send.  Returns -1 for a size of zero, which asks
+ * the server to exit.
+ */
+int
+source_setup(conn_t *c)
+{
+	unsigned long	m;
+	int	sockbuf = 0, nodelay = 0, one = 1;
+
+	c->ctl[sizeof(c->ctl) - 1] = '\0';
+	m = 0;
+	c->src = SRC_WRITE;
+	sscanf(c->ctl, "%lu %d %d %d", &m, &c->src, &sockbuf, &nodelay);
+	if (m == 0) return -1;
+	c->m = m;
+
+	if (sockbuf)
+		setsockopt(c->sock, SOL_SOCKET, SO_SNDBUF, &sockbuf, sizeof(int));
+	if (nodelay)
+		setsockopt(c->sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(int));
+
+	c->buf = valloc(m);
+	if (!c->buf) {
+		perror("valloc");
+		exit(1);
+	}
+	bzero(c->buf, m);
+
+	switch (c->src) {
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+	case SRC_ZEROCOPY:
+		if (setsockopt(c->sock, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0) {
+			perror("SO_ZEROCOPY");
+			c->src = SRC_WRITE;
+		}
+		break;
+#endif
+#ifdef __linux__
+	case SRC_SPLICE:
+		if (pipe(c->pipe) < 0) {
+			perror("pipe");
+			exit(1);
+		}
+		/* fall through */
+	case SRC_SENDFILE:
+	{
+		FILE	*f = tmpfile();
+
+		if (!f || fwrite(c->buf, 1, m, f) != m || fflush(f)) {
+			perror("bw_tcp: tmpfile");
+			exit(1);
+		}
+		c->file = dup(fileno(f));
+		fclose(f);
+		break;
+	}
 #endif
+	default:
+		c->src = SRC_WRITE;
+		break;
 	}
-	free(buf);
+	return 0;
+}
+
+/*
+ * Send (up to) one message.  Returns the bytes sent, or -1 with errno
+ * set (EAGAIN if the socket is non-blocking and full).
+ */
+ssize_t
+source_send(conn_t *c, int nonblock)
+{
+	ssize_t	n;
+
+	switch (c->src) {
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+	case SRC_ZEROCOPY:
+		source_reap(c);
+		return send(c->sock, c->buf, c->m, MSG_ZEROCOPY|MSG_NOSIGNAL
+			    | (nonblock ? MSG_DONTWAIT : 0));
+#endif
+#ifdef __linux__
+	case SRC_SENDFILE:
+		n = sendfile(c->sock, c->file, &c->off, c->m - c->off);
+		if (c->off >= c->m) c->off = 0;
+		return n;
+	case SRC_SPLICE:
+		if (c->inpipe == 0) {
+			c->off = 0;
+			n = splice(c->file, &c->off, c->pipe[1], NULL, c->m,
+				   SPLICE_F_MOVE);
+			if (n <= 0) return -1;
+			c->inpipe = n;
+		}
+		n = splice(c->pipe[0], NULL, c->sock, NULL, c->inpipe,
+			   SPLICE_F_MOVE | (nonblock ? SPLICE_F_NONBLOCK : 0));
+		if (n > 0) c->inpipe -= n;
+		return n;
+#endif
+	default:
+		return write(c->sock, c->buf, c->m);
+	}
+}
+
+/*
+ * Throw away the MSG_ZEROCOPY completion notifications; the buffer
+ * is never changed so there is nothing to wait for.
+ */
+void
+source_reap(conn_t *c)
+{
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+	char	control[256];
+	struct msghdr msg;
+
+	bzero(&msg, sizeof(msg));
+	do {
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+	} while (recvmsg(c->sock, &msg, MSG_ERRQUEUE|MSG_DONTWAIT) >= 0);
+#endif
+}
+
+void
+source_close(conn_t *c)
+{
+	close(c->sock);
+	if (c->file >= 0) close(c->file);
+	if (c->pipe[0] >= 0) close(c->pipe[0]);
+	if (c->pipe[1] >= 0) close(c->pipe[1]);
+	if (c->buf) free(c->buf);
+	c->buf = NULL;
 }
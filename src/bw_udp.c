@@ -2,9 +2,19 @@
  * bw_udp.c - simple UDP bandwidth test
  *
  * Three programs in one -
- *	server usage:	bw_tcp -s
- *	client usage:	bw_tcp [-m <message size>] [-P <parallelism>] [-W <warmup>] [-N <repetitions>] hostname [bytes]
- *	shutdown:	bw_tcp -S hostname
+ *	server usage:	bw_udp [-b <batch>] [-G] -s
+ *	client usage:	bw_udp [-m <message size>] [-b <batch>] [-g] [-P <parallelism>] [-W <warmup>] [-N <repetitions>] hostname [bytes]
+ *	shutdown:	bw_udp -S hostname
+ *
+ * The client sends <bytes> as <message size> datagrams and then asks
+ * the server how many of them arrived, so the result is what got
+ * through, and the datagrams which didn't are reported as drops.
+ *
+ * -b sends (or on the server, receives) up to <batch> datagrams per
+ * system call with sendmmsg() and recvmmsg().  -g has the client hand
+ * the kernel up to 64 datagrams at once in one buffer which it splits
+ * into datagrams itself (UDP_SEGMENT, or GSO), and -G has the server
+ * take them in the same way (UDP_GRO).  All three are Linux only.
  *
  * Copyright (c) 2000 Carl Staelin.
  * Copyright (c) 1994 Larry McVoy.  Distributed under the FSF GPL with
@@ -15,23 +25,59 @@
  */
 char	*id = "$Id$\n";
 #include "bench.h"
+#include <poll.h>
+#ifdef __linux__
+#include <netinet/udp.h>
+#ifndef SOL_UDP
+#define	SOL_UDP		17
+#endif
+#ifndef UDP_SEGMENT
+#define	UDP_SEGMENT	103
+#endif
+#ifndef UDP_GRO
+#define	UDP_GRO		104
+#endif
+#endif
+
+#define	MAX_MSIZE	65507		/* largest UDP payload */
+#define	MAX_GSO		64		/* datagrams per UDP_SEGMENT send */
+#define	MAXBATCH	1024
+#define	MAXCLIENTS	256
 
-#define MAX_MSIZE (10 * 1024 * 1024)
+/*
+ * Every datagram starts with a magic number, so the server can tell
+ * data from requests even when UDP_GRO hands it several at once.
+ */
+#define	BW_UDP_DATA	0x62776461
+#define	BW_UDP_CTL	0x6277636c
+
+enum { OP_REPORT, OP_EXIT };
+
+typedef struct {
+	uint32_t	magic;
+	uint32_t	op;
+	uint32_t	seq;
+	uint32_t	count;		/* datagrams received from this client */
+} ctl_t;
 
 typedef struct _state {
 	int	sock;
 	int	seq;
 	long	move;
 	long	msize;
+	int	batch;		/* datagrams or GSO buffers per sendmmsg */
+	int	gso;		/* datagrams per GSO buffer, or 0 */
 	char	*server;
-	int	fd;
 	char	*buf;
+	uint32_t count;		/* the server's count after the last iteration */
+	uint64	*counts;	/* sent and received by each child, shared */
 } state_t;
 
-void	server_main();
-void	client_main(int parallel, state_t *state);
+void	server_main(int batch, int gro);
+void	server_ctl(int sock, char *buf, struct sockaddr_in *it, uint32_t count);
 void	init(iter_t iterations, void *cookie);
 void	cleanup(iter_t iterations, void *cookie);
+uint32_t	report(state_t *state);
 
 void	loop_transfer(iter_t iterations, void *cookie);
 
@@ -41,38 +87,62 @@ main(int ac, char **av)
 	int	parallel = 1;
 	int	warmup = 0;
 	int	repetitions = TRIES;
-	int	server = 0;
+	int	server = 0, gro = 0;
 	state_t state;
-	char	*usage = "-s\n OR [-m <message size>] [-W <warmup>] [-N <repetitions>] server [size]\n OR -S serverhost\n";
-	int	c;
-	uint64	usecs;
-	
-	state.msize = 0;
+	char	*usage = "[-b <batch>] [-G] -s\n OR [-m <message size>] [-b <batch>] [-g] [-P <parallelism>] [-W <warmup>] [-N <repetitions>] server [size]\n OR -S serverhost\n";
+	int	c, i;
+	uint64	sent, received;
+	double	secs, tx, rx, drop;
+	char	name[256];
+
+	bzero(&state, sizeof(state));
+	state.msize = 1472;	/* fills a 1500 byte Ethernet frame */
 	state.move = 10*1024*1024;
+	state.batch = 1;
 
 	/* Rest is client argument processing */
-	while (( c = getopt(ac, av, "sS:m:W:N:")) != EOF) {
+	while (( c = getopt(ac, av, "sS:m:b:gGP:W:N:")) != EOF) {
 		switch(c) {
 		case 's': /* Server */
-			if (fork() == 0) {
-				server_main();
-			}
-			exit(0);
+			server = 1;
+			break;
 		case 'S': /* shutdown serverhost */
 		{
-			int seq, n;
+			ctl_t	ctl;
 			int sock = udp_connect(optarg,
-					       UDP_XACT,
+					       UDP_DATA,
 					       SOCKOPT_NONE);
-			for (n = -1; n > -5; --n) {
-				seq = htonl(n);
-				(void) send(sock, &seq, sizeof(int), 0);
+
+			bzero(&ctl, sizeof(ctl));
+			ctl.magic = htonl(BW_UDP_CTL);
+			ctl.op = htonl(OP_EXIT);
+			for (i = 0; i < 4; ++i) {
+				(void) send(sock, &ctl, sizeof(ctl), 0);
 			}
 			close(sock);
 			exit (0);
 		}
 		case 'm':
-			state.msize = atoi(optarg);
+			state.msize = bytes(optarg);
+			if (state.msize < sizeof(uint32_t)
+			    || state.msize > MAX_MSIZE)
+				lmbench_usage(ac, av, usage);
+			break;
+		case 'b':
+			state.batch = atoi(optarg);
+			if (state.batch <= 0 || state.batch > MAXBATCH)
+				lmbench_usage(ac, av, usage);
+			break;
+		case 'g':
+			state.gso = 1;
+			break;
+		case 'G':
+			gro = 1;
+			break;
+		case 'P':
+			parallel = atoi(optarg);
+			if (parallel <= 0)
+				lmbench_usage(ac, av, usage);
 			break;
 		case 'W':
 			warmup = atoi(optarg);
@@ -85,6 +155,19 @@ main(int ac, char **av)
 			break;
 		}
 	}
+#ifndef __linux__
+	if (state.batch > 1 || state.gso || gro) {
+		fprintf(stderr, "bw_udp: -b, -g and -G need Linux\n");
+		exit(1);
+	}
+#endif
+
+	if (server) {
+		if (fork() == 0) {
+			server_main(state.batch, gro);
+		}
+		exit(0);
+	}
 
 	if (optind < ac - 2 || optind >= ac) {
 		lmbench_usage(ac, av, usage);
@@ -94,68 +177,177 @@ main(int ac, char **av)
 	if (optind < ac) {
 		state.move = bytes(av[optind]);
 	}
-	if (state.msize == 0) {
-		state.msize = state.move;
+	if (state.gso) {
+		/* as many as fit in the largest datagram */
+		state.gso = MAX_MSIZE / state.msize;
+		if (state.gso > MAX_GSO) state.gso = MAX_GSO;
 	}
 	/* make the number of bytes to move a multiple of the message size */
-	if (state.move % state.msize) {
-		state.move += state.move - state.move % state.msize;
+	if (state.move < state.msize) {
+		state.move = state.msize;
+	} else if (state.move % state.msize) {
+		state.move += state.msize - state.move % state.msize;
 	}
 
-	state.buf = valloc(state.msize);
-	if (!state.buf) {
-		perror("valloc");
+	state.counts = (uint64*)mmap(0, 2 * parallel * sizeof(uint64),
+				     PROT_READ|PROT_WRITE,
+				     MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (state.counts == (uint64*)MAP_FAILED) {
+		perror("mmap");
 		exit(1);
 	}
-	touch(state.buf, state.msize);
+	bzero(state.counts, 2 * parallel * sizeof(uint64));
 
 	/*
-	 * Make one run take at least 5 seconds.
-	 * This minimizes the effect of connect & reopening TCP windows.
+	 * There is no connection to warm up, so the usual timing
+	 * interval will do.
 	 */
-	benchmp(init, loop_transfer, cleanup, LONGER, parallel, warmup, repetitions, &state );
+	benchmp(init, loop_transfer, cleanup, 0, parallel, warmup, repetitions, &state );
 
-out:	(void)fprintf(stderr, "socket UDP bandwidth using %s: ", state.server);
-	mb(state.move * get_n() * parallel);
+	for (sent = received = 0, i = 0; i < parallel; ++i) {
+		sent += state.counts[2 * i];
+		received += state.counts[2 * i + 1];
+	}
+	if (sent == 0 || (secs = gettime() / 1000000.) == 0.) return (0);
+
+	/* the drop rate is over every run, timed or not */
+	(void)fprintf(stderr, "socket UDP bandwidth using %s: ", state.server);
+	mb((uint64)((double)state.move * get_n() * parallel
+		    * received / sent));
+	tx = (double)state.move / state.msize * get_n() * parallel / secs;
+	rx = tx * received / sent;
+	drop = 100. * (sent - received) / sent;
+	(void)fprintf(stderr, "UDP packets using %s: %.0f sent/sec "
+		      "%.0f received/sec %.2f%% dropped\n", state.server,
+		      tx, rx, drop);
+	sprintf(name, "UDP packets using %s sent", state.server);
+	json_result(name, tx, "packets/sec");
+	sprintf(name, "UDP packets using %s received", state.server);
+	json_result(name, rx, "packets/sec");
+	sprintf(name, "UDP packets using %s dropped", state.server);
+	json_result(name, drop, "percent");
+	return (0);
 }
 
 void
 init(iter_t iterations, void* cookie)
 {
 	state_t *state = (state_t *) cookie;
+	int	i, n = state->gso ? state->gso : 1;
+	uint32_t magic = htonl(BW_UDP_DATA);
 
 	if (iterations) return;
 
-	state->sock = udp_connect(state->server, UDP_XACT, SOCKOPT_NONE);
+	state->sock = udp_connect(state->server, UDP_DATA, SOCKOPT_WRITE);
 	state->seq = 0;
-	state->buf = (char*)malloc(state->msize);
+	state->buf = (char*)valloc(n * state->msize);
+	if (!state->buf) {
+		perror("valloc");
+		exit(1);
+	}
+	touch(state->buf, n * state->msize);
+	for (i = 0; i < n; ++i) {
+		bcopy(&magic, state->buf + i * state->msize, sizeof(magic));
+	}
+#ifdef __linux__
+	if (state->gso) {
+		i = state->msize;
+		if (setsockopt(state->sock, SOL_UDP, UDP_SEGMENT,
+			       &i, sizeof(i)) < 0) {
+			perror("bw_udp: UDP_SEGMENT");
+			exit(1);
+		}
+	}
+#endif
+	state->count = report(state);
+}
+
+/*
+ * Ask the server how many datagrams it has had from us, asking again
+ * if either the request or the answer is lost.
+ */
+uint32_t
+report(state_t *state)
+{
+	ctl_t	ctl, ans;
+	struct pollfd p;
+
+	bzero(&ctl, sizeof(ctl));
+	ctl.magic = htonl(BW_UDP_CTL);
+	ctl.op = htonl(OP_REPORT);
+	ctl.seq = htonl(++state->seq);
+	p.fd = state->sock;
+	p.events = POLLIN;
+	for (;;) {
+		if (send(state->sock, &ctl, sizeof(ctl), 0) != sizeof(ctl)
+		    && errno != ENOBUFS) {
+			perror("bw_udp client: send failed");
+			exit(5);
+		}
+		while (poll(&p, 1, 100) > 0) {
+			if (recv(state->sock, &ans, sizeof(ans), 0)
+			    == sizeof(ans) && ans.seq == ctl.seq) {
+				return (ntohl(ans.count));
+			}
+		}
+	}
 }
 
 void
 loop_transfer(iter_t iterations, void *cookie)
 {
 	state_t *state = (state_t *) cookie;
-	char	*server = state->server;
 	int	sock = state->sock;
-	long	control[2], nbytes;
+	int	i, n, per = state->gso ? state->gso : 1;
+	long	left, packets = state->move / state->msize;
+	uint32_t	count;
+	uint64	sent = 0, received = 0;
+#ifdef __linux__
+	struct mmsghdr msgs[MAXBATCH];
+	struct iovec iov[MAXBATCH];
 
-	nbytes = state->move;
-	control[0] = state->move;
-	control[1] = state->msize;
+	bzero(msgs, state->batch * sizeof(struct mmsghdr));
+	for (i = 0; i < state->batch; ++i) {
+		iov[i].iov_base = state->buf;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+#endif
 
 	while (iterations-- > 0) {
-		if (send(sock, control, 2 * sizeof(long), 0) != 2 * sizeof(long)) {
-			perror("bw_udp client: send failed");
-			exit(5);
-		}
-		while (nbytes > 0) {
-			if (recv(sock, state->buf, state->msize, 0) != state->msize) {
-				perror("bw_udp client: recv failed");
+		for (left = packets; left > 0; ) {
+#ifdef __linux__
+			if (state->batch > 1) {
+				for (i = 0, n = 0; i < state->batch && n < left; ++i) {
+					iov[i].iov_len = (left - n < per ?
+						left - n : per) * state->msize;
+					n += iov[i].iov_len / state->msize;
+				}
+				if ((i = sendmmsg(sock, msgs, i, 0)) <= 0) {
+					if (errno == ENOBUFS) continue;
+					perror("bw_udp client: sendmmsg failed");
+					exit(5);
+				}
+				while (i-- > 0)
+					left -= iov[i].iov_len / state->msize;
+				continue;
+			}
+#endif
+			n = left < per ? left : per;
+			if (send(sock, state->buf, n * state->msize, 0) < 0) {
+				if (errno == ENOBUFS) continue;
+				perror("bw_udp client: send failed");
 				exit(5);
 			}
-			nbytes -= state->msize;
+			left -= n;
 		}
+		count = report(state);
+		sent += packets;
+		received += (uint32_t)(count - state->count);
+		state->count = count;
 	}
+	state->counts[2 * benchmp_childid()] += sent;
+	state->counts[2 * benchmp_childid() + 1] += received;
 }
 
 void
@@ -169,35 +361,137 @@ cleanup(iter_t iterations, void* cookie)
 	free(state->buf);
 }
 
+/*
+ * Count the datagrams from each client, and answer its requests.
+ */
 void
-server_main()
+server_main(int batch, int gro)
 {
-	char	*buf = (char*)valloc(MAX_MSIZE);
-	int     sock, namelen, seq = 0;
-	long	nbytes, msize;
-	struct sockaddr_in it;
+	int     sock, i, j, k, n, len, seg, nclients = 0;
+	uint32_t magic;
+	char	*bufs;
+	struct sockaddr_in it[MAXBATCH];
+	struct {
+		struct sockaddr_in addr;
+		uint32_t	count;
+	} clients[MAXCLIENTS];
+#ifdef __linux__
+	struct mmsghdr msgs[MAXBATCH];
+	struct iovec iov[MAXBATCH];
+	union {
+		char	buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} cmsgs[MAXBATCH];
+	struct cmsghdr *cmsg;
+#endif
 
 	GO_AWAY;
 
-	sock = udp_server(UDP_XACT, SOCKOPT_NONE);
+	sock = udp_server(UDP_DATA, SOCKOPT_READ);
+	bufs = (char*)valloc(batch * (MAX_MSIZE + 1));
+	if (!bufs) {
+		perror("bw_udp server: valloc");
+		exit(1);
+	}
+#ifdef __linux__
+	i = 1;
+	if (gro && setsockopt(sock, SOL_UDP, UDP_GRO, &i, sizeof(i)) < 0) {
+		perror("bw_udp server: UDP_GRO");
+		exit(1);
+	}
+	bzero(msgs, batch * sizeof(struct mmsghdr));
+	for (i = 0; i < batch; ++i) {
+		iov[i].iov_base = bufs + i * (MAX_MSIZE + 1);
+		iov[i].iov_len = MAX_MSIZE + 1;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &it[i];
+	}
+#endif
 
 	while (1) {
-		namelen = sizeof(it);
-		if (recvfrom(sock, (void*)buf, 2 * sizeof(long), 0, 
-		    (struct sockaddr*)&it, &namelen) < 0) {
-			fprintf(stderr, "bw_udp server: recvfrom: got wrong size\n");
+#ifdef __linux__
+		for (i = 0; i < batch; ++i) {
+			msgs[i].msg_hdr.msg_namelen = sizeof(it[i]);
+			msgs[i].msg_hdr.msg_control = gro ? cmsgs[i].buf : NULL;
+			msgs[i].msg_hdr.msg_controllen =
+				gro ? sizeof(cmsgs[i].buf) : 0;
+		}
+		if ((n = recvmmsg(sock, msgs, batch, MSG_WAITFORONE, NULL)) < 0) {
+			perror("bw_udp server: recvmmsg");
 			exit(9);
 		}
-		nbytes = ntohl(*(long*)buf);
-		msize = ntohl(*((long*)buf + 1));
-		while (nbytes > 0) {
-			if (sendto(sock, (void*)buf, msize, 0, 
-				   (struct sockaddr*)&it, sizeof(it)) < 0) {
-				perror("bw_udp sendto");
-				exit(9);
+#else
+		socklen_t namelen = sizeof(it[0]);
+
+		if ((len = recvfrom(sock, (void*)bufs, MAX_MSIZE + 1, 0,
+		    (struct sockaddr*)&it[0], &namelen)) < 0) {
+			perror("bw_udp server: recvfrom");
+			exit(9);
+		}
+		n = 1;
+#endif
+		for (i = 0; i < n; ++i) {
+			char	*buf = bufs + i * (MAX_MSIZE + 1);
+
+#ifdef __linux__
+			len = msgs[i].msg_len;
+			seg = len;
+			for (cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg;
+			     cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+				if (cmsg->cmsg_level == SOL_UDP
+				    && cmsg->cmsg_type == UDP_GRO)
+					seg = *(int*)CMSG_DATA(cmsg);
+			}
+#else
+			seg = len;
+#endif
+			if (seg <= 0) continue;
+
+			/* find the sender, remembering it if it is new */
+			for (k = 0; k < nclients; ++k) {
+				if (clients[k].addr.sin_port == it[i].sin_port
+				    && clients[k].addr.sin_addr.s_addr
+				    == it[i].sin_addr.s_addr) break;
+			}
+			if (k == nclients) {
+				if (nclients < MAXCLIENTS) ++nclients;
+				else k = it[i].sin_port % MAXCLIENTS;
+				clients[k].addr = it[i];
+				clients[k].count = 0;
+			}
+
+			/* UDP_GRO may have joined several datagrams */
+			for (j = 0; j < len; j += seg) {
+				magic = 0;
+				if (len - j >= sizeof(magic))
+					bcopy(buf + j, &magic, sizeof(magic));
+				if (magic == htonl(BW_UDP_DATA)) {
+					clients[k].count++;
+				} else if (len - j >= sizeof(ctl_t)) {
+					server_ctl(sock, buf + j, &it[i],
+						   clients[k].count);
+				}
 			}
-			nbytes -= msize;
 		}
 	}
 }
 
+void
+server_ctl(int sock, char *buf, struct sockaddr_in *it, uint32_t count)
+{
+	ctl_t	ctl;
+
+	bcopy(buf, &ctl, sizeof(ctl));
+	if (ctl.magic != htonl(BW_UDP_CTL)) return;
+	switch (ntohl(ctl.op)) {
+	    case OP_EXIT:
+		udp_done(UDP_DATA);
+		exit(0);
+	    case OP_REPORT:
+		ctl.count = htonl(count);
+		(void) sendto(sock, (void*)&ctl, sizeof(ctl), 0,
+			      (struct sockaddr*)it, sizeof(*it));
+		break;
+	}
+}
@@ -2,8 +2,17 @@
  * bw_unix.c - simple Unix stream socket bandwidth test
  *
  * Usage: bw_unix [-m <message size>] [-M <total bytes>] \
+ *		[-x write|zerocopy|memfd|dgram|mmsg] [-b <batch>] \
  *		[-P <parallelism>] [-W <warmup>] [-N <repetitions>]
  *
+ * -x zerocopy sends with MSG_ZEROCOPY, where the kernel allows it on
+ * AF_UNIX sockets.  -x memfd has the writer pass a memfd to the reader
+ * with SCM_RIGHTS once, and from then on only send the index of the
+ * slot in it which holds the next message; the reader copies the
+ * message out and hands the slot back.  -x dgram sends each message
+ * as an AF_UNIX datagram, and -x mmsg sends and receives them <batch>
+ * at a time with sendmmsg() and recvmmsg().
+ *
  * Copyright (c) 1994 Larry McVoy.  
  * Copyright (c) 2002 Carl Staelin.
  * Distributed under the FSF GPL with additional restriction that results 
@@ -18,9 +27,19 @@ char	*id = "$Id$\n";
 
 void	reader(iter_t iterations, void * cookie);
 void	writer(int controlfd, int writefd, char* buf, void* cookie);
+void	writer_memfd(int controlfd, int writefd, void* cookie);
+int	send_fd(int sock, int fd);
+int	recv_fd(int sock);
 
 size_t	XFER	= 10*1024*1024;
 
+/* how the data is moved */
+enum { M_WRITE, M_ZEROCOPY, M_MEMFD, M_DGRAM, M_MMSG };
+char	*modes[] = { "write", "zerocopy", "memfd", "dgram", "mmsg", NULL };
+
+#define	NSLOTS	8		/* messages in the memfd */
+#define	MAXBATCH 1024
+
 struct _state {
 	int	pid;
 	size_t	xfer;	/* bytes to read/write per "packet" */
@@ -28,6 +47,9 @@ struct _state {
 	char	*buf;	/* buffer memory space */
 	int	pipes[2];
 	int	control[2];
+	int	mode;
+	int	batch;		/* messages per sendmmsg/recvmmsg */
+	char	*map;		/* the memfd, NSLOTS messages */
 	int	initerr;
 };
 
@@ -38,10 +60,13 @@ initialize(iter_t iterations, void* cookie)
 
 	if (iterations) return;
 
-	state->buf = valloc(XFERSIZE);
-	touch(state->buf, XFERSIZE);
+	state->buf = valloc(state->xfer > XFERSIZE ? state->xfer : XFERSIZE);
+	touch(state->buf, state->xfer > XFERSIZE ? state->xfer : XFERSIZE);
 	state->initerr = 0;
-	if (socketpair(AF_UNIX, SOCK_STREAM, 0, state->pipes) == -1) {
+	state->map = NULL;
+	if (socketpair(AF_UNIX, 
+		       state->mode >= M_DGRAM ? SOCK_DGRAM : SOCK_STREAM,
+		       0, state->pipes) == -1) {
 		perror("socketpair");
 		state->initerr = 1;
 		return;
@@ -57,6 +82,9 @@ initialize(iter_t iterations, void* cookie)
 	      handle_scheduler(benchmp_childid(), 1, 1);
 		close(state->control[1]);
 		close(state->pipes[0]);
+		if (state->mode == M_MEMFD) {
+			writer_memfd(state->control[0], state->pipes[1], state);
+		}
 		writer(state->control[0], state->pipes[1], state->buf, state);
 		return;
 		/*NOTREACHED*/
@@ -72,6 +100,22 @@ initialize(iter_t iterations, void* cookie)
 	}
 	close(state->control[0]);
 	close(state->pipes[1]);
+	if (state->mode == M_MEMFD) {
+		int	fd = recv_fd(state->pipes[0]);
+
+		if (fd < 0) {
+			state->initerr = 4;
+			return;
+		}
+		state->map = mmap(0, NSLOTS * state->xfer, PROT_READ,
+				  MAP_SHARED, fd, 0);
+		close(fd);
+		if (state->map == MAP_FAILED) {
+			perror("mmap");
+			state->map = NULL;
+			state->initerr = 4;
+		}
+	}
 }
 void 
 cleanup(iter_t iterations, void*  cookie)
@@ -82,6 +126,8 @@ cleanup(iter_t iterations, void*  cookie)
 
 	close(state->control[1]);
 	close(state->pipes[0]);
+	if (state->map) munmap(state->map, NSLOTS * state->xfer);
+	state->map = NULL;
 	if (state->pid > 0) {
 		kill(state->pid, SIGKILL);
 		waitpid(state->pid, NULL, 0);
@@ -95,10 +141,53 @@ reader(iter_t iterations, void* cookie)
 	struct _state* state = (struct _state*)cookie;
 	size_t	done, n;
 	size_t	todo = state->bytes;
+	int	i, slot[NSLOTS];
+#ifdef __linux__
+	struct mmsghdr msgs[MAXBATCH];
+	struct iovec iov;
+
+	if (state->mode == M_MMSG) {
+		iov.iov_base = state->buf;
+		iov.iov_len = state->xfer;
+		bzero(msgs, state->batch * sizeof(struct mmsghdr));
+		for (i = 0; i < state->batch; ++i) {
+			msgs[i].msg_hdr.msg_iov = &iov;
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+	}
+#endif
 
 	while (iterations-- > 0) {
 		write(state->control[1], &todo, sizeof(todo));
 		for (done = 0; done < todo; done += n) {
+			switch (state->mode) {
+#ifdef __linux__
+			case M_MMSG:
+				/* the writer sends no more than we ask for */
+				i = (todo - done) / state->xfer;
+				if (i > state->batch) i = state->batch;
+				if ((i = recvmmsg(state->pipes[0], msgs, i,
+						  MSG_WAITFORONE, NULL)) <= 0) {
+					perror("recvmmsg");
+					exit(1);
+				}
+				for (n = 0; i-- > 0; n += msgs[i].msg_len)
+					;
+				continue;
+#endif
+			case M_MEMFD:
+				/* copy out each message named, then free its slot */
+				if ((i = read(state->pipes[0], slot, sizeof(slot))) <= 0) {
+					exit(1);
+				}
+				for (n = 0; n < i / sizeof(int) * state->xfer;
+				     n += state->xfer) {
+					bcopy(state->map + slot[n / state->xfer] * state->xfer,
+					      state->buf, state->xfer);
+				}
+				write(state->pipes[0], slot, i);
+				continue;
+			}
 			if ((n = read(state->pipes[0], state->buf, state->xfer)) <= 0) {
 				/* error! */
 				exit(1);
@@ -111,22 +200,171 @@ void
 writer(int controlfd, int writefd, char* buf, void* cookie)
 {
 	size_t	todo, n, done;
+	int	i, flags = 0;
 	struct _state* state = (struct _state*)cookie;
+#ifdef __linux__
+	struct mmsghdr msgs[MAXBATCH];
+	struct iovec iov;
+
+	if (state->mode == M_MMSG) {
+		iov.iov_base = buf;
+		iov.iov_len = state->xfer;
+		bzero(msgs, state->batch * sizeof(struct mmsghdr));
+		for (i = 0; i < state->batch; ++i) {
+			msgs[i].msg_hdr.msg_iov = &iov;
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+	}
+#endif
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+	if (state->mode == M_ZEROCOPY) {
+		i = 1;
+		if (setsockopt(writefd, SOL_SOCKET, SO_ZEROCOPY, &i, sizeof(i)) < 0) {
+			perror("bw_unix: SO_ZEROCOPY on AF_UNIX");
+			exit(1);
+		}
+		flags = MSG_ZEROCOPY;
+	}
+#endif
 
 	for ( ;; ) {
-		read(controlfd, &todo, sizeof(todo));
+		/* the reader has gone away: we are done */
+		if (read(controlfd, &todo, sizeof(todo)) != sizeof(todo))
+			exit(0);
 		for (done = 0; done < todo; done += n) {
 #ifdef TOUCH
 			touch(buf, XFERSIZE);
 #endif
-			if ((n = write(writefd, buf, state->xfer)) < 0) {
-				/* error! */
+#ifdef __linux__
+			if (state->mode == M_MMSG) {
+				i = (todo - done) / state->xfer;
+				if (i > state->batch) i = state->batch;
+				if ((i = sendmmsg(writefd, msgs, i, 0)) <= 0) {
+					perror("sendmmsg");
+					exit(1);
+				}
+				for (n = 0; i-- > 0; n += msgs[i].msg_len)
+					;
+				continue;
+			}
+#endif
+			if ((n = send(writefd, buf, state->xfer, flags)) < 0) {
+				perror("send");
 				exit(1);
 			}
 		}
 	}
 }
 
+/*
+ * Make a memfd holding NSLOTS messages, give it to the reader, and then
+ * tell the reader which slot to read each message from.  The reader
+ * sends the slot numbers back once it is done with them.
+ */
+void
+writer_memfd(int controlfd, int writefd, void* cookie)
+{
+#ifdef __linux__
+	struct _state* state = (struct _state*)cookie;
+	size_t	todo, done;
+	int	fd, n, nfree, slot[NSLOTS];
+	char	*map;
+
+	if ((fd = memfd_create("bw_unix", 0)) < 0
+	    || ftruncate(fd, NSLOTS * state->xfer) < 0) {
+		perror("memfd");
+		exit(1);
+	}
+	map = mmap(0, NSLOTS * state->xfer, PROT_READ|PROT_WRITE,
+		   MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	touch(map, NSLOTS * state->xfer);
+	if (send_fd(writefd, fd) < 0) exit(1);
+	close(fd);
+
+	for (nfree = 0; nfree < NSLOTS; ++nfree)
+		slot[nfree] = nfree;
+	for ( ;; ) {
+		/* the reader has gone away: we are done */
+		if (read(controlfd, &todo, sizeof(todo)) != sizeof(todo))
+			exit(0);
+		for (done = 0; done < todo; done += state->xfer) {
+			if (nfree == 0) {
+				if ((n = read(writefd, slot, sizeof(slot))) <= 0)
+					exit(1);
+				nfree = n / sizeof(int);
+			}
+			--nfree;
+#ifdef TOUCH
+			touch(map + slot[nfree] * state->xfer, state->xfer);
+#endif
+			if (write(writefd, &slot[nfree], sizeof(int)) != sizeof(int))
+				exit(1);
+		}
+	}
+#else
+	exit(1);
+#endif
+}
+
+int
+send_fd(int sock, int fd)
+{
+	char	c = 0;
+	char	control[CMSG_SPACE(sizeof(int))];
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+
+	bzero(&msg, sizeof(msg));
+	iov.iov_base = &c;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	bcopy(&fd, CMSG_DATA(cmsg), sizeof(int));
+	if (sendmsg(sock, &msg, 0) != 1) {
+		perror("sendmsg");
+		return (-1);
+	}
+	return (0);
+}
+
+int
+recv_fd(int sock)
+{
+	int	fd;
+	char	c;
+	char	control[CMSG_SPACE(sizeof(int))];
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+
+	bzero(&msg, sizeof(msg));
+	iov.iov_base = &c;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	if (recvmsg(sock, &msg, 0) != 1
+	    || !(cmsg = CMSG_FIRSTHDR(&msg))
+	    || cmsg->cmsg_type != SCM_RIGHTS) {
+		perror("recvmsg");
+		return (-1);
+	}
+	bcopy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	return (fd);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -135,13 +373,26 @@ main(int argc, char *argv[])
 	int warmup = 0;
 	int repetitions = TRIES;
 	int c;
-	char* usage = "[-m <message size>] [-M <total bytes>] [-P <parallelism>] [-W <warmup>] [-N <repetitions>]\n";
+	char* usage = "[-m <message size>] [-M <total bytes>] [-x write|zerocopy|memfd|dgram|mmsg] [-b <batch>] [-P <parallelism>] [-W <warmup>] [-N <repetitions>]\n";
 
 	state.xfer = XFERSIZE;	/* per-packet size */
 	state.bytes = XFER;	/* total bytes per call */
+	state.mode = M_WRITE;
+	state.batch = 32;
 
-	while (( c = getopt(argc,argv,"m:M:P:W:N:")) != EOF) {
+	while (( c = getopt(argc,argv,"m:M:x:b:P:W:N:")) != EOF) {
 		switch(c) {
+		case 'x':
+			for (c = 0; modes[c] && strcmp(modes[c], optarg); ++c)
+				;
+			if (!modes[c]) lmbench_usage(argc, argv, usage);
+			state.mode = c;
+			break;
+		case 'b':
+			state.batch = atoi(optarg);
+			if (state.batch <= 0 || state.batch > MAXBATCH)
+				lmbench_usage(argc, argv, usage);
+			break;
 		case 'm':
 			state.xfer = bytes(optarg);
 			break;
@@ -170,18 +421,70 @@ main(int argc, char *argv[])
 	}
 
 	state.pid = 0;
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+	if (state.mode == M_ZEROCOPY) {
+		int	sv[2], on = 1;
+
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0
+		    && setsockopt(sv[0], SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) < 0) {
+			fprintf(stderr, "bw_unix: MSG_ZEROCOPY is not supported on AF_UNIX sockets\n");
+			exit(1);
+		}
+		close(sv[0]);
+		close(sv[1]);
+	}
+#else
+	if (state.mode == M_ZEROCOPY) {
+		fprintf(stderr, "bw_unix: no MSG_ZEROCOPY\n");
+		exit(1);
+	}
+#endif
+#ifndef __linux__
+	if (state.mode == M_MEMFD || state.mode == M_MMSG) {
+		fprintf(stderr, "bw_unix: -x %s needs Linux\n", modes[state.mode]);
+		exit(1);
+	}
+#endif
+
+	/* a datagram has to fit in the socket buffer, or the writer fails */
+	if (state.mode >= M_DGRAM) {
+		int	sv[2];
+		char	*p = valloc(state.xfer);
+
+		if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) < 0 || !p) {
+			perror("socketpair");
+			exit(1);
+		}
+		if (send(sv[0], p, state.xfer, MSG_DONTWAIT) < 0
+		    && errno == EMSGSIZE) {
+			int	sndbuf = 0;
+			socklen_t len = sizeof(sndbuf);
+
+			getsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, &len);
+			fprintf(stderr, "bw_unix: -m %lu is too big for an AF_UNIX datagram (SO_SNDBUF is %d)\n",
+				(unsigned long)state.xfer, sndbuf);
+			exit(1);
+		}
+		close(sv[0]);
+		close(sv[1]);
+		free(p);
+	}
 
 	/* round up total byte count to a multiple of xfer */
 	if (state.bytes % state.xfer) {
-		state.bytes += state.bytes - state.bytes % state.xfer;
+		state.bytes += state.xfer - state.bytes % state.xfer;
 	}
 
 	benchmp(initialize, reader, cleanup, MEDIUM, parallel, 
 		warmup, repetitions, &state);
 
 	if (gettime() > 0) {
-		fprintf(stderr, "AF_UNIX sock stream bandwidth: ");
-		mb(get_n() * parallel * XFER);
+		if (state.mode == M_WRITE) {
+			fprintf(stderr, "AF_UNIX sock stream bandwidth: ");
+		} else {
+			fprintf(stderr, "AF_UNIX %s bandwidth: ", modes[state.mode]);
+		}
+		mb(get_n() * parallel * state.bytes);
 	}
 	return(0);
 }
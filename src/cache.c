@@ -1,7 +1,7 @@
 /*
  * cache.c - guess the cache size(s)
  *
- * usage: cache [-c] [-L <line size>] [-M len[K|M]] [-W <warmup>] [-N <repetitions>]
+ * usage: cache [-c] [-w] [-L <line size>] [-M len[K|M]] [-W <warmup>] [-N <repetitions>]
  *
  * Copyright (c) 2000 Carl Staelin.
  * Copyright (c) 1994 Larry McVoy.  Distributed under the FSF GPL with
@@ -93,18 +93,26 @@ main(int ac, char **av)
 	int	warmup = 0;
 	int	repetitions = TRIES;
 	int	print_cost = 0;
+	int	curve = 0;
+	int	maxwidth = MEM_REGISTER_CHAINS;
 	int	maxlen = 32 * 1024 * 1024;
 	int	*levels;
 	double	par, maxpar;
-	char   *usage = "[-c] [-L <line size>] [-M len[K|M]] [-W <warmup>] [-N <repetitions>]\n";
+	double	ns[MAX_MEM_PARALLELISM];
+	char	buf[64];
+	char   *usage = "[-c] [-w] [-L <line size>] [-M len[K|M]] [-W <warmup>] [-N <repetitions>]\n";
 	struct cache_results* r;
 	struct mem_state state;
 
-	while (( c = getopt(ac, av, "cL:M:W:N:")) != EOF) {
+	while (( c = getopt(ac, av, "cwL:M:W:N:")) != EOF) {
 		switch(c) {
 		case 'c':
 			print_cost = 1;
 			break;
+		case 'w':
+			curve = 1;
+			maxwidth = MAX_MEM_PARALLELISM;
+			break;
 		case 'L':
 			line = atoi(optarg);
 			if (line < sizeof(char*))
@@ -191,12 +199,27 @@ main(int ac, char **av)
 		}
 
 		/* Compute memory parallelism for cache */
-		maxpar = par_mem(r[levels[i]-1].len, warmup, 
-				 repetitions, &state);
+		c = par_mem_curve(r[levels[i]-1].len, maxwidth,
+				  warmup, repetitions, &state, ns);
+		maxpar = c > 0 ? par_mem_max(c, ns) : -1.;
 
 		fprintf(stderr, 
 		    "L%d cache: %d bytes %.2f nanoseconds %d linesize %.2f parallelism\n",
 		    i+1, r[levels[i]].len, r[min].latency, line, maxpar);
+		if (json_output()) {
+			sprintf(buf, "L%d cache size", i+1);
+			json_result(buf, (double)r[levels[i]].len, "bytes");
+			sprintf(buf, "L%d cache latency", i+1);
+			json_result(buf, r[min].latency, "nanoseconds");
+			sprintf(buf, "L%d cache line", i+1);
+			json_result(buf, (double)line, "bytes");
+			sprintf(buf, "L%d cache parallelism", i+1);
+			json_result(buf, maxpar, "parallelism");
+		}
+		if (curve) {
+			sprintf(buf, "L%d cache", i+1);
+			par_mem_print(buf, c, ns, state.line);
+		}
 	}
 
 	/* Compute memory parallelism for main memory */
@@ -206,10 +229,15 @@ main(int ac, char **av)
 		if (r[i].latency > 0.99 * r[n-1].latency)
 			j = i;
 	}
-	par = par_mem(r[j].len, warmup, repetitions, &state);
+	c = par_mem_curve(r[j].len, maxwidth, 
+			  warmup, repetitions, &state, ns);
+	par = c > 0 ? par_mem_max(c, ns) : -1.;
 
 	fprintf(stderr, "Memory latency: %.2f nanoseconds %.2f parallelism\n",
 		r[n-1].latency, par);
+	json_result("Memory latency", r[n-1].latency, "nanoseconds");
+	json_result("Memory parallelism", par, "parallelism");
+	if (curve) par_mem_print("Memory", c, ns, state.line);
 
 	exit(0);
 }
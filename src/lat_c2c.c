@@ -0,0 +1,235 @@
+/*
+ * lat_c2c.c - cache to cache transfer latency between every pair of processors
+ *
+ * usage: lat_c2c [-x modified|shared] [-W <warmup>] [-N <repetitions>] [cpu ...]
+ *
+ * Two processes, each pinned to one of the processors, take turns
+ * incrementing a counter in a cache line of a MAP_SHARED page, so
+ * every turn moves the line from one cache to the other.  With
+ * modified each waits with compare-and-swap, so the line always
+ * moves in the modified state; with shared each waits with loads,
+ * so the line is first fetched shared and then written, which
+ * must invalidate the other copy.
+ *
+ * The result is a matrix of the one way latency in nanoseconds,
+ * half a round trip, for each pair of the given processors (all of
+ * them by default).  Processors are numbered as for LMBENCH_SCHED,
+ * from 0 among those we are allowed to run on.
+ *
+ * Copyright (c) 1994 Larry McVoy.  Distributed under the FSF GPL with
+ * additional restriction that results may published only if
+ * (1) the benchmark is unmodified, and
+ * (2) the version in the sccsid below is included in the report.
+ */
+char	*id = "$Id$\n";
+
+#include "bench.h"
+
+typedef struct _state {
+	int	cpu[2];
+	int	shared;		/* wait with loads rather than CAS */
+	char	*page;		/* the line is at the start */
+	uint64	seq;		/* the next value for us to write */
+	pid_t	pid;
+} state_t;
+
+void	initialize(iter_t iterations, void* cookie);
+void	benchmark(iter_t iterations, void* cookie);
+void	cleanup(iter_t iterations, void* cookie);
+void	peer(state_t* state);
+
+/*
+ * Wait until the line holds seq - 1, then make it seq
+ */
+static inline void
+turn(volatile uint64* line, uint64 seq, int shared)
+{
+	int	spins = 0;
+
+	if (shared) {
+		while (*line != seq - 1) {
+			/* don't starve the peer if it shares our CPU */
+			if (++spins % 1024 == 0) sched_yield();
+		}
+		*line = seq;
+	} else {
+		while (!__sync_bool_compare_and_swap(line, seq - 1, seq)) {
+			if (++spins % 1024 == 0) sched_yield();
+		}
+	}
+}
+
+int
+main(int ac, char **av)
+{
+	state_t	state;
+	int	i, j, c, n;
+	int	warmup = 0;
+	int	repetitions = TRIES;
+	int	*cpus;
+	double	*ns;
+	char	buf[64];
+	char	*usage = "[-x modified|shared] [-W <warmup>] [-N <repetitions>] [cpu ...]\n";
+
+	bzero(&state, sizeof(state));
+
+	while (( c = getopt(ac, av, "x:W:N:")) != EOF) {
+		switch(c) {
+		case 'x':
+			if (!strcmp(optarg, "modified")) {
+				state.shared = 0;
+			} else if (!strcmp(optarg, "shared")) {
+				state.shared = 1;
+			} else {
+				lmbench_usage(ac, av, usage);
+			}
+			break;
+		case 'W':
+			warmup = atoi(optarg);
+			break;
+		case 'N':
+			repetitions = atoi(optarg);
+			break;
+		default:
+			lmbench_usage(ac, av, usage);
+			break;
+		}
+	}
+
+	if (optind < ac) {
+		n = ac - optind;
+		cpus = (int*)malloc(n * sizeof(int));
+		for (i = 0; i < n; ++i) {
+			cpus[i] = atoi(av[optind + i]);
+			/* a missing or repeated CPU would pair a CPU with itself */
+			if (cpus[i] < 0 || cpus[i] >= sched_ncpus())
+				lmbench_usage(ac, av, usage);
+			for (j = 0; j < i; ++j) {
+				if (cpus[j] == cpus[i])
+					lmbench_usage(ac, av, usage);
+			}
+		}
+	} else {
+		n = sched_ncpus();
+		cpus = (int*)malloc(n * sizeof(int));
+		for (i = 0; i < n; ++i) cpus[i] = i;
+	}
+	ns = (double*)malloc(n * n * sizeof(double));
+
+	/* a round trip is the same whichever end starts it */
+	for (i = 0; i < n; ++i) {
+		ns[i * n + i] = -1.;
+		for (j = i + 1; j < n; ++j) {
+			state.cpu[0] = cpus[i];
+			state.cpu[1] = cpus[j];
+			benchmp(initialize, benchmark, cleanup, 0, 1,
+				warmup, repetitions, &state);
+			ns[i * n + j] = ns[j * n + i] = gettime() > 0 ?
+				(double)gettime() * 1000. / (2. * get_n()) : -1.;
+			if (json_output() && gettime() > 0) {
+				sprintf(buf, "%d-%d", cpus[i], cpus[j]);
+				json_result(buf, ns[i * n + j], "nanoseconds");
+			}
+		}
+	}
+
+	fprintf(stderr, "\"Cache to cache latency (ns), %s lines, cpu x cpu\n",
+		state.shared ? "shared" : "modified");
+	fprintf(stderr, "cpu");
+	for (j = 0; j < n; ++j) fprintf(stderr, "\t%d", cpus[j]);
+	fprintf(stderr, "\n");
+	for (i = 0; i < n; ++i) {
+		fprintf(stderr, "%d", cpus[i]);
+		for (j = 0; j < n; ++j) {
+			if (ns[i * n + j] < 0.) {
+				fprintf(stderr, "\t-");
+			} else {
+				fprintf(stderr, "\t%.1f", ns[i * n + j]);
+			}
+		}
+		fprintf(stderr, "\n");
+	}
+	return (0);
+}
+
+void
+initialize(iter_t iterations, void* cookie)
+{
+	state_t* state = (state_t*)cookie;
+
+	if (iterations) return;
+
+	state->page = (char*)mmap(0, getpagesize(), PROT_READ|PROT_WRITE,
+				  MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (state->page == (char*)MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	bzero(state->page, getpagesize());
+	state->seq = 1;
+
+	sched_pin(state->cpu[0]);
+	switch (state->pid = fork()) {
+	case 0:
+		sched_pin(state->cpu[1]);
+		signal(SIGTERM, exit);
+		peer(state);
+		exit(0);
+	case -1:
+		perror("fork");
+		exit(1);
+	default:
+		break;
+	}
+
+	/* once around to be sure the peer is running */
+	benchmark(1, cookie);
+}
+
+void
+cleanup(iter_t iterations, void* cookie)
+{
+	state_t* state = (state_t*)cookie;
+
+	if (iterations) return;
+
+	if (state->pid) {
+		kill(state->pid, SIGKILL);
+		waitpid(state->pid, NULL, 0);
+		state->pid = 0;
+	}
+	munmap(state->page, getpagesize());
+}
+
+/*
+ * We write the odd numbers and the peer the even ones
+ */
+void
+benchmark(iter_t iterations, void* cookie)
+{
+	state_t* state = (state_t*)cookie;
+	volatile uint64* line = (volatile uint64*)state->page;
+	uint64	seq = state->seq;
+	int	shared = state->shared;
+	int	spins = 0;
+
+	while (iterations-- > 0) {
+		turn(line, seq, shared);
+		seq += 2;
+	}
+	/* wait for the peer's answer to the last one */
+	while (*line != seq - 1) {
+		if (++spins % 1024 == 0) sched_yield();
+	}
+	state->seq = seq;
+}
+
+void
+peer(state_t* state)
+{
+	volatile uint64* line = (volatile uint64*)state->page;
+	uint64	seq;
+
+	for (seq = 2; ; seq += 2)
+		turn(line, seq, state->shared);
+}
@@ -51,6 +51,7 @@ main(int ac, char **av)
 	struct _state state;
 	char *usage = "[-P <parallelism>] [-W <warmup>] [-N <repetitions>] [-s kbytes] processes [processes ...]\n";
 	double	time;
+	char	buf[32];
 
 	/*
 	 * Need 4 byte ints.
@@ -118,8 +119,12 @@ main(int ac, char **av)
 		time /= state.procs;
 		time -= state.overhead;
 
-		if (time > 0.0)
+		if (time > 0.0) {
 			fprintf(stderr, "%d %.2f\n", state.procs, time);
+			sprintf(buf, "%d", state.procs);
+			percentiles(buf, 1. / state.procs, state.overhead);
+			json_result(buf, time, "microseconds");
+		}
 	}
 
 	return (0);
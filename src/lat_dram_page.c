@@ -73,8 +73,10 @@ main(int ac, char **av)
 
 	if (dram_hit < 0.95 * dram_miss) {
 		fprintf(stderr, "%f\n", dram_miss - dram_hit);
+		json_result("dram page miss", dram_miss - dram_hit, "nanoseconds");
 	} else {
 		fprintf(stderr, "0.0\n");
+		json_result("dram page miss", 0., "nanoseconds");
 	}
 
 	return (0);
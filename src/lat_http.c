@@ -1,7 +1,16 @@
 /*
  * lat_http.c - simple HTTP transaction latency test
  *
- * usage: lat_http hostname [port] < filelist
+ * usage: lat_http [-d] [-e] [-S] hostname [port] < filelist
+ *	  lat_http -c <connections> [-k] [-R <rate>] [-t <secs>] hostname [port] < filelist
+ *
+ * The first form fetches each file once, one after another, on a new
+ * connection.  The second keeps <connections> requests in flight for
+ * <secs> seconds, cycling through the list, and reports requests per
+ * second and the distribution of response times.  -k reuses each
+ * connection for more requests (HTTP/1.1 keep-alive).  -R issues
+ * <rate> requests per second in all, whether or not earlier ones have
+ * been answered, and times each from when it was due.
  *
  * Copyright (c) 1994-6 Larry McVoy.  Distributed under the FSF GPL with
  * additional restriction that results may published only if
@@ -12,11 +21,36 @@
 char	*id = "$Id$\n";
 
 #include "bench.h"
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 
 char	*buf;
 int	debug;
 int	echo;
 
+#define	HDRSIZE		4096
+#define	DRAIN_NS	2000000000ULL	/* grace for requests in flight */
+
+/* a connection used by load() */
+typedef struct _lconn {
+	int	sock;
+	int	state;
+	uint64	start;		/* when the current request was due */
+	int	sent, len;	/* how much of req has been written */
+	char	req[1200];
+	char	hdr[HDRSIZE];	/* the response header */
+	int	nhdr;
+	int	inbody;		/* have we seen all of the header? */
+	long long left;		/* body still to come, or -1 until EOF */
+	int	keepalive;
+} lconn_t;
+
+enum { L_IDLE, L_CONNECTING, L_SENDING, L_READING };
+
+void	load(char *server, int prog, char **files, int nfiles,
+	     int conns, int keepalive, int rate, int secs);
+
 int
 http(char *server, char *file, int prog)
 {
@@ -67,10 +101,26 @@ main(int ac, char **av)
 	double	avg;
 	char	*name = av[0];
 	char	file[1024];
-	char	*usage = "[-d] [-e] [-S] serverhost [port] < list\n";
+	int	conns = 0, keepalive = 0, rate = 0, secs = 10;
+	char	*usage = "[-d] [-e] [-S] serverhost [port] < list\n OR -c <connections> [-k] [-R <rate>] [-t <secs>] serverhost [port] < list\n";
 
-	while (( c = getopt(ac, av, "deS")) != EOF) {
+	while (( c = getopt(ac, av, "deSc:kR:t:")) != EOF) {
 		switch(c) {
+		case 'c':
+			conns = atoi(optarg);
+			if (conns <= 0) lmbench_usage(ac, av, usage);
+			break;
+		case 'k':
+			keepalive = 1;
+			break;
+		case 'R':
+			rate = atoi(optarg);
+			if (rate <= 0) lmbench_usage(ac, av, usage);
+			break;
+		case 't':
+			secs = atoi(optarg);
+			if (secs <= 0) lmbench_usage(ac, av, usage);
+			break;
 		case 'd':
 			debug++;
 			break;
@@ -106,6 +156,27 @@ main(int ac, char **av)
 	i = 0;
 	buf = valloc(XFERSIZE);
 	bzero(buf, XFERSIZE);
+	if (conns || rate) {
+		char	**files = NULL;
+		int	max = 0;
+
+		while (fgets(file, sizeof(file), stdin)) {
+			chop(file);
+			if (!file[0]) continue;
+			if (i == max) {
+				max = max ? 2 * max : 64;
+				files = (char**)realloc(files, max * sizeof(char*));
+			}
+			files[i++] = strdup(file);
+		}
+		if (i == 0) {
+			fprintf(stderr, "%s: no files\n", name);
+			exit(1);
+		}
+		load(server, prog, files, i, conns ? conns : 1,
+		     keepalive, rate, secs);
+		exit(0);
+	}
 	while (fgets(file, sizeof(file), stdin)) {
 		chop(file);
 		start(0);
@@ -126,3 +197,264 @@ main(int ac, char **av)
 	exit(0);
 }
 
+
+#ifdef __linux__
+static	int	epfd;
+static	struct	sockaddr_in addr;
+
+static void
+lconn_wait(lconn_t *c, int op, int events)
+{
+	struct	epoll_event ev;
+
+	ev.events = events;
+	ev.data.ptr = c;
+	epoll_ctl(epfd, op, c->sock, &ev);
+}
+
+/*
+ * Start a request for file on c, connecting first if need be
+ */
+static void
+lconn_start(lconn_t *c, char *server, char *file, int keepalive, uint64 due)
+{
+	c->start = due;
+	c->nhdr = c->inbody = 0;
+	c->sent = 0;
+	c->keepalive = keepalive;
+	if (keepalive) {
+		c->len = sprintf(c->req,
+		    "GET /%.1024s HTTP/1.1\r\nHost: %.100s\r\n\r\n", file, server);
+	} else {
+		c->len = sprintf(c->req, "GET /%.1024s HTTP/1.0\r\n\r\n", file);
+	}
+	if (c->sock >= 0) {
+		c->state = L_SENDING;
+		lconn_wait(c, EPOLL_CTL_MOD, EPOLLOUT);
+		return;
+	}
+	if ((c->sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+		perror("socket");
+		exit(1);
+	}
+	fcntl(c->sock, F_SETFL, O_NONBLOCK);
+	if (connect(c->sock, (struct sockaddr*)&addr, sizeof(addr)) < 0
+	    && errno != EINPROGRESS) {
+		perror("connect");
+		exit(1);
+	}
+	c->state = L_CONNECTING;
+	lconn_wait(c, EPOLL_CTL_ADD, EPOLLOUT);
+}
+
+static void
+lconn_close(lconn_t *c)
+{
+	if (c->sock >= 0) close(c->sock);
+	c->sock = -1;
+	c->state = L_IDLE;
+}
+
+/*
+ * Look at the response header: is it complete, how long is the body,
+ * and will the server keep the connection open?  Returns the length of
+ * the header, or 0 if it isn't all here yet.
+ */
+static int
+lconn_header(lconn_t *c)
+{
+	char	*s, *end;
+
+	c->hdr[c->nhdr] = 0;
+	if (!(end = strstr(c->hdr, "\r\n\r\n"))) return (0);
+	*end = 0;
+	c->left = -1;
+	if ((s = strcasestr(c->hdr, "\nContent-Length:")))
+		c->left = atoll(s + 16);
+	if (strncmp(c->hdr, "HTTP/1.1", 8)
+	    || strcasestr(c->hdr, "\nConnection: close"))
+		c->keepalive = 0;
+	return (end + 4 - c->hdr);
+}
+
+/*
+ * Make requests on conns connections for secs seconds
+ */
+void
+load(char *server, int prog, char **files, int nfiles,
+     int conns, int keepalive, int rate, int secs)
+{
+	int	i, n, h, next = 0, nidle, timeout;
+	uint64	t, t0, end, period = 0, due, issued = 0;
+	uint64	done = 0, errors = 0, timeouts = 0, bytes = 0;
+	double	elapsed;
+	lconn_t	*conn, *c, **idle;
+	histogram_t *hist;
+	struct	hostent *hp;
+	struct	epoll_event events[256];
+	char	label[256];
+
+	if (prog > 0) {
+		fprintf(stderr, "lat_http: load needs a TCP port\n");
+		exit(1);
+	}
+	if (!(hp = gethostbyname(server))) {
+		perror(server);
+		exit(2);
+	}
+	bzero(&addr, sizeof(addr));
+	addr.sin_family = AF_INET;
+	bcopy((void*)hp->h_addr, (void *)&addr.sin_addr, hp->h_length);
+	addr.sin_port = htons(-prog);
+
+	morefds();
+	signal(SIGPIPE, SIG_IGN);
+	hist = hist_alloc(1);
+	conn = (lconn_t*)calloc(conns, sizeof(lconn_t));
+	idle = (lconn_t**)malloc(conns * sizeof(lconn_t*));
+	if ((epfd = epoll_create(conns)) < 0 || !conn || !idle) {
+		perror("lat_http");
+		exit(1);
+	}
+	for (i = 0; i < conns; ++i) {
+		conn[i].sock = -1;
+		idle[i] = &conn[conns - 1 - i];
+	}
+	nidle = conns;
+	if (rate) period = 1000000000 / rate;
+
+	t0 = now_ns();
+	end = t0 + (uint64)secs * 1000000000;
+	for (;;) {
+		t = now_ns();
+		/*
+		 * Once the time is up no new requests are started, but
+		 * the ones in flight get DRAIN_NS to finish; only those
+		 * still outstanding after that count as lost.
+		 */
+		if (t >= end && (nidle == conns || t >= end + DRAIN_NS)) break;
+
+		/* start whatever requests are due on idle connections */
+		while (t < end && nidle > 0) {
+			due = rate ? t0 + issued * period : t;
+			if (due > t) break;
+			c = idle[--nidle];
+			lconn_start(c, server, files[next], keepalive, due);
+			if (++next == nfiles) next = 0;
+			issued++;
+		}
+
+		timeout = ((t < end ? end : end + DRAIN_NS) - t) / 1000000 + 1;
+		if (rate && nidle > 0 && t < end) {
+			due = t0 + issued * period;
+			timeout = due > t ? (due - t) / 1000000 : 0;
+		}
+		n = epoll_wait(epfd, events, 256, timeout);
+		for (i = 0; i < n; ++i) {
+			c = (lconn_t*)events[i].data.ptr;
+			if (c->state == L_IDLE) {
+				/*
+				 * The server closed a kept-alive connection
+				 * between requests; it is already on idle[]
+				 * and will reconnect when next used.
+				 */
+				lconn_close(c);
+				continue;
+			}
+			if (c->state == L_CONNECTING) {
+				int	err = 0;
+				socklen_t len = sizeof(err);
+
+				getsockopt(c->sock, SOL_SOCKET, SO_ERROR,
+					   &err, &len);
+				if (err) goto fail;
+				c->state = L_SENDING;
+			}
+			if (c->state == L_SENDING) {
+				h = write(c->sock, c->req + c->sent,
+					  c->len - c->sent);
+				if (h < 0 && errno == EAGAIN) continue;
+				if (h <= 0) goto fail;
+				if ((c->sent += h) < c->len) continue;
+				c->state = L_READING;
+				lconn_wait(c, EPOLL_CTL_MOD, EPOLLIN);
+				continue;
+			}
+
+			/* L_READING */
+			h = read(c->sock, buf, XFERSIZE);
+			if (h < 0 && errno == EAGAIN) continue;
+			if (h < 0) goto fail;
+			if (t < end) bytes += h;
+			if (h == 0) {
+				/* EOF ends a response without a length */
+				if (!c->inbody || c->left != -1) goto fail;
+				c->keepalive = 0;
+			} else if (!c->inbody) {
+				int	m = h, old = c->nhdr;
+
+				if (m > HDRSIZE - 1 - c->nhdr)
+					m = HDRSIZE - 1 - c->nhdr;
+				bcopy(buf, c->hdr + c->nhdr, m);
+				c->nhdr += m;
+				if (!(m = lconn_header(c))) {
+					if (c->nhdr >= HDRSIZE - 1) goto fail;
+					continue;
+				}
+				c->inbody = 1;
+				/* some of the body may have come with it */
+				if (c->left >= 0) c->left -= h - (m - old);
+				if (c->left == -1 || c->left > 0) continue;
+			} else {
+				if (c->left > 0) c->left -= h;
+				if (c->left == -1 || c->left > 0) continue;
+			}
+
+			/* the response is complete */
+			t = now_ns();
+			hist_add(hist, t - c->start);
+			/* the rate only counts what finished in time */
+			if (t < end) done++;
+			if (c->keepalive) {
+				/* only hangups until the next request */
+				c->state = L_IDLE;
+				lconn_wait(c, EPOLL_CTL_MOD, EPOLLRDHUP);
+			} else {
+				lconn_close(c);
+			}
+			idle[nidle++] = c;
+			continue;
+fail:
+			errors++;
+			lconn_close(c);
+			idle[nidle++] = c;
+		}
+	}
+	elapsed = (end - t0) / 1e9;
+	/* requests which outlived the drain never completed either */
+	timeouts = conns - nidle;
+	hist->lost = errors + timeouts;
+
+	sprintf(label, "HTTP load using %s: %d connections%s", server,
+		conns, keepalive ? " keep-alive" : "");
+	if (rate) sprintf(label + strlen(label), " at %d/sec", rate);
+	fprintf(stderr, "%s: %.0f requests/sec %.2f MB/sec", label,
+		done / elapsed, bytes / (elapsed * 1024 * 1024));
+	if (errors || timeouts)
+		fprintf(stderr, " (%llu failed, %llu timed out)",
+			(unsigned long long)errors,
+			(unsigned long long)timeouts);
+	fprintf(stderr, "\n");
+	json_result(label, done / elapsed, "requests/sec");
+	hist_report(label, hist);
+	for (i = 0; i < conns; ++i) lconn_close(&conn[i]);
+}
+#else
+void
+load(char *server, int prog, char **files, int nfiles,
+     int conns, int keepalive, int rate, int secs)
+{
+	fprintf(stderr, "lat_http: load generation needs epoll\n");
+	exit(1);
+}
+#endif
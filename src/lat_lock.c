@@ -0,0 +1,455 @@
+/*
+ * lat_lock.c - lock and thread handoff latencies
+ *
+ * usage: lat_lock [-x mutex|spin|ticket|mcs|rwlock|futex|condvar] [-w <write percent>] [-W <warmup>] [-N <repetitions>] threads [threads ...]
+ *
+ * The lock tests run that many threads, each taking and dropping one
+ * shared lock as fast as it can, and report the time per acquisition
+ * in each thread and the total acquisitions per second.  With one
+ * thread this is the uncontended cost.  rwlock takes the lock for
+ * reading, except for -w percent of the time.
+ *
+ * futex and condvar pass a token back and forth between pairs of
+ * threads, waking each other with raw FUTEX_WAKE/FUTEX_WAIT or with
+ * a condition variable, and report the time for one handoff; for
+ * these the counts are numbers of pairs.
+ *
+ * The threads are placed with LMBENCH_SCHED, as for any benchmark.
+ *
+ * Copyright (c) 1994 Larry McVoy.  Distributed under the FSF GPL with
+ * additional restriction that results may published only if
+ * (1) the benchmark is unmodified, and
+ * (2) the version in the sccsid below is included in the report.
+ */
+char	*id = "$Id$\n";
+
+#include "bench.h"
+
+#ifdef HAVE_PTHREAD
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+#define	LINE	128		/* keep the locks out of each other's way */
+
+enum { L_MUTEX, L_SPIN, L_TICKET, L_MCS, L_RWLOCK, L_FUTEX, L_CONDVAR };
+char	*modes[] = { "mutex", "spin", "ticket", "mcs", "rwlock", "futex",
+		     "condvar", NULL };
+
+typedef struct {
+	volatile unsigned next;		/* ticket to hand out */
+	char	pad[LINE - sizeof(unsigned)];
+	volatile unsigned owner;	/* ticket being served */
+} ticket_t;
+
+typedef struct _mcs {
+	struct _mcs * volatile next;
+	volatile int	locked;
+} mcs_t;
+
+/*
+ * Everything the threads share, one cache line (or two) apiece
+ */
+typedef struct {
+	pthread_mutex_t	*mutex;
+	pthread_spinlock_t *spin;
+	pthread_rwlock_t *rwlock;
+	ticket_t	*ticket;
+	mcs_t * volatile *mcs;		/* the tail of the MCS queue */
+	volatile uint64	*counter;	/* what the locks protect */
+} locks_t;
+
+/*
+ * The two sides of a handoff
+ */
+typedef struct {
+	volatile int	turn;		/* 1 when it is the peer's turn */
+	volatile int	stop;
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;
+} pair_t;
+
+typedef struct _state {
+	int	mode;
+	int	wpct;		/* rwlock writes, percent */
+	locks_t	*locks;
+	mcs_t	*me;		/* this thread's MCS queue node */
+	pair_t	*pair;
+	pthread_t peer;
+	int	childid;	/* the peer has no benchmp_childid() */
+} state_t;
+
+void	initialize(iter_t iterations, void *cookie);
+void	cleanup(iter_t iterations, void *cookie);
+void	dolock(iter_t iterations, void *cookie);
+void	dohandoff(iter_t iterations, void *cookie);
+void	*peer(void *cookie);
+
+static void
+relax(int spins)
+{
+	/* don't starve the holder if it shares our CPU */
+	if (spins % 1024 == 0) {
+		sched_yield();
+		return;
+	}
+#if defined(__i386__) || defined(__x86_64__)
+	__asm__ __volatile__("pause" ::: "memory");
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield" ::: "memory");
+#endif
+}
+
+static void
+ticket_lock(ticket_t *t)
+{
+	unsigned	me = __sync_fetch_and_add(&t->next, 1);
+	int		spins = 0;
+
+	while (t->owner != me)
+		relax(++spins);
+	__sync_synchronize();
+}
+
+static void
+ticket_unlock(ticket_t *t)
+{
+	__sync_synchronize();
+	t->owner = t->owner + 1;
+}
+
+static void
+mcs_lock(mcs_t * volatile *tail, mcs_t *me)
+{
+	mcs_t	*prev;
+	int	spins = 0;
+
+	me->next = NULL;
+	me->locked = 1;
+	__sync_synchronize();
+	prev = __sync_lock_test_and_set(tail, me);
+	if (prev) {
+		prev->next = me;
+		while (me->locked)
+			relax(++spins);
+	}
+	__sync_synchronize();
+}
+
+static void
+mcs_unlock(mcs_t * volatile *tail, mcs_t *me)
+{
+	int	spins = 0;
+
+	__sync_synchronize();
+	if (!me->next) {
+		if (__sync_bool_compare_and_swap(tail, me, NULL))
+			return;
+		/* somebody is queueing behind us */
+		while (!me->next)
+			relax(++spins);
+	}
+	me->next->locked = 0;
+}
+
+static void
+futex_wait(volatile int *addr, int val)
+{
+#if defined(__linux__) && defined(SYS_futex)
+	syscall(SYS_futex, (int*)addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+#else
+	sched_yield();
+#endif
+}
+
+static void
+futex_wake(volatile int *addr)
+{
+#if defined(__linux__) && defined(SYS_futex)
+	syscall(SYS_futex, (int*)addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#endif
+}
+
+int
+main(int ac, char **av)
+{
+	state_t	state;
+	locks_t	locks;
+	int	i, c, threads;
+	int	warmup = 0;
+	int	repetitions = TRIES;
+	double	secs;
+	char	buf[256];
+	char	*lines;
+	char	*usage = "[-x mutex|spin|ticket|mcs|rwlock|futex|condvar] [-w <write percent>] [-W <warmup>] [-N <repetitions>] threads [threads ...]\n";
+
+	bzero(&state, sizeof(state));
+	state.mode = L_MUTEX;
+
+	while (( c = getopt(ac, av, "x:w:W:N:")) != EOF) {
+		switch(c) {
+		case 'x':
+			for (i = 0; modes[i]; ++i)
+				if (!strcmp(optarg, modes[i])) break;
+			if (!modes[i]) lmbench_usage(ac, av, usage);
+			state.mode = i;
+			break;
+		case 'w':
+			state.wpct = atoi(optarg);
+			if (state.wpct < 0 || state.wpct > 100)
+				lmbench_usage(ac, av, usage);
+			break;
+		case 'W':
+			warmup = atoi(optarg);
+			break;
+		case 'N':
+			repetitions = atoi(optarg);
+			break;
+		default:
+			lmbench_usage(ac, av, usage);
+			break;
+		}
+	}
+	if (optind > ac - 1)
+		lmbench_usage(ac, av, usage);
+#if !defined(__linux__)
+	if (state.mode == L_FUTEX) {
+		fprintf(stderr, "lat_lock: -x futex needs Linux\n");
+		exit(1);
+	}
+#endif
+
+	lines = (char*)valloc(7 * LINE);
+	if (!lines) {
+		perror("valloc");
+		exit(1);
+	}
+	bzero(lines, 7 * LINE);
+	locks.mutex = (pthread_mutex_t*)lines;
+	locks.spin = (pthread_spinlock_t*)(lines + LINE);
+	locks.rwlock = (pthread_rwlock_t*)(lines + 2 * LINE);
+	locks.ticket = (ticket_t*)(lines + 3 * LINE);	/* two lines */
+	locks.mcs = (mcs_t * volatile *)(lines + 5 * LINE);
+	locks.counter = (volatile uint64*)(lines + 6 * LINE);
+	pthread_mutex_init(locks.mutex, NULL);
+	pthread_spin_init(locks.spin, PTHREAD_PROCESS_PRIVATE);
+	pthread_rwlock_init(locks.rwlock, NULL);
+	state.locks = &locks;
+
+	/* the threads share the locks, so they must be threads */
+	benchmp_threads(1, sizeof(state));
+
+	for (i = optind; i < ac; ++i) {
+		threads = atoi(av[i]);
+		if (threads <= 0) lmbench_usage(ac, av, usage);
+		if (state.mode == L_FUTEX || state.mode == L_CONDVAR) {
+			benchmp(initialize, dohandoff, cleanup, 0, threads,
+				warmup, repetitions, &state);
+			sprintf(buf, "%s handoff, %d pair%s", modes[state.mode],
+				threads, threads > 1 ? "s" : "");
+			micro(buf, 2 * get_n());
+			continue;
+		}
+		sprintf(buf, "%s lock, %d thread%s", modes[state.mode],
+			threads, threads > 1 ? "s" : "");
+		/*
+		 * A queue lock is handed to the next waiter in line, which
+		 * may not be running, so with more threads than CPUs
+		 * nearly every handoff waits for the scheduler.
+		 */
+		if ((state.mode == L_TICKET || state.mode == L_MCS)
+		    && threads > sched_ncpus()) {
+			fprintf(stderr, "%s: skipped, only %d CPUs\n",
+				buf, sched_ncpus());
+			continue;
+		}
+		benchmp(initialize, dolock, cleanup, 0, threads,
+			warmup, repetitions, &state);
+		if ((secs = gettime() / 1000000.) == 0.) continue;
+		nano(buf, get_n());
+		fprintf(stderr, "%s: %.0f ops/sec\n",
+			buf, (double)get_n() * threads / secs);
+		json_result(buf, (double)get_n() * threads / secs, "ops/sec");
+	}
+	return (0);
+}
+
+void
+initialize(iter_t iterations, void *cookie)
+{
+	state_t	*state = (state_t *)cookie;
+
+	if (iterations) return;
+
+	if (state->mode == L_MCS) {
+		state->me = (mcs_t*)valloc(LINE);
+		if (!state->me) {
+			perror("valloc");
+			exit(1);
+		}
+		bzero(state->me, LINE);
+	}
+	if (state->mode != L_FUTEX && state->mode != L_CONDVAR)
+		return;
+
+	state->childid = benchmp_childid();
+	handle_scheduler(state->childid, 0, 1);
+	state->pair = (pair_t*)valloc(sizeof(pair_t));
+	if (!state->pair) {
+		perror("valloc");
+		exit(1);
+	}
+	bzero(state->pair, sizeof(pair_t));
+	pthread_mutex_init(&state->pair->mutex, NULL);
+	pthread_cond_init(&state->pair->cond, NULL);
+	if (pthread_create(&state->peer, NULL, peer, state) != 0) {
+		perror("pthread_create");
+		exit(1);
+	}
+}
+
+void
+cleanup(iter_t iterations, void *cookie)
+{
+	state_t	*state = (state_t *)cookie;
+	pair_t	*p = state->pair;
+
+	if (iterations) return;
+
+	if (state->me) free(state->me);
+	state->me = NULL;
+	if (!p) return;
+
+	pthread_mutex_lock(&p->mutex);
+	p->stop = 1;
+	p->turn = 1;
+	pthread_cond_signal(&p->cond);
+	pthread_mutex_unlock(&p->mutex);
+	futex_wake(&p->turn);
+	pthread_join(state->peer, NULL);
+	pthread_cond_destroy(&p->cond);
+	pthread_mutex_destroy(&p->mutex);
+	free(p);
+	state->pair = NULL;
+}
+
+void
+dolock(register iter_t iterations, void *cookie)
+{
+	state_t	*state = (state_t *)cookie;
+	locks_t	*l = state->locks;
+	volatile uint64 *counter = l->counter;
+	unsigned int	seed = (unsigned int)benchmp_childid() + 1;
+	uint64	sum = 0;
+
+	switch (state->mode) {
+	    case L_MUTEX:
+		while (iterations-- > 0) {
+			pthread_mutex_lock(l->mutex);
+			*counter += 1;
+			pthread_mutex_unlock(l->mutex);
+		}
+		break;
+	    case L_SPIN:
+		while (iterations-- > 0) {
+			pthread_spin_lock(l->spin);
+			*counter += 1;
+			pthread_spin_unlock(l->spin);
+		}
+		break;
+	    case L_TICKET:
+		while (iterations-- > 0) {
+			ticket_lock(l->ticket);
+			*counter += 1;
+			ticket_unlock(l->ticket);
+		}
+		break;
+	    case L_MCS:
+		while (iterations-- > 0) {
+			mcs_lock(l->mcs, state->me);
+			*counter += 1;
+			mcs_unlock(l->mcs, state->me);
+		}
+		break;
+	    case L_RWLOCK:
+		while (iterations-- > 0) {
+			seed = seed * 1103515245 + 12345;
+			if ((seed >> 16) % 100 < state->wpct) {
+				pthread_rwlock_wrlock(l->rwlock);
+				*counter += 1;
+			} else {
+				pthread_rwlock_rdlock(l->rwlock);
+				sum += *counter;
+			}
+			pthread_rwlock_unlock(l->rwlock);
+		}
+		break;
+	}
+	use_int((int)sum);
+}
+
+/*
+ * One round trip: give the peer the token and wait for it back
+ */
+void
+dohandoff(register iter_t iterations, void *cookie)
+{
+	state_t	*state = (state_t *)cookie;
+	pair_t	*p = state->pair;
+
+	if (state->mode == L_FUTEX) {
+		while (iterations-- > 0) {
+			p->turn = 1;
+			futex_wake(&p->turn);
+			while (p->turn == 1)
+				futex_wait(&p->turn, 1);
+		}
+		return;
+	}
+	pthread_mutex_lock(&p->mutex);
+	while (iterations-- > 0) {
+		p->turn = 1;
+		pthread_cond_signal(&p->cond);
+		while (p->turn == 1)
+			pthread_cond_wait(&p->cond, &p->mutex);
+	}
+	pthread_mutex_unlock(&p->mutex);
+}
+
+void *
+peer(void *cookie)
+{
+	state_t	*state = (state_t *)cookie;
+	pair_t	*p = state->pair;
+
+	handle_scheduler(state->childid, 1, 1);
+	if (state->mode == L_FUTEX) {
+		for (;;) {
+			while (p->turn == 0)
+				futex_wait(&p->turn, 0);
+			if (p->stop) break;
+			p->turn = 0;
+			futex_wake(&p->turn);
+		}
+		return (NULL);
+	}
+	pthread_mutex_lock(&p->mutex);
+	for (;;) {
+		while (p->turn == 0)
+			pthread_cond_wait(&p->cond, &p->mutex);
+		if (p->stop) break;
+		p->turn = 0;
+		pthread_cond_signal(&p->cond);
+	}
+	pthread_mutex_unlock(&p->mutex);
+	return (NULL);
+}
+#else
+int
+main(int ac, char **av)
+{
+	fprintf(stderr, "lat_lock: needs pthreads\n");
+	return (1);
+}
+#endif /* HAVE_PTHREAD */
@@ -0,0 +1,344 @@
+/*
+ * lat_mem_load.c - memory load latency while other processors use the memory
+ *
+ * usage: lat_mem_load [-t rd|wr|cp] [-T <traffic processes>] [-d <delay>[,<delay>...]] [-M <traffic size>] [-L <line size>] [-W <warmup>] [-N <repetitions>] size-in-MB
+ *
+ * One process chases a random pointer chain through size-in-MB of
+ * memory, as in par_mem, while the other processes read, write or
+ * copy their own buffers.  Each traffic process pauses for <delay>
+ * trips around an empty loop after every 4KB it moves, so each delay
+ * gives a different load on the memory system.  For each delay, and
+ * first with no traffic at all, it prints the bandwidth the traffic
+ * got and the latency of the pointer chase, giving a curve of
+ * latency against bandwidth.
+ *
+ * The processes are placed with LMBENCH_SCHED, the chaser first.
+ * On a NUMA machine, unless LMBENCH_NUMA says otherwise, the curve is
+ * repeated with all the memory on each node in turn.
+ *
+ * Copyright (c) 1994 Larry McVoy.  Distributed under the FSF GPL with
+ * additional restriction that results may published only if
+ * (1) the benchmark is unmodified, and
+ * (2) the version in the sccsid below is included in the report.
+ */
+char	*id = "$Id$\n";
+
+#include "bench.h"
+
+#define	LINE	128		/* keep the counters out of each other's way */
+#define	CHUNK	4096		/* bytes moved between delays */
+#define	TYPE	long
+
+enum { T_RD, T_WR, T_CP };
+char	*kinds[] = { "rd", "wr", "cp", NULL };
+
+int	delays[] = { 20000, 10000, 5000, 2000, 1000, 500, 200, 100, 50, 0, -1 };
+
+typedef struct {
+	volatile uint64	bytes;	/* moved so far */
+	volatile int	ready;	/* buffer is allocated and touched */
+} slot_t;
+
+typedef struct {
+	uint64	bytes;		/* moved by the traffic while timing */
+	uint64	ns;		/* time over which they were moved */
+} totals_t;
+
+typedef struct _state {
+	struct mem_state mem;	/* the pointer chain */
+	int	kind;
+	int	ntraffic;	/* traffic processes this time */
+	int	delay;
+	size_t	tlen;		/* bytes in each traffic buffer */
+	char	*shared;	/* slots, then the result */
+	pid_t	*pids;
+	uint64	start;
+	uint64	bytes;
+} state_t;
+
+#define	SLOT(s, i)	((slot_t*)((s)->shared + (i) * LINE))
+#define	RESULT(s, n)	((totals_t*)((s)->shared + (n) * LINE))
+
+void	initialize(iter_t iterations, void* cookie);
+void	benchmark(iter_t iterations, void* cookie);
+void	cleanup(iter_t iterations, void* cookie);
+void	traffic(state_t* state, int i);
+uint64	traffic_bytes(state_t* state);
+void	loaded(state_t* state, int warmup, int repetitions);
+
+int
+main(int ac, char **av)
+{
+	state_t	state;
+	int	i, c, n, node, nnodes = 1;
+	int	warmup = 0;
+	int	repetitions = TRIES;
+	int	ntraffic = sched_ncpus() - 1;
+	int	*list = delays;
+	char	*p;
+	static char env[64];
+	char	*usage = "[-t rd|wr|cp] [-T <traffic processes>] [-d <delay>[,<delay>...]] [-M <traffic size>] [-L <line size>] [-W <warmup>] [-N <repetitions>] size-in-MB\n";
+
+	bzero(&state, sizeof(state));
+	state.kind = T_RD;
+	state.tlen = 64 * 1024 * 1024;
+	state.mem.line = 128;
+	state.mem.pagesize = getpagesize();
+	if (ntraffic < 1) ntraffic = 1;
+
+	while (( c = getopt(ac, av, "t:T:d:M:L:W:N:")) != EOF) {
+		switch(c) {
+		case 't':
+			for (i = 0; kinds[i]; ++i)
+				if (strcmp(optarg, kinds[i]) == 0) break;
+			if (!kinds[i]) lmbench_usage(ac, av, usage);
+			state.kind = i;
+			break;
+		case 'T':
+			ntraffic = atoi(optarg);
+			if (ntraffic <= 0) lmbench_usage(ac, av, usage);
+			break;
+		case 'd':
+			for (n = 1, p = optarg; *p; ++p)
+				if (*p == ',') n++;
+			list = (int*)malloc((n + 1) * sizeof(int));
+			for (i = 0, p = optarg; i < n; ++i) {
+				list[i] = strtol(p, &p, 10);
+				if (list[i] < 0) lmbench_usage(ac, av, usage);
+				if (*p == ',') p++;
+			}
+			list[n] = -1;
+			break;
+		case 'M':
+			state.tlen = bytes(optarg);
+			if (state.tlen < 2 * CHUNK) state.tlen = 2 * CHUNK;
+			break;
+		case 'L':
+			state.mem.line = atoi(optarg);
+			if (state.mem.line < sizeof(char*))
+				state.mem.line = sizeof(char*);
+			break;
+		case 'W':
+			warmup = atoi(optarg);
+			break;
+		case 'N':
+			repetitions = atoi(optarg);
+			break;
+		default:
+			lmbench_usage(ac, av, usage);
+			break;
+		}
+	}
+	if (optind != ac - 1) {
+		lmbench_usage(ac, av, usage);
+	}
+	state.mem.len = state.mem.maxlen = atoi(av[optind]) * 1024 * 1024;
+	state.mem.width = 1;
+	state.tlen -= state.tlen % CHUNK;
+
+	state.shared = (char*)mmap(0, (ntraffic + 1) * LINE,
+				   PROT_READ|PROT_WRITE,
+				   MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (state.shared == (char*)MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+
+	if (!getenv("LMBENCH_NUMA")) nnodes = numa_nodes();
+	for (node = 0; node < nnodes; ++node) {
+		if (nnodes > 1) {
+			if (!numa_has_memory(node)) continue;
+			sprintf(env, "LMBENCH_NUMA=MEM %d", node);
+			putenv(env);
+			fprintf(stderr, "\"%s traffic from %d process%s, "
+				"memory on node %d\n", kinds[state.kind],
+				ntraffic, ntraffic > 1 ? "es" : "", node);
+		} else {
+			fprintf(stderr, "\"%s traffic from %d process%s\n",
+				kinds[state.kind], ntraffic,
+				ntraffic > 1 ? "es" : "");
+		}
+
+		/* unloaded first, then heavier and heavier loads */
+		state.ntraffic = 0;
+		loaded(&state, warmup, repetitions);
+		state.ntraffic = ntraffic;
+		for (i = 0; list[i] >= 0; ++i) {
+			state.delay = list[i];
+			loaded(&state, warmup, repetitions);
+		}
+		fprintf(stderr, "\n");
+	}
+	return (0);
+}
+
+/*
+ * One point on the curve: traffic bandwidth in MB/sec, then latency
+ */
+void
+loaded(state_t* state, int warmup, int repetitions)
+{
+	totals_t *r = RESULT(state, state->ntraffic);
+	double	ns, bw = 0.;
+
+	bzero(state->shared, (state->ntraffic + 1) * LINE);
+	benchmp(initialize, benchmark, cleanup, 0, 1,
+		warmup, repetitions, state);
+	if (gettime() == 0) return;
+
+	/* each iteration is a hundred loads */
+	ns = (double)gettime() * 10. / (double)get_n();
+	if (r->ns > 0)
+		bw = (double)r->bytes * 1000. / (double)r->ns;
+	fprintf(stderr, "%.2f %.3f\n", bw, ns);
+	if (json_output()) {
+		char	buf[64];
+
+		sprintf(buf, "%.2f", bw);
+		json_result(buf, ns, "nanoseconds");
+	}
+}
+
+void
+initialize(iter_t iterations, void* cookie)
+{
+	state_t* state = (state_t*)cookie;
+	int	i;
+
+	if (iterations) return;
+
+	handle_scheduler(benchmp_childid(), 0, state->ntraffic);
+	mem_initialize(0, &state->mem);
+	if (state->mem.addr == NULL) {
+		fprintf(stderr, "lat_mem_load: cannot allocate %lu bytes\n",
+			(unsigned long)state->mem.len);
+		exit(1);
+	}
+
+	state->pids = (pid_t*)malloc((state->ntraffic + 1) * sizeof(pid_t));
+	for (i = 0; i < state->ntraffic; ++i) {
+		switch (state->pids[i] = fork()) {
+		case 0:
+			handle_scheduler(benchmp_childid(),
+					 i + 1, state->ntraffic);
+			signal(SIGTERM, exit);
+			traffic(state, i);
+			exit(0);
+		case -1:
+			perror("fork");
+			exit(1);
+		default:
+			break;
+		}
+	}
+	for (i = 0; i < state->ntraffic; ++i) {
+		while (!SLOT(state, i)->ready)
+			usleep(1000);
+	}
+	state->bytes = traffic_bytes(state);
+	state->start = now_ns();
+}
+
+void
+cleanup(iter_t iterations, void* cookie)
+{
+	state_t* state = (state_t*)cookie;
+	totals_t *r = RESULT(state, state->ntraffic);
+	int	i;
+
+	if (iterations) return;
+
+	r->bytes = traffic_bytes(state) - state->bytes;
+	r->ns = now_ns() - state->start;
+	if (state->pids) {
+		for (i = 0; i < state->ntraffic; ++i) {
+			kill(state->pids[i], SIGKILL);
+			waitpid(state->pids[i], NULL, 0);
+		}
+		free(state->pids);
+		state->pids = NULL;
+	}
+	mem_cleanup(0, &state->mem);
+}
+
+void
+benchmark(iter_t iterations, void* cookie)
+{
+	state_t* state = (state_t*)cookie;
+
+	mem_benchmark_0(iterations, &state->mem);
+}
+
+uint64
+traffic_bytes(state_t* state)
+{
+	int	i;
+	uint64	sum = 0;
+
+	for (i = 0; i < state->ntraffic; ++i)
+		sum += SLOT(state, i)->bytes;
+	return (sum);
+}
+
+/*
+ * Move CHUNK bytes at a time through our own buffer, sitting in a
+ * delay loop after each chunk.  Reads touch every fourth word, which
+ * is still every cache line; writes and copies store every word.
+ * Copies count the bytes both read and written.
+ */
+void
+traffic(state_t* state, int i)
+{
+	slot_t	*s = SLOT(state, i);
+	TYPE	*buf, *p, *q, *end;
+	register TYPE sum = 0;
+	register int j;
+	volatile int d;
+	int	n = CHUNK / sizeof(TYPE);
+	size_t	len = state->tlen;
+
+	buf = (TYPE*)valloc(len);
+	if (!buf) {
+		perror("valloc");
+		exit(1);
+	}
+	bzero((void*)buf, len);
+	end = (TYPE*)((char*)buf + len);
+	s->ready = 1;
+
+	switch (state->kind) {
+	case T_RD:
+		for (;;) {
+			for (p = buf; p < end; p += n) {
+				for (j = 0; j < n; j += 16)
+					sum += p[j] + p[j+4]
+						+ p[j+8] + p[j+12];
+				s->bytes += CHUNK;
+				for (d = state->delay; d > 0; --d)
+					;
+			}
+			use_int((int)sum);
+		}
+	case T_WR:
+		for (;;) {
+			for (p = buf; p < end; p += n) {
+				for (j = 0; j < n; ++j)
+					p[j] = (TYPE)j;
+				s->bytes += CHUNK;
+				for (d = state->delay; d > 0; --d)
+					;
+			}
+		}
+	case T_CP:
+		end = (TYPE*)((char*)buf + len / 2 / CHUNK * CHUNK);
+		for (;;) {
+			for (p = buf, q = end; p < end; p += n, q += n) {
+				for (j = 0; j < n; ++j)
+					q[j] = p[j];
+				s->bytes += 2 * CHUNK;
+				for (d = state->delay; d > 0; --d)
+					;
+			}
+		}
+	}
+}
@@ -1,7 +1,18 @@
 /*
  * lat_mem_rd.c - measure memory load latency
  *
- * usage: lat_mem_rd [-P <parallelism>] [-W <warmup>] [-N <repetitions>] [-t] size-in-MB [stride ...]
+ * usage: lat_mem_rd [-P <parallelism>] [-W <warmup>] [-N <repetitions>] [-t] [-x <pattern>] [-S <streams>] size-in-MB [stride ...]
+ *
+ * The chain through memory is one of these patterns, to see which
+ * ones the hardware prefetchers can follow:
+ *
+ *	stride		each line in turn (the default)
+ *	thrash		random, a different page each time (same as -t)
+ *	streams		<streams> interleaved sequential streams
+ *	growing		a stride that grows by a line at each step
+ *	backward	each line in turn from the top down
+ *	pagerand	pages in order, lines in a random order within each
+ *	tiled		8x8 tiles of a matrix whose rows are pages
  *
  * Copyright (c) 1994 Larry McVoy.  
  * Copyright (c) 2003, 2004 Carl Staelin.
@@ -22,7 +33,25 @@ void	loads(size_t len, size_t range, size_t stride,
 size_t	step(size_t k);
 void	initialize(iter_t iterations, void* cookie);
 
-benchmp_f	fpInit = stride_initialize;
+void	sweep(size_t len, size_t stride, 
+	      int parallel, int warmup, int repetitions);
+
+struct {
+	char		*name;
+	benchmp_f	init;
+} patterns[] = {
+	{ "stride",	stride_initialize },
+	{ "thrash",	thrash_initialize },
+	{ "streams",	streams_initialize },
+	{ "growing",	growing_initialize },
+	{ "backward",	backward_initialize },
+	{ "pagerand",	pagerand_initialize },
+	{ "tiled",	tiled_initialize },
+	{ NULL,		NULL }
+};
+
+int		pattern = 0;
+int		streams = 4;
 
 int
 main(int ac, char **av)
@@ -33,14 +62,23 @@ main(int ac, char **av)
 	int	warmup = 0;
 	int	repetitions = TRIES;
         size_t	len;
-	size_t	range;
-	size_t	stride;
-	char   *usage = "[-P <parallelism>] [-W <warmup>] [-N <repetitions>] [-t] len [stride...]\n";
+	char   *usage = "[-P <parallelism>] [-W <warmup>] [-N <repetitions>] [-t] [-x stride|thrash|streams|growing|backward|pagerand|tiled] [-S <streams>] len [stride...]\n";
 
-	while (( c = getopt(ac, av, "tP:W:N:")) != EOF) {
+	while (( c = getopt(ac, av, "tx:S:P:W:N:")) != EOF) {
 		switch(c) {
 		case 't':
-			fpInit = thrash_initialize;
+			pattern = 1;
+			break;
+		case 'x':
+			for (pattern = 0; patterns[pattern].name; ++pattern)
+				if (!strcmp(optarg, patterns[pattern].name))
+					break;
+			if (!patterns[pattern].name)
+				lmbench_usage(ac, av, usage);
+			break;
+		case 'S':
+			streams = atoi(optarg);
+			if (streams <= 0) lmbench_usage(ac, av, usage);
 			break;
 		case 'P':
 			parallel = atoi(optarg);
@@ -65,25 +103,33 @@ main(int ac, char **av)
 	len *= 1024 * 1024;
 
 	if (optind == ac - 1) {
-		fprintf(stderr, "\"stride=%d\n", STRIDE);
-		for (range = LOWER; range <= len; range = step(range)) {
-			loads(len, range, STRIDE, parallel, 
-			      warmup, repetitions);
-		}
+		sweep(len, STRIDE, parallel, warmup, repetitions);
 	} else {
 		for (i = optind + 1; i < ac; ++i) {
-			stride = bytes(av[i]);
-			fprintf(stderr, "\"stride=%d\n", stride);
-			for (range = LOWER; range <= len; range = step(range)) {
-				loads(len, range, stride, parallel, 
-				      warmup, repetitions);
-			}
+			sweep(len, bytes(av[i]), parallel, warmup, repetitions);
 			fprintf(stderr, "\n");
 		}
 	}
 	return(0);
 }
 
+void
+sweep(size_t len, size_t stride, int parallel, int warmup, int repetitions)
+{
+	size_t	range;
+
+	/* the scripts look for plain "stride= */
+	if (pattern <= 1) {
+		fprintf(stderr, "\"stride=%d\n", (int)stride);
+	} else {
+		fprintf(stderr, "\"%s stride=%d\n", 
+			patterns[pattern].name, (int)stride);
+	}
+	for (range = LOWER; range <= len; range = step(range)) {
+		loads(len, range, stride, parallel, warmup, repetitions);
+	}
+}
+
 #define	ONE	p = (char **)*p;
 #define	FIVE	ONE ONE ONE ONE ONE
 #define	TEN	FIVE FIVE
@@ -120,7 +166,7 @@ loads(size_t len, size_t range, size_t stride,
 
 	if (range < stride) return;
 
-	state.width = 1;
+	state.width = streams;
 	state.len = range;
 	state.maxlen = len;
 	state.line = stride;
@@ -128,7 +174,7 @@ loads(size_t len, size_t range, size_t stride,
 	count = 100 * (state.len / (state.line * 100) + 1);
 
 #if 0
-	(*fpInit)(0, &state);
+	(*patterns[pattern].init)(0, &state);
 	fprintf(stderr, "loads: after init\n");
 	(*benchmark_loads)(2, &state);
 	fprintf(stderr, "loads: after benchmark\n");
@@ -140,7 +186,7 @@ loads(size_t len, size_t range, size_t stride,
 	/*
 	 * Now walk them and time it.
 	 */
-	benchmp(fpInit, benchmark_loads, mem_cleanup, 
+	benchmp(patterns[pattern].init, benchmark_loads, mem_cleanup, 
 		100000, parallel, warmup, repetitions, &state);
 #endif
 
@@ -148,6 +194,18 @@ loads(size_t len, size_t range, size_t stride,
 	save_minimum();
 	result = (1000. * (double)gettime()) / (double)(count * get_n());
 	fprintf(stderr, "%.5f %.3f\n", range / (1024. * 1024.), result);
+	if (json_output()) {
+		char	buf[64];
+
+		sprintf(buf, "%.5f", range / (1024. * 1024.));
+		json_result(buf, result, "nanoseconds");
+	}
+	if (getenv("LMBENCH_PERF")) {
+		char	buf[64];
+
+		sprintf(buf, "%.5f", range / (1024. * 1024.));
+		perf_report(buf, (double)count);
+	}
 
 }
 
@@ -0,0 +1,386 @@
+/*
+ * lat_mem_wr.c - measure memory store latency
+ *
+ * usage: lat_mem_wr [-x rd|ldst|shared|st|nt] [-P <parallelism>] [-W <warmup>] [-N <repetitions>] size-in-MB [stride ...]
+ *
+ * The read latency in lat_mem_rd is easy to measure because each load
+ * needs the one before it.  Nothing waits for a store, so instead we
+ * time stores the ways programs meet them, over the random pointer
+ * chain from mem_initialize():
+ *
+ *	rd	the plain chain, for comparison
+ *	ldst	load each pointer and store it back, so every line
+ *		visited is dirtied and has to be written back when it
+ *		is evicted
+ *	shared	the same while another thread reads the chain, so
+ *		the lines are usually shared with its cache and each
+ *		store has to invalidate the other copy
+ *	st	write whole lines in the chain's order, so each store
+ *		misses and has to read the line for ownership first
+ *	nt	the same with non-temporal stores, which skip the read
+ *
+ * and report nanoseconds per line in the lat_mem_rd format.
+ *
+ * Copyright (c) 1994 Larry McVoy.  Distributed under the FSF GPL with
+ * additional restriction that results may published only if
+ * (1) the benchmark is unmodified, and
+ * (2) the version in the sccsid below is included in the report.
+ * Support for this development by Sun Microsystems is gratefully acknowledged.
+ */
+char	*id = "$Id$\n";
+
+#include "bench.h"
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#define STRIDE  (512/sizeof(char *))
+#define	LOWER	512
+
+enum { W_RD, W_LDST, W_SHARED, W_ST, W_NT };
+char	*modes[] = { "rd", "ldst", "shared", "st", "nt", NULL };
+
+typedef struct _state {
+	struct mem_state mem;
+	int	mode;
+	size_t	count;		/* lines per iteration */
+	char	**addrs;	/* line addresses in chain order, for st/nt */
+	size_t	naddrs;
+	int	childid;
+#ifdef HAVE_PTHREAD
+	pthread_t reader;	/* for shared */
+	volatile int stop;
+#endif
+} state_t;
+
+void	sweep(size_t len, size_t stride, int mode,
+	      int parallel, int warmup, int repetitions);
+void	stores(size_t len, size_t range, size_t stride, int mode,
+	       int parallel, int warmup, int repetitions);
+void*	reader(void* cookie);
+size_t	step(size_t k);
+void	initialize(iter_t iterations, void* cookie);
+void	cleanup(iter_t iterations, void* cookie);
+void	benchmark_rd(iter_t iterations, void* cookie);
+void	benchmark_ldst(iter_t iterations, void* cookie);
+void	benchmark_st(iter_t iterations, void* cookie);
+void	benchmark_nt(iter_t iterations, void* cookie);
+
+benchmp_f	benchmarks[] = { benchmark_rd, benchmark_ldst, benchmark_ldst,
+				 benchmark_st, benchmark_nt };
+
+int
+main(int ac, char **av)
+{
+	int	i;
+	int	c;
+	int	mode = W_LDST;
+	int	parallel = 1;
+	int	warmup = 0;
+	int	repetitions = TRIES;
+        size_t	len;
+	char   *usage = "[-x rd|ldst|shared|st|nt] [-P <parallelism>] [-W <warmup>] [-N <repetitions>] len [stride...]\n";
+
+	while (( c = getopt(ac, av, "x:P:W:N:")) != EOF) {
+		switch(c) {
+		case 'x':
+			for (mode = 0; modes[mode]; ++mode)
+				if (!strcmp(optarg, modes[mode])) break;
+			if (!modes[mode]) lmbench_usage(ac, av, usage);
+			break;
+		case 'P':
+			parallel = atoi(optarg);
+			if (parallel <= 0) lmbench_usage(ac, av, usage);
+			break;
+		case 'W':
+			warmup = atoi(optarg);
+			break;
+		case 'N':
+			repetitions = atoi(optarg);
+			break;
+		default:
+			lmbench_usage(ac, av, usage);
+			break;
+		}
+	}
+	if (optind == ac) {
+		lmbench_usage(ac, av, usage);
+	}
+#ifndef HAVE_X86_SIMD
+	if (mode == W_NT) {
+		fprintf(stderr, "lat_mem_wr: no non-temporal stores here\n");
+		exit(1);
+	}
+#endif
+#ifndef HAVE_PTHREAD
+	if (mode == W_SHARED) {
+		fprintf(stderr, "lat_mem_wr: shared needs pthreads\n");
+		exit(1);
+	}
+#endif
+
+        len = atoi(av[optind]);
+	len *= 1024 * 1024;
+
+	if (optind == ac - 1) {
+		sweep(len, STRIDE, mode, parallel, warmup, repetitions);
+	} else {
+		for (i = optind + 1; i < ac; ++i) {
+			sweep(len, bytes(av[i]), mode, parallel,
+			      warmup, repetitions);
+			fprintf(stderr, "\n");
+		}
+	}
+	return(0);
+}
+
+void
+sweep(size_t len, size_t stride, int mode,
+      int parallel, int warmup, int repetitions)
+{
+	size_t	range;
+
+	if (mode == W_NT && stride % 16) {
+		fprintf(stderr, "lat_mem_wr: nt needs a stride "
+			"which is a multiple of 16\n");
+		exit(1);
+	}
+	fprintf(stderr, "\"%s stride=%d\n", modes[mode], (int)stride);
+	for (range = LOWER; range <= len; range = step(range)) {
+		stores(len, range, stride, mode, parallel, 
+		       warmup, repetitions);
+	}
+}
+
+#define	FIVE(m)		m m m m m
+#define	TEN(m)		FIVE(m) FIVE(m)
+#define	FIFTY(m)	TEN(m) TEN(m) TEN(m) TEN(m) TEN(m)
+#define	HUNDRED(m)	FIFTY(m) FIFTY(m)
+
+#define	LOAD		p = (char**)*p;
+#define	LOADSTORE	q = (char**)*p; *p = (char*)q; p = q;
+
+void
+initialize(iter_t iterations, void* cookie)
+{
+	state_t* state = (state_t*)cookie;
+	register char **p;
+	size_t	i, off;
+
+	if (iterations) return;
+
+	mem_initialize(0, &state->mem);
+	if (state->mem.addr == NULL) return;
+
+	if (state->mode == W_ST || state->mode == W_NT) {
+		/* the lines in the order the chain visits them */
+		state->naddrs = state->mem.len / state->mem.line;
+		state->addrs = (char**)malloc(state->naddrs * sizeof(char*));
+		p = (char**)state->mem.p[0];
+		for (i = 0; i < state->naddrs; ++i) {
+			off = ((char*)p - state->mem.base) % state->mem.line;
+			state->addrs[i] = (char*)p - off;
+			p = (char**)*p;
+		}
+	}
+
+#ifdef HAVE_PTHREAD
+	/* a thread, so that it reads the very lines we write */
+	if (state->mode == W_SHARED) {
+		state->childid = benchmp_childid();
+		state->stop = 0;
+		handle_scheduler(state->childid, 0, 1);
+		if (pthread_create(&state->reader, NULL, reader, state)) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+#endif
+}
+
+#ifdef HAVE_PTHREAD
+void*
+reader(void* cookie)
+{
+	state_t* state = (state_t*)cookie;
+	register char **p = (char**)state->mem.p[0];
+
+	handle_scheduler(state->childid, 1, 1);
+	while (!state->stop) {
+		HUNDRED(LOAD);
+	}
+	use_pointer((void *)p);
+	return (NULL);
+}
+#endif
+
+void
+cleanup(iter_t iterations, void* cookie)
+{
+	state_t* state = (state_t*)cookie;
+
+	if (iterations) return;
+
+#ifdef HAVE_PTHREAD
+	if (state->mode == W_SHARED && !state->stop) {
+		state->stop = 1;
+		pthread_join(state->reader, NULL);
+	}
+#endif
+	if (state->addrs) {
+		free(state->addrs);
+		state->addrs = NULL;
+	}
+	mem_cleanup(0, &state->mem);
+}
+
+void
+benchmark_rd(iter_t iterations, void *cookie)
+{
+	state_t* state = (state_t*)cookie;
+	register char **p = (char**)state->mem.p[0];
+	register size_t i;
+	register size_t count = state->count / 100;
+
+	while (iterations-- > 0) {
+		for (i = 0; i < count; ++i) {
+			HUNDRED(LOAD);
+		}
+	}
+
+	use_pointer((void *)p);
+	state->mem.p[0] = (char*)p;
+}
+
+/*
+ * Storing back what we loaded keeps the chain intact
+ */
+void
+benchmark_ldst(iter_t iterations, void *cookie)
+{
+	state_t* state = (state_t*)cookie;
+	register char **p = (char**)state->mem.p[0];
+	register char **q;
+	register size_t i;
+	register size_t count = state->count / 100;
+
+	while (iterations-- > 0) {
+		for (i = 0; i < count; ++i) {
+			HUNDRED(LOADSTORE);
+		}
+	}
+
+	use_pointer((void *)p);
+	state->mem.p[0] = (char*)p;
+}
+
+void
+benchmark_st(iter_t iterations, void *cookie)
+{
+	state_t* state = (state_t*)cookie;
+	register char **addrs = state->addrs;
+	register size_t i, j;
+	register size_t n = state->naddrs;
+	register size_t nw = state->mem.line / sizeof(long);
+
+	while (iterations-- > 0) {
+		for (i = 0; i < n; ++i) {
+			register long *p = (long*)addrs[i];
+
+			for (j = 0; j < nw; ++j)
+				p[j] = (long)i;
+		}
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2"))) void
+benchmark_nt(iter_t iterations, void *cookie)
+{
+	state_t* state = (state_t*)cookie;
+	register char **addrs = state->addrs;
+	register size_t i, j;
+	register size_t n = state->naddrs;
+	register size_t nv = state->mem.line / sizeof(__m128i);
+	__m128i	one = _mm_set1_epi32(1);
+
+	while (iterations-- > 0) {
+		for (i = 0; i < n; ++i) {
+			register __m128i *p = (__m128i*)addrs[i];
+
+			for (j = 0; j < nv; ++j)
+				_mm_stream_si128(p + j, one);
+		}
+		_mm_sfence();
+	}
+}
+#else
+void
+benchmark_nt(iter_t iterations, void *cookie)
+{
+	benchmark_st(iterations, cookie);
+}
+#endif
+
+void
+stores(size_t len, size_t range, size_t stride, int mode,
+       int parallel, int warmup, int repetitions)
+{
+	double	result;
+	state_t	state;
+
+	if (range < stride) return;
+
+	bzero(&state, sizeof(state));
+	state.mode = mode;
+	state.mem.width = 1;
+	state.mem.len = range;
+	state.mem.maxlen = len;
+	state.mem.line = stride;
+	state.mem.pagesize = getpagesize();
+	state.count = 100 * (range / (stride * 100) + 1);
+#ifdef HAVE_PTHREAD
+	state.stop = 1;		/* no reader yet */
+#endif
+
+	benchmp(initialize, benchmarks[mode], cleanup,
+		100000, parallel, warmup, repetitions, &state);
+
+	/* st and nt store to every line once per iteration */
+	if (mode == W_ST || mode == W_NT)
+		state.count = range / stride;
+
+	/* We want to get to nanoseconds / line. */
+	save_minimum();
+	result = (1000. * (double)gettime()) / (double)(state.count * get_n());
+	fprintf(stderr, "%.5f %.3f\n", range / (1024. * 1024.), result);
+	if (json_output()) {
+		char	buf[64];
+
+		sprintf(buf, "%.5f", range / (1024. * 1024.));
+		json_result(buf, result, "nanoseconds");
+	}
+	if (getenv("LMBENCH_PERF")) {
+		char	buf[64];
+
+		sprintf(buf, "%.5f", range / (1024. * 1024.));
+		perf_report(buf, (double)state.count);
+	}
+}
+
+size_t
+step(size_t k)
+{
+	if (k < 1024) {
+		k = k * 2;
+        } else if (k < 4*1024) {
+		k += 1024;
+	} else {
+		size_t s;
+
+		for (s = 32 * 1024; s <= k; s *= 2)
+			;
+		k += s / 16;
+	}
+	return (k);
+}
@@ -1,7 +1,7 @@
 /*
  * lat_mmap.c - time how fast a mapping can be made and broken down
  *
- * Usage: mmap [-r] [-C] [-P <parallelism>] [-W <warmup>] [-N <repetitions>] size file
+ * Usage: mmap [-r] [-C] [-T] [-P <parallelism>] [-W <warmup>] [-N <repetitions>] size file
  *
  * XXX - If an implementation did lazy address space mapping, this test
  * will make that system look very good.  I haven't heard of such a system.
@@ -43,14 +43,15 @@ main(int ac, char **av)
 	int	parallel = 1;
 	int	warmup = 0;
 	int	repetitions = TRIES;
+	int	threads = 0;
 	char	buf[256];
 	int	c;
-	char	*usage = "[-r] [-C] [-P <parallelism>] [-W <warmup>] [-N <repetitions>] size file\n";
+	char	*usage = "[-r] [-C] [-T] [-P <parallelism>] [-W <warmup>] [-N <repetitions>] size file\n";
 	
 
 	state.random = 0;
 	state.clone = 0;
-	while (( c = getopt(ac, av, "rP:W:N:C")) != EOF) {
+	while (( c = getopt(ac, av, "rP:W:N:CT")) != EOF) {
 		switch(c) {
 		case 'P':
 			parallel = atoi(optarg);
@@ -69,6 +70,9 @@ main(int ac, char **av)
 		case 'C':
 			state.clone = 1;
 			break;
+		case 'T':
+			threads = 1;
+			break;
 		default:
 			lmbench_usage(ac, av, usage);
 			break;
@@ -84,6 +88,7 @@ main(int ac, char **av)
 		return (1);
 	}
 	state.name = av[optind+1];
+	benchmp_threads(threads, sizeof(state));
 
 	benchmp(init, domapping, cleanup, 0, parallel, 
 		warmup, repetitions, &state);
@@ -105,10 +110,10 @@ init(iter_t iterations, void* cookie)
 		char buf[128];
 		char* s;
 
-		/* copy original file into a process-specific one */
-		sprintf(buf, "%d", (int)getpid());
+		/* copy original file into a child-specific one */
+		sprintf(buf, "%d.%d", (int)getpid(), benchmp_childid());
 		s = (char*)malloc(strlen(state->name) + strlen(buf) + 1);
-		sprintf(s, "%s%d", state->name, (int)getpid());
+		sprintf(s, "%s%s", state->name, buf);
 		if (cp(state->name, s, S_IREAD|S_IWRITE) < 0) {
 			perror("Could not copy file");
 			unlink(s);
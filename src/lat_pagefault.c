@@ -1,7 +1,7 @@
 /*
  * lat_pagefault.c - time a page fault in
  *
- * Usage: lat_pagefault [-C] [-P <parallel>] [-W <warmup>] [-N <repetitions>] file 
+ * Usage: lat_pagefault [-C] [-T] [-P <parallel>] [-W <warmup>] [-N <repetitions>] file 
  *
  * Copyright (c) 2000 Carl Staelin.
  * Copyright (c) 1994 Larry McVoy.  Distributed under the FSF GPL with
@@ -37,17 +37,18 @@ main(int ac, char **av)
 	int parallel = 1;
 	int warmup = 0;
 	int repetitions = TRIES;
+	int threads = 0;
 	int c;
 	double t_mmap;
 	double t_combined;
 	struct stat   st;
 	struct _state state;
 	char buf[2048];
-	char* usage = "[-C] [-P <parallel>] [-W <warmup>] [-N <repetitions>] file\n";
+	char* usage = "[-C] [-T] [-P <parallel>] [-W <warmup>] [-N <repetitions>] file\n";
 
 	state.clone = 0;
 
-	while (( c = getopt(ac, av, "P:W:N:C")) != EOF) {
+	while (( c = getopt(ac, av, "P:W:N:CT")) != EOF) {
 		switch(c) {
 		case 'P':
 			parallel = atoi(optarg);
@@ -62,6 +63,9 @@ main(int ac, char **av)
 		case 'C':
 			state.clone = 1;
 			break;
+		case 'T':
+			threads = 1;
+			break;
 		default:
 			lmbench_usage(ac, av, usage);
 			break;
@@ -74,6 +78,7 @@ main(int ac, char **av)
 	state.file = av[optind];
 	CHK(stat(state.file, &st));
 	state.npages = st.st_size / (size_t)getpagesize();
+	benchmp_threads(threads, sizeof(state));
 
 #ifdef	MS_INVALIDATE
 	benchmp(initialize, benchmark_mmap, cleanup, 0, parallel, 
@@ -106,10 +111,10 @@ initialize(iter_t iterations, void* cookie)
 		char buf[128];
 		char* s;
 
-		/* copy original file into a process-specific one */
-		sprintf(buf, "%d", (int)getpid());
+		/* copy original file into a child-specific one */
+		sprintf(buf, "%d.%d", (int)getpid(), benchmp_childid());
 		s = (char*)malloc(strlen(state->file) + strlen(buf) + 1);
-		sprintf(s, "%s%d", state->file, (int)getpid());
+		sprintf(s, "%s%s", state->file, buf);
 		if (cp(state->file, s, S_IREAD|S_IWRITE) < 0) {
 			perror("Could not copy file");
 			unlink(s);
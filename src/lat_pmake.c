@@ -73,8 +73,11 @@ main(int ac, char **av)
 			warmup, repetitions, &state);
 		time = gettime();
 		time /= get_n();
-		if (time > 0.0)
+		if (time > 0.0) {
 			fprintf(stderr, "%llu %.2f\n", usecs, time);
+			sprintf(buf, "%llu", usecs);
+			json_result(buf, time, "microseconds");
+		}
 	}
 	return (0);
 }
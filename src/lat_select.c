@@ -1,7 +1,15 @@
 /*
  * lat_select.c - time select system call
  *
- * usage: lat_select [-P <parallelism>] [-W <warmup>] [-N <repetitions>] [n]
+ * usage: lat_select [-m select|poll|epoll|epollet|io_uring] [-n <#fds>[,<#fds>...]] [-r <ready fraction>] [-P <parallelism>] [-W <warmup>] [-N <repetitions>] file|tcp
+ *
+ * Besides select(), the same descriptors can be watched with poll(),
+ * epoll (level or edge triggered) and io_uring poll requests, and a
+ * list of descriptor counts may be given to get the cost as a function
+ * of the number of descriptors.  With -r, only that fraction of the tcp
+ * descriptors are made readable, by the server process writing to them,
+ * so the cost of mechanisms which scale with the number of ready
+ * descriptors can be told apart from those that scale with the total.
  *
  * Copyright (c) 1996 Larry McVoy.  Distributed under the FSF GPL with
  * additional restriction that results may published only if
@@ -12,16 +20,29 @@ char	*id = "$Id$\n";
 
 #include "bench.h"
 
+#include <poll.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
 void initialize(iter_t iterations, void *cookie);
 void cleanup(iter_t iterations, void *cookie);
 void doit(iter_t iterations, void *cookie);
+void doit_poll(iter_t iterations, void *cookie);
+void doit_epoll(iter_t iterations, void *cookie);
+void doit_uring(iter_t iterations, void *cookie);
 void writer(int w, int r);
 void server(void* cookie);
+void server_loop(int sock, int pid);
 
 typedef int (*open_f)(void* cookie);
 int  open_file(void* cookie);
 int  open_socket(void* cookie);
 
+enum { M_SELECT, M_POLL, M_EPOLL, M_EPOLLET, M_URING };
+char	*modes[] = { "select", "poll", "epoll", "epollet", "io_uring", NULL };
+char	*names[] = { "Select", "Poll", "Epoll", "Epoll (edge)", "io_uring poll" };
+
 typedef struct _state {
 	char	fname[L_tmpnam];
 	open_f	fid_f;
@@ -30,7 +51,21 @@ typedef struct _state {
 	int	fid;
 	int	num;
 	int	max;
+	int	mode;
+	double	ready;		/* fraction of fds made readable, or < 0 */
+	int	nready;
+	short	events;		/* POLLIN with -r, else POLLOUT */
+	int	*fds;
+	int	nfds;
 	fd_set  set;
+	struct pollfd *pfds;
+	int	epfd;
+#ifdef __linux__
+	struct epoll_event *ev;
+#endif
+#ifdef HAVE_IO_URING
+	uring_t	ring;
+#endif
 } state_t;
 
 int
@@ -40,14 +75,30 @@ main(int ac, char **av)
 	int parallel = 1;
 	int warmup = 0;
 	int repetitions = TRIES;
-	int c;
-	char* usage = "[-n <#descriptors>] [-P <parallelism>] [-W <warmup>] [-N <repetitions>] file|tcp\n";
+	int c, i;
+	char* usage = "[-m select|poll|epoll|epollet|io_uring] [-n <#descriptors>[,<#descriptors>...]] [-r <ready fraction>] [-P <parallelism>] [-W <warmup>] [-N <repetitions>] file|tcp\n";
 	char	buf[256];
+	char	*counts = "200";
+	char	*n;
+	benchmp_f bench = doit;
 
 	morefds();  /* bump fd_cur to fd_max */
-	state.num = 200;
-	while (( c = getopt(ac, av, "P:W:N:n:")) != EOF) {
+	bzero(&state, sizeof(state));
+	state.mode = M_SELECT;
+	state.ready = -1.;
+	while (( c = getopt(ac, av, "m:r:P:W:N:n:")) != EOF) {
 		switch(c) {
+		case 'm':
+			for (i = 0; modes[i] && !streq(modes[i], optarg); ++i)
+				;
+			if (!modes[i]) lmbench_usage(ac, av, usage);
+			state.mode = i;
+			break;
+		case 'r':
+			state.ready = atof(optarg);
+			if (state.ready < 0. || state.ready > 1.)
+				lmbench_usage(ac, av, usage);
+			break;
 		case 'P':
 			parallel = atoi(optarg);
 			if (parallel <= 0) lmbench_usage(ac, av, usage);
@@ -59,7 +110,7 @@ main(int ac, char **av)
 			repetitions = atoi(optarg);
 			break;
 		case 'n':
-			state.num = bytes(optarg);
+			counts = optarg;
 			break;
 		default:
 			lmbench_usage(ac, av, usage);
@@ -73,23 +124,73 @@ main(int ac, char **av)
 
 	if (streq("tcp", av[optind])) {
 		state.fid_f = open_socket;
-		server(&state);
-		benchmp(initialize, doit, cleanup, 0, parallel, 
-			warmup, repetitions, &state);
-		sprintf(buf, "Select on %d tcp fd's", state.num);
-		kill(state.pid, SIGKILL);
-		waitpid(state.pid, NULL, 0);
-		micro(buf, get_n());
 	} else if (streq("file", av[optind])) {
+		if (state.ready >= 0.) {
+			fprintf(stderr, "lat_select: files are always ready, -r needs tcp\n");
+			exit(1);
+		}
+		if (state.mode == M_EPOLL || state.mode == M_EPOLLET) {
+			fprintf(stderr, "lat_select: epoll cannot watch regular files\n");
+			exit(1);
+		}
 		state.fid_f = open_file;
-		server(&state);
-		benchmp(initialize, doit, cleanup, 0, parallel, 
+	} else {
+		lmbench_usage(ac, av, usage);
+	}
+	state.events = state.ready >= 0. ? POLLIN : POLLOUT;
+
+	switch (state.mode) {
+	case M_POLL:
+		bench = doit_poll;
+		break;
+	case M_EPOLL:
+	case M_EPOLLET:
+#ifndef __linux__
+		fprintf(stderr, "lat_select: no epoll on this system\n");
+		exit(1);
+#endif
+		bench = doit_epoll;
+		break;
+	case M_URING:
+#ifndef HAVE_IO_URING
+		fprintf(stderr, "lat_select: no io_uring on this system\n");
+		exit(1);
+#endif
+		bench = doit_uring;
+		break;
+	}
+
+	server(&state);
+	counts = strdup(counts);
+	for (n = strtok(counts, ","); n; n = strtok(NULL, ",")) {
+		state.num = bytes(n);
+		if (state.num <= 0) continue;
+		if (state.ready >= 0.) {
+			state.nready = (int)(state.ready * state.num + 0.5);
+			if (state.nready == 0 && state.ready > 0.)
+				state.nready = 1;
+		}
+		benchmp(initialize, bench, cleanup, 0, parallel,
 			warmup, repetitions, &state);
-		unlink(state.fname);
-		sprintf(buf, "Select on %d fd's", state.num);
+		if (state.mode == M_SELECT && state.ready < 0.) {
+			if (state.fid_f == open_socket)
+				sprintf(buf, "Select on %d tcp fd's", state.num);
+			else
+				sprintf(buf, "Select on %d fd's", state.num);
+		} else {
+			sprintf(buf, "%s on %d %sfd's", names[state.mode],
+				state.num, state.fid_f == open_socket ? "tcp " : "");
+			if (state.ready >= 0.)
+				sprintf(buf + strlen(buf), " (%d ready)",
+					state.nready);
+		}
 		micro(buf, get_n());
+	}
+	if (state.fid_f == open_socket) {
+		kill(state.pid, SIGKILL);
+		waitpid(state.pid, NULL, 0);
 	} else {
-		lmbench_usage(ac, av, usage);
+		unlink(state.fname);
 	}
 
 	exit(0);
@@ -129,11 +230,7 @@ server(void* cookie)
 	switch(state->pid = fork()) {
 	case 0:
 		/* child server process */
-		while (pid == getppid()) {
-			int newsock = tcp_accept(state->sock, SOCKOPT_NONE);
-			read(newsock, &state->fid, 1);
-			close(newsock);
-		}
+		server_loop(state->sock, pid);
 		exit(0);
 	case -1:
 		/* error */
@@ -144,6 +241,46 @@ server(void* cookie)
 	}
 }
 
+/*
+ * The server holds every connection open until the client closes it.
+ * A client that sends 'r' gets one byte back, which leaves its end
+ * readable for as long as the benchmark runs.
+ */
+void
+server_loop(int sock, int pid)
+{
+	int	i, n = 1, max = 64;
+	char	c;
+	struct pollfd *p = (struct pollfd*)malloc(max * sizeof(*p));
+
+	if (!p) exit(1);
+	p[0].fd = sock;
+	p[0].events = POLLIN;
+	while (pid == getppid()) {
+		if (poll(p, n, 1000) <= 0) continue;
+		for (i = n - 1; i > 0; --i) {
+			if (!p[i].revents) continue;
+			if (read(p[i].fd, &c, 1) == 1) {
+				if (c == 'r') write(p[i].fd, &c, 1);
+				continue;
+			}
+			close(p[i].fd);
+			p[i] = p[--n];
+		}
+		if (p[0].revents & POLLIN) {
+			if (n == max) {
+				max *= 2;
+				p = (struct pollfd*)realloc(p, max * sizeof(*p));
+				if (!p) exit(1);
+			}
+			p[n].fd = tcp_accept(sock, SOCKOPT_NONE);
+			p[n].events = POLLIN;
+			p[n].revents = 0;
+			if (p[n].fd >= 0) n++;
+		}
+	}
+}
+
 int
 open_socket(void* cookie)
 {
@@ -164,44 +301,216 @@ doit(iter_t iterations, void * cookie)
 	state_t * 	state = (state_t *)cookie;
 	fd_set		nosave;
 	static struct timeval tv;
-	
+
 	tv.tv_sec = 0;
 	tv.tv_usec = 0;
 
+	if (state->events == POLLIN) {
+		while (iterations-- > 0) {
+			nosave = state->set;
+			select(state->max, &nosave, 0, 0, &tv);
+		}
+		return;
+	}
 	while (iterations-- > 0) {
 		nosave = state->set;
 		select(state->num, 0, &nosave, 0, &tv);
 	}
 }
 
+/*
+ * The event loop has to scan every pollfd to find the ready ones
+ */
+void
+doit_poll(iter_t iterations, void * cookie)
+{
+	state_t * 	state = (state_t *)cookie;
+	int		i, n, nready = 0;
+
+	while (iterations-- > 0) {
+		n = poll(state->pfds, state->nfds, 0);
+		for (i = 0; n > 0 && i < state->nfds; ++i) {
+			if (state->pfds[i].revents) {
+				nready++;
+				n--;
+			}
+		}
+	}
+	use_int(nready);
+}
+
+/*
+ * epoll hands back just the ready descriptors.  Edge triggered
+ * descriptors report once per event and ours never change state, so
+ * with -m epollet each pass is an edge triggered epoll_wait() plus an
+ * EPOLL_CTL_MOD per ready descriptor to re-arm it, as an event loop
+ * which has not drained them would do.
+ */
+void
+doit_epoll(iter_t iterations, void * cookie)
+{
+#ifdef __linux__
+	state_t * 	state = (state_t *)cookie;
+	struct epoll_event ev;
+	int		i, n;
+
+	ev.events = (state->events == POLLIN ? EPOLLIN : EPOLLOUT) | EPOLLET;
+	while (iterations-- > 0) {
+		n = epoll_wait(state->epfd, state->ev, state->nfds, 0);
+		if (state->mode != M_EPOLLET) continue;
+		for (i = 0; i < n; ++i) {
+			/* not state->ev[i], whose events lack EPOLLET */
+			ev.data.fd = state->ev[i].data.fd;
+			epoll_ctl(state->epfd, EPOLL_CTL_MOD, ev.data.fd, &ev);
+		}
+	}
+#endif
+}
+
+/*
+ * Every descriptor has a one-shot poll request outstanding; each
+ * pass reaps the completions of the ready ones and re-arms them,
+ * which completes again straight away while they stay ready.
+ */
+void
+doit_uring(iter_t iterations, void * cookie)
+{
+#ifdef HAVE_IO_URING
+	state_t * 	state = (state_t *)cookie;
+	struct io_uring_cqe *cqe;
+	struct io_uring_sqe *sqe;
+	int		fd;
+
+	while (iterations-- > 0) {
+		while ((cqe = uring_cqe(&state->ring)) != NULL) {
+			fd = (int)cqe->user_data;
+			uring_cqe_seen(&state->ring);
+			while ((sqe = uring_sqe(&state->ring)) == NULL)
+				uring_submit(&state->ring, 0);
+			sqe->opcode = IORING_OP_POLL_ADD;
+			sqe->fd = fd;
+			sqe->poll_events = state->events;
+			sqe->user_data = fd;
+		}
+		uring_submit(&state->ring, 0);
+	}
+#endif
+}
+
+/*
+ * Open the descriptors to watch.  With -r the first nready are
+ * connections which the server has written to; the rest are dup()s
+ * of one connection that stays idle.
+ */
 void
 initialize(iter_t iterations, void *cookie)
 {
-	char	c;
+	char	c = 'r';
 	state_t * state = (state_t *)cookie;
-	int	n, last = 0 /* lint */;
+	int	n;
 	int	N = state->num, fid, fd;
+	struct pollfd p;
 
 	if (iterations) return;
 
+	state->fds = (int*)malloc(N * sizeof(int));
+	state->pfds = (struct pollfd*)malloc(N * sizeof(struct pollfd));
+	if (!state->fds || !state->pfds) {
+		perror("lat_select: malloc");
+		exit(1);
+	}
+	state->nfds = 0;
+	state->max = 0;
+	state->epfd = -1;
+	FD_ZERO(&(state->set));
+
+	for (n = 0; n < state->nready; ++n) {
+		fd = (*state->fid_f)(cookie);
+		if (fd <= 0 || write(fd, &c, 1) != 1) {
+			perror("lat_select: Could not open ready connection");
+			exit(1);
+		}
+		p.fd = fd;
+		p.events = POLLIN;
+		poll(&p, 1, 10000);
+		state->fds[state->nfds++] = fd;
+	}
+
 	fid = (*state->fid_f)(cookie);
 	if (fid <= 0) {
 		perror("Could not open device");
 		exit(1);
 	}
-	state->max = 0;
-	FD_ZERO(&(state->set));
-	for (n = 0; n < N; n++) {
+	for (n = state->nfds; n < N; n++) {
 		fd = dup(fid);
 		if (fd == -1) break;
+		state->fds[state->nfds++] = fd;
+	}
+	close(fid);
+	if (state->nfds != N) {
+		fprintf(stderr, "lat_select: only %d of %d descriptors available\n", state->nfds, N);
+		exit(1);
+	}
+
+	for (n = 0; n < N; ++n) {
+		fd = state->fds[n];
 		if (fd > state->max)
 			state->max = fd;
-		FD_SET(fd, &(state->set));
+		if (state->mode == M_SELECT) {
+			if (fd >= FD_SETSIZE) {
+				fprintf(stderr, "lat_select: select is limited to %d descriptors\n", FD_SETSIZE);
+				exit(1);
+			}
+			FD_SET(fd, &(state->set));
+		}
+		state->pfds[n].fd = fd;
+		state->pfds[n].events = state->events;
+		state->pfds[n].revents = 0;
 	}
 	state->max++;
-	close(fid);
-	if (n != N)
-		exit(1);
+
+#ifdef __linux__
+	if (state->mode == M_EPOLL || state->mode == M_EPOLLET) {
+		struct epoll_event ev;
+
+		state->ev = (struct epoll_event*)malloc(N * sizeof(ev));
+		state->epfd = epoll_create(N);
+		if (!state->ev || state->epfd < 0) {
+			perror("lat_select: epoll_create");
+			exit(1);
+		}
+		for (n = 0; n < N; ++n) {
+			ev.events = state->events == POLLIN ? EPOLLIN : EPOLLOUT;
+			if (state->mode == M_EPOLLET) ev.events |= EPOLLET;
+			ev.data.fd = state->fds[n];
+			if (epoll_ctl(state->epfd, EPOLL_CTL_ADD, state->fds[n], &ev) < 0) {
+				perror("lat_select: epoll_ctl");
+				exit(1);
+			}
+		}
+	}
+#endif
+#ifdef HAVE_IO_URING
+	if (state->mode == M_URING) {
+		struct io_uring_sqe *sqe;
+		unsigned cq = 1;
+
+		while (cq < N + 1 && cq < 65536) cq <<= 1;
+		if (uring_init(&state->ring, N < 4096 ? N : 4096, cq) < 0) {
+			perror("lat_select: io_uring_setup");
+			exit(1);
+		}
+		for (n = 0; n < N; ++n) {
+			while ((sqe = uring_sqe(&state->ring)) == NULL)
+				uring_submit(&state->ring, 0);
+			sqe->opcode = IORING_OP_POLL_ADD;
+			sqe->fd = state->fds[n];
+			sqe->poll_events = state->events;
+			sqe->user_data = state->fds[n];
+		}
+		uring_submit(&state->ring, 0);
+	}
+#endif
 }
 
 void
@@ -212,11 +521,25 @@ cleanup(iter_t iterations, void *cookie)
 
 	if (iterations) return;
 
-	for (i = 0; i <= state->max; ++i) {
-		if (FD_ISSET(i, &(state->set)))
-			close(i);
+#ifdef HAVE_IO_URING
+	if (state->mode == M_URING)
+		uring_exit(&state->ring);
+#endif
+#ifdef __linux__
+	if (state->epfd >= 0) {
+		close(state->epfd);
+		free(state->ev);
+		state->ev = NULL;
+	}
+#endif
+	state->epfd = -1;
+	for (i = 0; i < state->nfds; ++i) {
+		close(state->fds[i]);
 	}
+	state->nfds = 0;
 	FD_ZERO(&(state->set));
+	free(state->fds);
+	free(state->pfds);
+	state->fds = NULL;
+	state->pfds = NULL;
 }
-
-	     
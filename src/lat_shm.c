@@ -0,0 +1,169 @@
+/*
+ * lat_shm.c - shared memory ring transaction test
+ *
+ * usage: lat_shm [-w spin|futex|eventfd] [-m <message size>] [-P <parallelism>] [-W <warmup>] [-N <repetitions>]
+ *
+ * Like lat_pipe, but the token goes back and forth through a pair of
+ * rings in shared memory (see lib_shm.c), so the kernel is only
+ * involved when a side has to sleep.  -w chooses how: never (spin),
+ * on a futex, or in read() on an eventfd.
+ *
+ * Copyright (c) 1994 Larry McVoy.  Distributed under the FSF GPL with
+ * additional restriction that results may published only if
+ * (1) the benchmark is unmodified, and
+ * (2) the version in the sccsid below is included in the report.
+ */
+char	*id = "$Id$\n";
+
+#include "bench.h"
+
+void initialize(iter_t iterations, void *cookie);
+void cleanup(iter_t iterations, void *cookie);
+void doit(iter_t iterations, void *cookie);
+void writer(shm_ring_t* req, shm_ring_t* rsp, char* buf);
+
+#define	NSLOTS	16
+
+typedef struct _state {
+	int	pid;
+	int	wait;
+	int	msize;
+	char	*buf;
+	shm_ring_t *req;	/* to the peer */
+	shm_ring_t *rsp;	/* back from the peer */
+} state_t;
+
+int 
+main(int ac, char **av)
+{
+	state_t state;
+	int parallel = 1;
+	int warmup = 0;
+	int repetitions = TRIES;
+	int c;
+	char buf[256];
+	char* usage = "[-w spin|futex|eventfd] [-m <message size>] [-P <parallelism>] [-W <warmup>] [-N <repetitions>]\n";
+
+	bzero(&state, sizeof(state));
+#ifdef __linux__
+	state.wait = SHM_FUTEX;
+#else
+	state.wait = SHM_SPIN;
+#endif
+	state.msize = 1;
+
+	while (( c = getopt(ac, av, "w:m:P:W:N:")) != EOF) {
+		switch(c) {
+		case 'w':
+			state.wait = shm_wait_mode(optarg);
+			if (state.wait < 0) lmbench_usage(ac, av, usage);
+			break;
+		case 'm':
+			state.msize = bytes(optarg);
+			if (state.msize <= 0) lmbench_usage(ac, av, usage);
+			break;
+		case 'P':
+			parallel = atoi(optarg);
+			if (parallel <= 0) lmbench_usage(ac, av, usage);
+			break;
+		case 'W':
+			warmup = atoi(optarg);
+			break;
+		case 'N':
+			repetitions = atoi(optarg);
+			break;
+		default:
+			lmbench_usage(ac, av, usage);
+			break;
+		}
+	}
+	if (optind < ac) {
+		lmbench_usage(ac, av, usage);
+	}
+
+	benchmp(initialize, doit, cleanup, SHORT, parallel, 
+		warmup, repetitions, &state);
+	sprintf(buf, "Shared memory latency using %s",
+		shm_wait_modes[state.wait]);
+	micro(buf, get_n());
+	return (0);
+}
+
+void 
+initialize(iter_t iterations, void* cookie)
+{
+	state_t * state = (state_t *)cookie;
+
+	if (iterations) return;
+
+	state->buf = (char*)malloc(state->msize);
+	state->req = shm_ring_create(NSLOTS, state->msize, state->wait, 0);
+	state->rsp = shm_ring_create(NSLOTS, state->msize, state->wait, 0);
+	if (!state->buf || !state->req || !state->rsp) exit(1);
+	bzero(state->buf, state->msize);
+
+	handle_scheduler(benchmp_childid(), 0, 1);
+	switch (state->pid = fork()) {
+	    case 0:
+		handle_scheduler(benchmp_childid(), 1, 1);
+		signal(SIGTERM, exit);
+		writer(state->req, state->rsp, state->buf);
+		return;
+
+	    case -1:
+		perror("fork");
+		exit(1);
+
+	    default:
+		break;
+	}
+
+	/*
+	 * One time around to make sure both processes are started.
+	 */
+	shm_send(state->req, state->buf, state->msize);
+	shm_recv(state->rsp, state->buf);
+}
+
+void 
+cleanup(iter_t iterations, void* cookie)
+{
+	state_t * state = (state_t *)cookie;
+
+	if (iterations) return;
+
+	if (state->pid) {
+		kill(state->pid, SIGKILL);
+		waitpid(state->pid, NULL, 0);
+		state->pid = 0;
+	}
+	shm_ring_destroy(state->req);
+	shm_ring_destroy(state->rsp);
+	free(state->buf);
+}
+
+void 
+doit(register iter_t iterations, void *cookie)
+{
+	state_t *state = (state_t *) cookie;
+	shm_ring_t *req = state->req;
+	shm_ring_t *rsp = state->rsp;
+	char	*buf = state->buf;
+	int	msize = state->msize;
+
+	while (iterations-- > 0) {
+		shm_send(req, buf, msize);
+		shm_recv(rsp, buf);
+	}
+}
+
+void 
+writer(shm_ring_t* req, shm_ring_t* rsp, char* buf)
+{
+	int	n;
+
+	for ( ;; ) {
+		n = shm_recv(req, buf);
+		shm_send(rsp, buf, n);
+	}
+}
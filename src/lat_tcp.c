@@ -2,10 +2,17 @@
  * lat_tcp.c - simple TCP transaction latency test
  *
  * Three programs in one -
- *	server usage:	tcp_xact -s
- *	client usage:	tcp_xact [-m <message size>] [-P <parallelism>] [-W <warmup>] [-N <repetitions>] hostname
+ *	server usage:	tcp_xact [-e] -s
+ *	client usage:	tcp_xact [-m <message size>] [-H] [-R <rate>] [-P <parallelism>] [-W <warmup>] [-N <repetitions>] hostname
  *	shutdown:	tcp_xact -S hostname
  *
+ * The server forks a process per connection, or with -e serves all of
+ * them from one process.  -H times every transaction and prints the
+ * distribution as well as the mean.  -R sends requests at a fixed rate
+ * per client instead of one after another, and times each from when it
+ * was due to be sent, so queueing delay is not hidden by the client
+ * waiting for the server (coordinated omission).
+ *
  * Copyright (c) 1994 Larry McVoy.  Distributed under the FSF GPL with
  * additional restriction that results may published only if
  * (1) the benchmark is unmodified, and
@@ -15,18 +22,30 @@
 char	*id = "$Id$\n";
 
 #include "bench.h"
+#include <poll.h>
+
+#define	RING	65536		/* most requests in flight with -R */
+#define	RBUF	(64 * 1024)
 
 typedef struct _state {
 	int	msize;
 	int	sock;
 	char	*server;
 	char	*buf;
+	int	rate;		/* requests per second per client, or 0 */
+	histogram_t *hists;	/* one per child */
+	histogram_t *hist;
+	uint64	*due;		/* when each request in flight was due */
 } state_t;
 
 void	init(iter_t iterations, void* cookie);
 void	cleanup(iter_t iterations, void* cookie);
 void	doclient(iter_t iterations, void* cookie);
-void	server_main();
+void	doclient_hist(iter_t iterations, void* cookie);
+void	doclient_rate(iter_t iterations, void* cookie);
+int	waitfor(struct pollfd *p, long long ns);
+void	server_main(int single);
+void	server_single(int sock);
 void	doserver(int sock);
 
 int
@@ -36,19 +55,22 @@ main(int ac, char **av)
 	int	parallel = 1;
 	int	warmup = 0;
 	int	repetitions = TRIES;
+	int	server = 0, single = 0, hist = 0;
 	int 	c;
 	char	buf[256];
-	char	*usage = "-s\n OR [-m <message size>] [-P <parallelism>] [-W <warmup>] [-N <repetitions>] server\n OR -S server\n";
+	char	*usage = "[-e] -s\n OR [-m <message size>] [-H] [-R <rate>] [-P <parallelism>] [-W <warmup>] [-N <repetitions>] server\n OR -S server\n";
 
+	bzero(&state, sizeof(state));
 	state.msize = 1;
 
-	while (( c = getopt(ac, av, "sS:m:P:W:N:")) != EOF) {
+	while (( c = getopt(ac, av, "esS:m:HR:P:W:N:")) != EOF) {
 		switch(c) {
+		case 'e': /* single process server */
+			single = 1;
+			break;
 		case 's': /* Server */
-			if (fork() == 0) {
-				server_main();
-			}
-			exit(0);
+			server = 1;
+			break;
 		case 'S': /* shutdown serverhost */
 			state.sock = tcp_connect(optarg,
 						 TCP_XACT,
@@ -58,6 +80,14 @@ main(int ac, char **av)
 		case 'm':
 			state.msize = atoi(optarg);
 			break;
+		case 'H':
+			hist = 1;
+			break;
+		case 'R':
+			state.rate = atoi(optarg);
+			if (state.rate <= 0)
+				lmbench_usage(ac, av, usage);
+			break;
 		case 'P':
 			parallel = atoi(optarg);
 			if (parallel <= 0)
@@ -75,16 +105,39 @@ main(int ac, char **av)
 		}
 	}
 
-	if (optind != ac - 1) {
+	if (server) {
+		if (fork() == 0) {
+			server_main(single);
+		}
+		exit(0);
+	}
+
+	if (optind != ac - 1 || state.msize <= 0) {
 		lmbench_usage(ac, av, usage);
 	}
 
 	state.server = av[optind];
-	benchmp(init, doclient, cleanup, MEDIUM, parallel, 
+	if (hist || state.rate)
+		state.hists = hist_alloc(parallel);
+	benchmp(init, state.rate ? doclient_rate
+		: (hist ? doclient_hist : doclient), cleanup, MEDIUM, parallel,
 		warmup, repetitions, &state);
 
-	sprintf(buf, "TCP latency using %s", state.server);
-	micro(buf, get_n());
+	if (state.rate) {
+		sprintf(buf, "TCP latency using %s at %d/sec",
+			state.server, state.rate);
+	} else {
+		sprintf(buf, "TCP latency using %s", state.server);
+		micro(buf, get_n());
+	}
+	if (state.hists) {
+		histogram_t total;
+
+		bzero(&total, sizeof(total));
+		for (c = 0; c < parallel; ++c)
+			hist_merge(&total, &state.hists[c]);
+		hist_report(buf, &total);
+	}
 
 	exit(0);
 }
@@ -98,7 +151,12 @@ init(iter_t iterations, void* cookie)
 	if (iterations) return;
 
 	state->sock = tcp_connect(state->server, TCP_XACT, SOCKOPT_NONE);
-	state->buf = malloc(state->msize);
+	state->buf = malloc(state->rate && state->msize < RBUF ?
+			    RBUF : state->msize);
+	if (state->hists)
+		state->hist = &state->hists[benchmp_childid()];
+	if (state->rate)
+		state->due = (uint64*)malloc(RING * sizeof(uint64));
 
 	write(state->sock, &msize, sizeof(int));
 }
@@ -112,6 +170,8 @@ cleanup(iter_t iterations, void* cookie)
 
 	close(state->sock);
 	free(state->buf);
+	if (state->due) free(state->due);
+	state->due = NULL;
 }
 
 void
@@ -126,14 +186,115 @@ doclient(iter_t iterations, void* cookie)
 	}
 }
 
+/*
+ * The same ping-pong, but timing each transaction
+ */
+void
+doclient_hist(iter_t iterations, void* cookie)
+{
+	state_t *state = (state_t *) cookie;
+	int 	sock   = state->sock;
+	int	n, got;
+	int	timed = benchmp_timing();
+	uint64	t;
+
+	while (iterations-- > 0) {
+		t = now_ns();
+		write(sock, state->buf, state->msize);
+		for (got = 0; got < state->msize; got += n) {
+			n = read(sock, state->buf + got, state->msize - got);
+			if (n <= 0) exit(1);
+		}
+		if (timed) hist_add(state->hist, now_ns() - t);
+	}
+}
+
+/*
+ * poll() one descriptor for up to ns nanoseconds, or forever if ns < 0
+ */
+int
+waitfor(struct pollfd *p, long long ns)
+{
+#ifdef __linux__
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000;
+	ts.tv_nsec = ns % 1000000000;
+	return (ppoll(p, 1, ns < 0 ? NULL : &ts, NULL));
+#else
+	return (poll(p, 1, ns < 0 ? -1 : (int)((ns + 999999) / 1000000)));
+#endif
+}
+
+/*
+ * Open loop: request i is due at start + i / rate, whether or not the
+ * earlier ones have been answered.  Responses come back in order, so
+ * each is timed from when its request was due.
+ */
+void
+doclient_rate(iter_t iterations, void* cookie)
+{
+	state_t *state = (state_t *) cookie;
+	int 	sock   = state->sock;
+	uint64	start, next, t, period;
+	long long wait;
+	iter_t	sent = 0, done = 0;
+	int	n, wleft = 0, got = 0;
+	int	timed = benchmp_timing();
+	struct pollfd p;
+
+	period = 1000000000 / state->rate;
+	start = now_ns();
+	while (done < iterations) {
+		t = now_ns();
+		next = start + sent * period;
+		if (wleft == 0 && sent < iterations
+		    && sent - done < RING && t >= next) {
+			state->due[sent % RING] = next;
+			wleft = state->msize;
+			sent++;
+		}
+		while (wleft > 0) {
+			n = send(sock, state->buf,
+				 wleft < RBUF ? wleft : RBUF, MSG_DONTWAIT);
+			if (n <= 0) break;
+			wleft -= n;
+		}
+
+		/* sleep until the next request is due or a reply comes */
+		wait = -1;
+		if (wleft == 0 && sent < iterations && sent - done < RING) {
+			next = start + sent * period;
+			t = now_ns();
+			wait = next > t ? next - t : 0;
+		}
+		p.fd = sock;
+		p.events = POLLIN | (wleft ? POLLOUT : 0);
+		if (waitfor(&p, wait) <= 0 || !(p.revents & POLLIN))
+			continue;
+
+		n = recv(sock, state->buf, RBUF, MSG_DONTWAIT);
+		if (n == 0 || (n < 0 && errno != EAGAIN)) exit(1);
+		if (n < 0) continue;
+		t = now_ns();
+		for (got += n; got >= state->msize && done < sent;
+		     got -= state->msize, done++) {
+			if (timed)
+				hist_add(state->hist, 
+					 t - state->due[done % RING]);
+		}
+	}
+}
+
 void
-server_main()
+server_main(int single)
 {
 	int     newsock, sock;
 
 	GO_AWAY;
 	signal(SIGCHLD, sigchld_wait_handler);
 	sock = tcp_server(TCP_XACT, SOCKOPT_REUSE);
+	if (single) server_single(sock);
 	for (;;) {
 		newsock = tcp_accept(sock, SOCKOPT_NONE);
 		switch (fork()) {
@@ -151,6 +312,64 @@ server_main()
 	/* NOTREACHED */
 }
 
+/*
+ * Echo every connection from one process.  Each connection starts
+ * with the message size, which isn't needed since we echo whatever
+ * arrives, but a connection which closes without sending it means
+ * shut down.
+ */
+void
+server_single(int sock)
+{
+	int	i, n, w, nfds = 1, max = 16;
+	int	*hdr;
+	char	*buf = (char*)malloc(RBUF);
+	struct pollfd *p;
+
+	signal(SIGPIPE, SIG_IGN);
+	p = (struct pollfd*)malloc(max * sizeof(struct pollfd));
+	hdr = (int*)malloc(max * sizeof(int));
+	p[0].fd = sock;
+	p[0].events = POLLIN;
+
+	for (;;) {
+		if (poll(p, nfds, -1) <= 0) continue;
+		for (i = nfds - 1; i > 0; --i) {
+			if (!p[i].revents) continue;
+			n = read(p[i].fd, buf, RBUF);
+			if (n <= 0) {
+				if (hdr[i] == 0) {
+					tcp_done(TCP_XACT);
+					exit(0);
+				}
+				close(p[i].fd);
+				p[i] = p[--nfds];
+				hdr[i] = hdr[nfds];
+				continue;
+			}
+			w = 0;
+			if (hdr[i] < sizeof(int)) {
+				w = sizeof(int) - hdr[i];
+				if (w > n) w = n;
+				hdr[i] += w;
+			}
+			if (w < n) write(p[i].fd, buf + w, n - w);
+		}
+		if (p[0].revents & POLLIN) {
+			if (nfds == max) {
+				max *= 2;
+				p = (struct pollfd*)realloc(p,
+					max * sizeof(struct pollfd));
+				hdr = (int*)realloc(hdr, max * sizeof(int));
+			}
+			p[nfds].fd = tcp_accept(sock, SOCKOPT_NONE);
+			p[nfds].events = POLLIN;
+			p[nfds].revents = 0;
+			hdr[nfds++] = 0;
+		}
+	}
+}
+
 void
 doserver(int sock)
 {
@@ -160,8 +379,9 @@ doserver(int sock)
 		int	msize = ntohl(n);
 		char*   buf = (char*)malloc(msize);
 
-		for (n = 0; read(sock, buf, msize) > 0; n++) {
-			write(sock, buf, msize);
+		/* echo what arrived, which may be less than a message */
+		while ((n = read(sock, buf, msize)) > 0) {
+			write(sock, buf, n);
 		}
 		free(buf);
 	} else {
@@ -3,9 +3,15 @@
  *
  * Three programs in one -
  *	server usage:	lat_udp -s
- *	client usage:	lat_udp [-P <parallelism>] [-W <warmup>] [-N <repetitions>] hostname
+ *	client usage:	lat_udp [-m <message size>] [-H] [-R <rate>] [-P <parallelism>] [-W <warmup>] [-N <repetitions>] hostname
  *	shutdown:	lat_udp -S hostname
  *
+ * -H times every transaction and prints the distribution as well as
+ * the mean.  -R sends requests at a fixed rate per client, matching the
+ * replies up by sequence number, and times each request from when it
+ * was due to be sent; replies which don't arrive within a second of
+ * the last request are counted as lost.
+ *
  * Copyright (c) 1994 Larry McVoy.  Distributed under the FSF GPL with
  * additional restriction that results may published only if
  * (1) the benchmark is unmodified, and
@@ -15,7 +21,10 @@
 char	*id = "$Id$\n";
 #include "bench.h"
 
+#include <poll.h>
+
 #define MAX_MSIZE (10 * 1024 * 1024)
+#define	RING	65536		/* most requests in flight with -R */
 
 void	client_main(int ac, char **av);
 void	server_main();
@@ -23,6 +32,13 @@ void	timeout();
 void	init(iter_t iterations, void* cookie);
 void	cleanup(iter_t iterations, void* cookie);
 void    doit(iter_t iterations, void* cookie);
+void    doit_hist(iter_t iterations, void* cookie);
+void    doit_rate(iter_t iterations, void* cookie);
+
+typedef struct _pending {
+	uint64	due;		/* when the request was due */
+	int	seq;
+} pending_t;
 
 typedef struct _state {
 	int	sock;
@@ -30,6 +46,10 @@ typedef struct _state {
 	int	msize;
 	char	*server;
 	char	*buf;
+	int	rate;		/* requests per second per client, or 0 */
+	histogram_t *hists;	/* one per child */
+	histogram_t *hist;
+	pending_t *pending;
 } state_t;
 
 
@@ -44,15 +64,17 @@ main(int ac, char **av)
 	int	server = 0;
 	int	shutdown = 0;
 	int	msize = 4;
+	int	hist = 0;
  	char	buf[256];
-	char	*usage = "-s\n OR [-S] [-m <message size>] [-P <parallelism>] [-W <warmup>] [-N <repetitions>] server\n NOTE: message size must be >= 4\n";
+	char	*usage = "-s\n OR [-S] [-m <message size>] [-H] [-R <rate>] [-P <parallelism>] [-W <warmup>] [-N <repetitions>] server\n NOTE: message size must be >= 4\n";
 
 	if (sizeof(int) != 4) {
 		fprintf(stderr, "lat_udp: Wrong sequence size\n");
 		return(1);
 	}
 
-	while (( c = getopt(ac, av, "sS:m:P:W:N:")) != EOF) {
+	bzero(&state, sizeof(state));
+	while (( c = getopt(ac, av, "sS:m:HR:P:W:N:")) != EOF) {
 		switch(c) {
 		case 's': /* Server */
 			if (fork() == 0) {
@@ -83,6 +105,14 @@ main(int ac, char **av)
 				msize = MAX_MSIZE;
 			}
 			break;
+		case 'H':
+			hist = 1;
+			break;
+		case 'R':
+			state.rate = atoi(optarg);
+			if (state.rate <= 0)
+				lmbench_usage(ac, av, usage);
+			break;
 		case 'P':
 			parallel = atoi(optarg);
 			if (parallel <= 0)
@@ -106,10 +136,25 @@ main(int ac, char **av)
 
 	state.server = av[optind];
 	state.msize = msize;
-	benchmp(init, doit, cleanup, SHORT, parallel, 
-		warmup, repetitions, &state);
-	sprintf(buf, "UDP latency using %s", state.server);
-	micro(buf, get_n());
+	if (hist || state.rate)
+		state.hists = hist_alloc(parallel);
+	benchmp(init, state.rate ? doit_rate : (hist ? doit_hist : doit),
+		cleanup, SHORT, parallel, warmup, repetitions, &state);
+	if (state.rate) {
+		sprintf(buf, "UDP latency using %s at %d/sec",
+			state.server, state.rate);
+	} else {
+		sprintf(buf, "UDP latency using %s", state.server);
+		micro(buf, get_n());
+	}
+	if (state.hists) {
+		histogram_t total;
+
+		bzero(&total, sizeof(total));
+		for (c = 0; c < parallel; ++c)
+			hist_merge(&total, &state.hists[c]);
+		hist_report(buf, &total);
+	}
 	exit(0);
 }
 
@@ -123,6 +168,10 @@ init(iter_t iterations, void* cookie)
 	state->sock = udp_connect(state->server, UDP_XACT, SOCKOPT_NONE);
 	state->seq = 0;
 	state->buf = (char*)malloc(state->msize);
+	if (state->hists)
+		state->hist = &state->hists[benchmp_childid()];
+	if (state->rate)
+		state->pending = (pending_t*)calloc(RING, sizeof(pending_t));
 	
 	signal(SIGALRM, timeout);
 	alarm(15);
@@ -152,6 +201,105 @@ doit(iter_t iterations, void *cookie)
 	state->seq = seq;
 }
 
+/*
+ * The same ping-pong, but timing each transaction
+ */
+void
+doit_hist(iter_t iterations, void *cookie)
+{
+	state_t *state = (state_t *) cookie;
+	int seq = state->seq;
+	int sock = state->sock;
+	int timed = benchmp_timing();
+	uint64 t;
+
+	alarm(15);
+	while (iterations-- > 0) {
+		t = now_ns();
+		*(int*)state->buf = htonl(seq++);
+		if (send(sock, state->buf, state->msize, 0) != state->msize) {
+			perror("lat_udp client: send failed");
+			exit(5);
+		}
+		if (recv(sock, state->buf, state->msize, 0) != state->msize) {
+			perror("lat_udp client: recv failed");
+			exit(5);
+		}
+		if (timed) hist_add(state->hist, now_ns() - t);
+	}
+	state->seq = seq;
+}
+
+/*
+ * Open loop: request i is due at start + i / rate, whether or not
+ * the earlier ones have been answered.
+ */
+void
+doit_rate(iter_t iterations, void *cookie)
+{
+	state_t *state = (state_t *) cookie;
+	int	sock = state->sock;
+	int	seq, first = state->seq;
+	int	timed = benchmp_timing();
+	uint64	start, next, t, last, period;
+	iter_t	sent = 0, done = 0;
+	pending_t *p;
+	struct pollfd pfd;
+	struct timespec ts;
+
+	alarm(15);
+	period = 1000000000 / state->rate;
+	start = last = now_ns();
+	for ( ;; ) {
+		t = now_ns();
+		next = start + sent * period;
+		if (sent < iterations && t >= next) {
+			seq = state->seq++;
+			p = &state->pending[seq % RING];
+			p->due = next;
+			p->seq = seq;
+			*(int*)state->buf = htonl(seq);
+			(void)send(sock, state->buf, state->msize, MSG_DONTWAIT);
+			sent++;
+			last = t;
+			continue;
+		}
+		if (sent == iterations
+		    && (done == sent || t - last > 1000000000)) break;
+
+		/* sleep until the next request is due or a reply comes */
+		if (sent < iterations) {
+			next -= t;
+		} else {
+			next = last + 1000000000 - t;
+		}
+		ts.tv_sec = next / 1000000000;
+		ts.tv_nsec = next % 1000000000;
+		pfd.fd = sock;
+		pfd.events = POLLIN;
+#ifdef __linux__
+		if (ppoll(&pfd, 1, &ts, NULL) <= 0) continue;
+#else
+		if (poll(&pfd, 1, (int)((next + 999999) / 1000000)) <= 0)
+			continue;
+#endif
+		while (recv(sock, state->buf, state->msize, MSG_DONTWAIT)
+		       >= (int)sizeof(int)) {
+			seq = ntohl(*(int*)state->buf);
+			p = &state->pending[seq % RING];
+			/* late replies to earlier calls are not ours */
+			if (seq < first || p->seq != seq || p->due == 0)
+				continue;
+			t = now_ns();
+			if (timed) hist_add(state->hist, t - p->due);
+			p->due = 0;
+			done++;
+			last = t;
+		}
+	}
+	if (timed && sent > done) state->hist->lost += sent - done;
+}
+
 void
 cleanup(iter_t iterations, void* cookie)
 {
@@ -161,6 +309,8 @@ cleanup(iter_t iterations, void* cookie)
 
 	close(state->sock);
 	free(state->buf);
+	if (state->pending) free(state->pending);
+	state->pending = NULL;
 }
 
 void
@@ -0,0 +1,161 @@
+/*
+ * lib_hist.c - latency histograms
+ *
+ * Log-linear buckets in the style of HdrHistogram: values below
+ * 2*HIST_SUB nanoseconds get a bucket each, and every power of two
+ * above that is split into HIST_SUB buckets, so any value is known
+ * to within 1/HIST_SUB (about 3%) from 1ns up to over a day.
+ *
+ * The histograms are allocated in shared memory so that benchmp
+ * children, whether processes or threads, can each fill in their
+ * own and the parent can merge them afterwards.
+ *
+ * Copyright (c) 2000 Carl Staelin and Larry McVoy.  Distributed under
+ * the FSF GPL with additional restriction that results may published
+ * only if (1) the benchmark is unmodified, and (2) the version in the
+ * sccsid below is included in the report.
+ */
+#include "bench.h"
+
+extern FILE	*ftiming;
+
+static int
+hist_index(uint64 v)
+{
+	int	shift;
+
+	if (v < 2 * HIST_SUB) return ((int)v);
+	for (shift = 0; (v >> shift) >= 2 * HIST_SUB; ++shift)
+		;
+	return ((shift + 1) * HIST_SUB + (int)(v >> shift) - HIST_SUB);
+}
+
+/*
+ * The largest value that lands in bucket i
+ */
+static uint64
+hist_value(int i)
+{
+	int	shift;
+
+	if (i < 2 * HIST_SUB) return ((uint64)i);
+	shift = i / HIST_SUB - 1;
+	return ((((uint64)(i % HIST_SUB + HIST_SUB) + 1) << shift) - 1);
+}
+
+/*
+ * Allocate n empty histograms which are shared with any children
+ */
+histogram_t*
+hist_alloc(int n)
+{
+	histogram_t* h;
+
+	h = (histogram_t*)mmap(0, n * sizeof(histogram_t),
+			       PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS,
+			       -1, 0);
+	if (h == (histogram_t*)MAP_FAILED) {
+		perror("hist_alloc: mmap");
+		exit(1);
+	}
+	bzero(h, n * sizeof(histogram_t));
+	return (h);
+}
+
+void
+hist_free(histogram_t* h, int n)
+{
+	munmap((void*)h, n * sizeof(histogram_t));
+}
+
+void
+hist_add(histogram_t* h, uint64 ns)
+{
+	int	i = hist_index(ns);
+
+	if (i >= HIST_BUCKETS) i = HIST_BUCKETS - 1;
+	h->bucket[i]++;
+	if (h->count == 0 || ns < h->min) h->min = ns;
+	if (ns > h->max) h->max = ns;
+	h->count++;
+	h->sum += ns;
+}
+
+void
+hist_merge(histogram_t* dst, histogram_t* src)
+{
+	int	i;
+
+	dst->lost += src->lost;
+	if (src->count == 0) return;
+	for (i = 0; i < HIST_BUCKETS; ++i)
+		dst->bucket[i] += src->bucket[i];
+	if (dst->count == 0 || src->min < dst->min) dst->min = src->min;
+	if (src->max > dst->max) dst->max = src->max;
+	dst->count += src->count;
+	dst->sum += src->sum;
+}
+
+/*
+ * The value at or below which fraction p of the samples fall
+ */
+uint64
+hist_percentile(histogram_t* h, double p)
+{
+	int	i;
+	uint64	n, want;
+
+	if (h->count == 0) return (0);
+	want = (uint64)(p * h->count + 0.5);
+	if (want < 1) want = 1;
+	for (i = 0, n = 0; i < HIST_BUCKETS; ++i) {
+		n += h->bucket[i];
+		if (n >= want) break;
+	}
+	if (i >= HIST_BUCKETS || hist_value(i) > h->max) return (h->max);
+	if (hist_value(i) < h->min) return (h->min);
+	return (hist_value(i));
+}
+
+/*
+ * Print the distribution in microseconds
+ */
+void
+hist_report(char *s, histogram_t* h)
+{
+	char	buf[256];
+
+	if (!ftiming) ftiming = stderr;
+	if (h->count == 0) {
+		fprintf(ftiming, "%s: no samples\n", s);
+	} else {
+		fprintf(ftiming, "%s: N=%llu min=%.2f mean=%.2f p50=%.2f p90=%.2f "
+			"p99=%.2f p99.9=%.2f max=%.2f microseconds\n",
+			s, (unsigned long long)h->count,
+			h->min / 1000., h->sum / (1000. * h->count),
+			hist_percentile(h, 0.50) / 1000.,
+			hist_percentile(h, 0.90) / 1000.,
+			hist_percentile(h, 0.99) / 1000.,
+			hist_percentile(h, 0.999) / 1000.,
+			h->max / 1000.);
+	}
+	if (h->lost)
+		fprintf(ftiming, "%s: %llu lost\n", s, (unsigned long long)h->lost);
+
+	if (json_output()) {
+		if (h->count) {
+			sprintf(buf, "%.200s p50", s);
+			json_result(buf, hist_percentile(h, 0.50) / 1000., "microseconds");
+			sprintf(buf, "%.200s p90", s);
+			json_result(buf, hist_percentile(h, 0.90) / 1000., "microseconds");
+			sprintf(buf, "%.200s p99", s);
+			json_result(buf, hist_percentile(h, 0.99) / 1000., "microseconds");
+			sprintf(buf, "%.200s p99.9", s);
+			json_result(buf, hist_percentile(h, 0.999) / 1000., "microseconds");
+			sprintf(buf, "%.200s max", s);
+			json_result(buf, h->max / 1000., "microseconds");
+		}
+		sprintf(buf, "%.200s lost", s);
+		json_result(buf, (double)h->lost, "requests");
+	}
+}
@@ -25,7 +25,7 @@
 #define SAVE(N)		sp##N = p##N;
 
 #define MEM_BENCHMARK_F(N) mem_benchmark_##N,
-benchmp_f mem_benchmarks[] = {REPEAT_15(MEM_BENCHMARK_F)};
+benchmp_f mem_benchmarks[] = {REPEAT_63(MEM_BENCHMARK_F)};
 
 static int mem_benchmark_rerun = 0;
 
@@ -63,10 +63,210 @@ MEM_BENCHMARK_DEF(12, REPEAT_12, DEREF)
 MEM_BENCHMARK_DEF(13, REPEAT_13, DEREF)
 MEM_BENCHMARK_DEF(14, REPEAT_14, DEREF)
 MEM_BENCHMARK_DEF(15, REPEAT_15, DEREF)
+MEM_BENCHMARK_DEF(16, REPEAT_16, DEREF)
+MEM_BENCHMARK_DEF(17, REPEAT_17, DEREF)
+MEM_BENCHMARK_DEF(18, REPEAT_18, DEREF)
+MEM_BENCHMARK_DEF(19, REPEAT_19, DEREF)
+MEM_BENCHMARK_DEF(20, REPEAT_20, DEREF)
+MEM_BENCHMARK_DEF(21, REPEAT_21, DEREF)
+MEM_BENCHMARK_DEF(22, REPEAT_22, DEREF)
+MEM_BENCHMARK_DEF(23, REPEAT_23, DEREF)
+MEM_BENCHMARK_DEF(24, REPEAT_24, DEREF)
+MEM_BENCHMARK_DEF(25, REPEAT_25, DEREF)
+MEM_BENCHMARK_DEF(26, REPEAT_26, DEREF)
+MEM_BENCHMARK_DEF(27, REPEAT_27, DEREF)
+MEM_BENCHMARK_DEF(28, REPEAT_28, DEREF)
+MEM_BENCHMARK_DEF(29, REPEAT_29, DEREF)
+MEM_BENCHMARK_DEF(30, REPEAT_30, DEREF)
+MEM_BENCHMARK_DEF(31, REPEAT_31, DEREF)
+MEM_BENCHMARK_DEF(32, REPEAT_32, DEREF)
+MEM_BENCHMARK_DEF(33, REPEAT_33, DEREF)
+MEM_BENCHMARK_DEF(34, REPEAT_34, DEREF)
+MEM_BENCHMARK_DEF(35, REPEAT_35, DEREF)
+MEM_BENCHMARK_DEF(36, REPEAT_36, DEREF)
+MEM_BENCHMARK_DEF(37, REPEAT_37, DEREF)
+MEM_BENCHMARK_DEF(38, REPEAT_38, DEREF)
+MEM_BENCHMARK_DEF(39, REPEAT_39, DEREF)
+MEM_BENCHMARK_DEF(40, REPEAT_40, DEREF)
+MEM_BENCHMARK_DEF(41, REPEAT_41, DEREF)
+MEM_BENCHMARK_DEF(42, REPEAT_42, DEREF)
+MEM_BENCHMARK_DEF(43, REPEAT_43, DEREF)
+MEM_BENCHMARK_DEF(44, REPEAT_44, DEREF)
+MEM_BENCHMARK_DEF(45, REPEAT_45, DEREF)
+MEM_BENCHMARK_DEF(46, REPEAT_46, DEREF)
+MEM_BENCHMARK_DEF(47, REPEAT_47, DEREF)
+MEM_BENCHMARK_DEF(48, REPEAT_48, DEREF)
+MEM_BENCHMARK_DEF(49, REPEAT_49, DEREF)
+MEM_BENCHMARK_DEF(50, REPEAT_50, DEREF)
+MEM_BENCHMARK_DEF(51, REPEAT_51, DEREF)
+MEM_BENCHMARK_DEF(52, REPEAT_52, DEREF)
+MEM_BENCHMARK_DEF(53, REPEAT_53, DEREF)
+MEM_BENCHMARK_DEF(54, REPEAT_54, DEREF)
+MEM_BENCHMARK_DEF(55, REPEAT_55, DEREF)
+MEM_BENCHMARK_DEF(56, REPEAT_56, DEREF)
+MEM_BENCHMARK_DEF(57, REPEAT_57, DEREF)
+MEM_BENCHMARK_DEF(58, REPEAT_58, DEREF)
+MEM_BENCHMARK_DEF(59, REPEAT_59, DEREF)
+MEM_BENCHMARK_DEF(60, REPEAT_60, DEREF)
+MEM_BENCHMARK_DEF(61, REPEAT_61, DEREF)
+MEM_BENCHMARK_DEF(62, REPEAT_62, DEREF)
+MEM_BENCHMARK_DEF(63, REPEAT_63, DEREF)
 
 
 size_t*	words_initialize(size_t max, int scale);
 
+#if defined(MAP_HUGETLB) && !defined(MAP_HUGE_SHIFT)
+#define	MAP_HUGE_SHIFT	26
+#endif
+
+/*
+ * mem_hugepages
+ *
+ * LMBENCH_HUGEPAGES selects huge pages for the pointer chains:
+ * "thp" asks for transparent huge pages with madvise(MADV_HUGEPAGE),
+ * "2m" and "1g" map pre-reserved hugetlbfs pages with MAP_HUGETLB.
+ * Returns the huge page size, or 0 for normal pages.
+ */
+static size_t
+mem_hugepages(int* hugetlb)
+{
+	char	*p = getenv("LMBENCH_HUGEPAGES");
+	size_t	size = 0;
+	FILE	*f;
+
+	*hugetlb = 0;
+	if (p == NULL || *p == '\0') return 0;
+#if defined(MADV_HUGEPAGE)
+	if (!strcasecmp(p, "thp")) {
+		size = 2 * 1024 * 1024;
+		f = fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r");
+		if (f) {
+			unsigned long long n;
+			if (fscanf(f, "%llu", &n) == 1 && n > 0) size = n;
+			fclose(f);
+		}
+		return size;
+	}
+#endif
+#if defined(MAP_HUGETLB)
+	if (!strcasecmp(p, "2m")) size = 2 * 1024 * 1024;
+	if (!strcasecmp(p, "1g")) size = 1024 * 1024 * 1024;
+	if (size) {
+		*hugetlb = 1;
+		return size;
+	}
+#endif
+	return 0;
+}
+
+/*
+ * mem_buffer_alloc
+ *
+ * Allocate size bytes for state, which will be aligned to the page
+ * size by the caller.  With huge pages the memory is mmap'd, rounded
+ * up to whole huge pages, and state->maplen and state->hugepage are
+ * set; otherwise it comes from malloc.
+ */
+static char*
+mem_buffer_alloc(struct mem_state* state, size_t size)
+{
+	int	hugetlb;
+	size_t	huge, len;
+	char	*p;
+	static int warned = 0;
+
+	state->maplen = 0;
+	state->hugepage = 0;
+	if ((huge = mem_hugepages(&hugetlb)) > state->pagesize) {
+		len = (size + huge - 1) / huge * huge;
+#if defined(MAP_HUGETLB)
+		if (hugetlb) {
+			int	shift = (huge == 2 * 1024 * 1024) ? 21 : 30;
+
+			p = (char*)mmap(0, len, PROT_READ|PROT_WRITE,
+				MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB
+				| (shift << MAP_HUGE_SHIFT), -1, 0);
+			if (p != (char*)MAP_FAILED) {
+				state->maplen = len;
+				state->hugepage = huge;
+				return p;
+			}
+			if (!warned++)
+				fprintf(stderr, "LMBENCH_HUGEPAGES: cannot map %lluKB huge pages, using normal pages\n", (unsigned long long)huge / 1024);
+		}
+#endif
+#if defined(MADV_HUGEPAGE)
+		if (!hugetlb) {
+			/* extra huge page so that base can be aligned */
+			len += huge;
+			p = (char*)mmap(0, len, PROT_READ|PROT_WRITE,
+				MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+			if (p != (char*)MAP_FAILED) {
+				char	*q = p;
+
+				if ((unsigned long)q % huge)
+					q += huge - (unsigned long)q % huge;
+				if (madvise(q, len - (q - p), MADV_HUGEPAGE) < 0
+				    && !warned++)
+					perror("LMBENCH_HUGEPAGES: madvise");
+				state->maplen = len;
+				state->hugepage = huge;
+				return p;
+			}
+		}
+#endif
+	}
+	return (char*)malloc(size + 2 * state->pagesize);
+}
+
+static void
+mem_buffer_free(struct mem_state* state, char* p)
+{
+	if (state->maplen) {
+		munmap(p, state->maplen);
+		state->maplen = 0;
+	} else {
+		free(p);
+	}
+}
+
+/*
+ * mem_pages
+ *
+ * Order the pages for the pointer chains.  With normal pages this is
+ * a random permutation.  With huge pages the huge pages are permuted
+ * and the pages within each huge page are permuted, so that the chain
+ * visits every page in a huge page before moving on to the next huge
+ * page.
+ */
+static size_t*
+mem_pages(struct mem_state* state, size_t npages)
+{
+	size_t	i, per, nhuge;
+	size_t	*pages, *huge, *sub;
+
+	if (state->hugepage <= state->pagesize)
+		return permutation(npages, state->pagesize);
+
+	per = state->hugepage / state->pagesize;
+	nhuge = (npages + per - 1) / per;
+	pages = (size_t*)malloc(npages * sizeof(size_t));
+	huge = permutation(nhuge, state->hugepage);
+	sub = permutation(per, state->pagesize);
+	if (pages == NULL || huge == NULL || sub == NULL) {
+		if (pages) free(pages);
+		if (huge) free(huge);
+		if (sub) free(sub);
+		return NULL;
+	}
+	for (i = 0; i < npages; ++i) {
+		pages[i] = huge[i / per] + sub[i % per];
+	}
+	free(huge);
+	free(sub);
+	return pages;
+}
+
 
 void
 mem_reset()
@@ -82,7 +282,7 @@ mem_cleanup(iter_t iterations, void* cookie)
 	if (iterations) return;
 
 	if (state->addr) {
-		free(state->addr);
+		mem_buffer_free(state, state->addr);
 		state->addr = NULL;
 	}
 	if (state->lines) {
@@ -109,6 +309,11 @@ tlb_cleanup(iter_t iterations, void* cookie)
 	if (iterations) return;
 
 	if (addr) {
+		if (state->maplen) {
+			/* one huge page mapping for all the pages */
+			mem_buffer_free(state, addr[0]);
+			addr[0] = NULL;
+		}
 		for (i = 0; i < state->npages; ++i) {
 			if (addr[i]) free(addr[i]);
 		}
@@ -128,7 +333,7 @@ tlb_cleanup(iter_t iterations, void* cookie)
 void
 base_initialize(iter_t iterations, void* cookie)
 {
-	size_t	nwords, nlines, nbytes, npages, nmpages;
+	size_t	nwords, nlines, nbytes, npages, nmpages, align;
 	size_t *pages;
 	size_t *lines;
 	size_t *words;
@@ -149,8 +354,8 @@ base_initialize(iter_t iterations, void* cookie)
 
 	words = NULL;
 	lines = NULL;
-	pages = permutation(nmpages, state->pagesize);
-	p = state->addr = (char*)malloc(state->maxlen + 2 * state->pagesize);
+	p = state->addr = mem_buffer_alloc(state, state->maxlen);
+	pages = mem_pages(state, nmpages);
 
 	if (p == NULL) {
             printf(" memory allocation failure, current memory size used for\
@@ -168,8 +373,9 @@ testing is %llu bytes, please choose smaller memory size for testing\n ", state-
 	if (state->addr == NULL || pages == NULL)
 		return;
 
-	if ((unsigned long)p % state->pagesize) {
-		p += state->pagesize - (unsigned long)p % state->pagesize;
+	align = state->hugepage ? state->hugepage : state->pagesize;
+	if ((unsigned long)p % align) {
+		p += align - (unsigned long)p % align;
 	}
 	state->base = p;
 	state->initialized = 1;
@@ -267,6 +473,189 @@ thrash_initialize(iter_t iterations, void* cookie)
 	mem_reset();
 }
 
+/*
+ * More access patterns for studying hardware prefetchers.  Each
+ * builds a circular chain through the lines of the first state->len
+ * bytes, one pointer every state->line bytes, in its own order.
+ * The page based ones treat the memory as a matrix with one row
+ * per page.
+ */
+static void
+chain_link(struct mem_state* state, size_t* order, size_t n)
+{
+	size_t	i;
+	char*	addr = state->base;
+
+	if (order == NULL) return;
+	if (n > 0) {
+		for (i = 0; i < n - 1; ++i) {
+			*(char **)&addr[order[i]] = (char*)&addr[order[i+1]];
+		}
+		*(char **)&addr[order[n-1]] = (char*)&addr[order[0]];
+		state->p[0] = &addr[order[0]];
+	}
+	free(order);
+	mem_reset();
+}
+
+/*
+ * state->width sequential streams through equal parts of the
+ * memory, taking one line from each in turn
+ */
+void
+streams_initialize(iter_t iterations, void* cookie)
+{
+	struct mem_state* state = (struct mem_state*)cookie;
+	size_t	i, j, k, n, per;
+	size_t	nlines = state->len / state->line;
+	size_t*	order;
+
+	base_initialize(iterations, cookie);
+	if (!state->initialized) return;
+
+	k = state->width;
+	if (k > nlines) k = nlines;
+	per = nlines / k;
+	order = (size_t*)malloc(nlines * sizeof(size_t));
+	if (order == NULL) return;
+	for (i = 0, n = 0; i < per; ++i) {
+		for (j = 0; j < k; ++j) {
+			order[n++] = (j * per + i) * state->line;
+		}
+	}
+	chain_link(state, order, n);
+}
+
+/*
+ * The stride grows by a line after every access, and when it runs
+ * off the end we start again from the first line not yet visited
+ */
+void
+growing_initialize(iter_t iterations, void* cookie)
+{
+	struct mem_state* state = (struct mem_state*)cookie;
+	size_t	start, pos, d, n;
+	size_t	nlines = state->len / state->line;
+	size_t*	order;
+	char*	seen;
+
+	base_initialize(iterations, cookie);
+	if (!state->initialized) return;
+
+	order = (size_t*)malloc(nlines * sizeof(size_t));
+	seen = (char*)calloc(nlines, 1);
+	if (order == NULL || seen == NULL) {
+		if (order) free(order);
+		if (seen) free(seen);
+		return;
+	}
+	for (start = 0, n = 0; start < nlines; ++start) {
+		for (pos = start, d = 1; pos < nlines && !seen[pos]; pos += d++) {
+			seen[pos] = 1;
+			order[n++] = pos * state->line;
+		}
+	}
+	free(seen);
+	chain_link(state, order, n);
+}
+
+/*
+ * The stride pattern run from the top of memory down
+ */
+void
+backward_initialize(iter_t iterations, void* cookie)
+{
+	struct mem_state* state = (struct mem_state*)cookie;
+	size_t	i;
+	size_t	nlines = state->len / state->line;
+	size_t*	order;
+
+	base_initialize(iterations, cookie);
+	if (!state->initialized) return;
+
+	order = (size_t*)malloc(nlines * sizeof(size_t));
+	if (order == NULL) return;
+	for (i = 0; i < nlines; ++i) {
+		order[i] = (nlines - 1 - i) * state->line;
+	}
+	chain_link(state, order, nlines);
+}
+
+/*
+ * The pages in order, and the lines of each page in a random order,
+ * the same one for every page
+ */
+void
+pagerand_initialize(iter_t iterations, void* cookie)
+{
+	struct mem_state* state = (struct mem_state*)cookie;
+	size_t	i, j, n;
+	size_t	npages = state->len / state->pagesize;
+	size_t	nlines = state->pagesize / state->line;
+	size_t*	order;
+	size_t*	lines;
+
+	base_initialize(iterations, cookie);
+	if (!state->initialized) return;
+
+	if (npages == 0) {
+		npages = 1;
+		nlines = state->len / state->line;
+	}
+	order = (size_t*)malloc(npages * nlines * sizeof(size_t));
+	lines = permutation(nlines, state->line);
+	if (order == NULL || lines == NULL) {
+		if (order) free(order);
+		if (lines) free(lines);
+		return;
+	}
+	for (i = 0, n = 0; i < npages; ++i) {
+		for (j = 0; j < nlines; ++j) {
+			order[n++] = i * state->pagesize + lines[j];
+		}
+	}
+	free(lines);
+	chain_link(state, order, n);
+}
+
+/*
+ * 8 line by 8 row tiles, left to right and then down, each read
+ * a row at a time, as a blocked matrix algorithm would
+ */
+#define	TILE	8
+
+void
+tiled_initialize(iter_t iterations, void* cookie)
+{
+	struct mem_state* state = (struct mem_state*)cookie;
+	size_t	r, c, r0, c0, n;
+	size_t	rows = state->len / state->pagesize;
+	size_t	cols = state->pagesize / state->line;
+	size_t*	order;
+
+	base_initialize(iterations, cookie);
+	if (!state->initialized) return;
+
+	if (rows == 0) {
+		rows = 1;
+		cols = state->len / state->line;
+	}
+	order = (size_t*)malloc(rows * cols * sizeof(size_t));
+	if (order == NULL) return;
+	n = 0;
+	for (r0 = 0; r0 < rows; r0 += TILE) {
+		for (c0 = 0; c0 < cols; c0 += TILE) {
+			for (r = r0; r < r0 + TILE && r < rows; ++r) {
+				for (c = c0; c < c0 + TILE && c < cols; ++c) {
+					order[n++] = r * state->pagesize 
+						+ c * state->line;
+				}
+			}
+		}
+	}
+	chain_link(state, order, n);
+}
+
 /*
  * mem_initialize
  *
@@ -424,7 +813,7 @@ line_initialize(iter_t iterations, void* cookie)
 void
 tlb_initialize(iter_t iterations, void* cookie)
 {
-	int i, j, nwords, nlines, npages, pagesize;
+	int i, j, nwords, nlines, npages, pagesize, hugetlb;
 	unsigned int r;
 	char **pages = NULL;
 	char **addr = NULL;
@@ -454,6 +843,8 @@ tlb_initialize(iter_t iterations, void* cookie)
 	state->lines = lines;
 	state->pages = (size_t*)pages;
 	state->addr = (char*)addr;
+	state->maplen = 0;
+	state->hugepage = 0;
 	if (addr) bzero(addr, npages * sizeof(char**));
 	if (pages) bzero(pages, npages * sizeof(char**));
 
@@ -461,8 +852,23 @@ tlb_initialize(iter_t iterations, void* cookie)
 		return;
 	}
 
+	/* with huge pages, carve the pages out of one mapping */
+	if (mem_hugepages(&hugetlb) > pagesize) {
+		p = addr[0] = mem_buffer_alloc(state, npages * pagesize);
+		if (p == NULL) return;
+		if (!state->maplen) {
+			free(p);
+			addr[0] = NULL;
+		} else {
+			if ((unsigned long)p % state->hugepage)
+				p += state->hugepage - (unsigned long)p % state->hugepage;
+			for (i = 0; i < npages; ++i)
+				pages[i] = p + i * pagesize;
+		}
+	}
+
 	/* first, layout the sequence of page accesses */
-	for (i = 0; i < npages; ++i) {
+	for (i = 0; !state->maplen && i < npages; ++i) {
 		p = addr[i] = (char*)valloc(pagesize);
 		if (p == NULL) return;
 		if ((unsigned long)p % pagesize) {
@@ -644,14 +1050,29 @@ line_test(size_t line, int warmup, int repetitions, struct mem_state* state)
 	return (t);
 }
 
-double
-par_mem(size_t len, int warmup, int repetitions, struct mem_state* state)
+/*
+ * Time the pointer chase through len bytes with 1 to maxwidth
+ * independent chains in flight at once.  ns[i] is the time for one
+ * step of every chain when i+1 chains are running, so ns[0] is the
+ * plain load latency and ns[0] * (i + 1) / ns[i] is how many of the
+ * loads the memory system overlaps.  Returns the number of widths
+ * measured, or -1 if the memory could not be allocated.
+ *
+ * Past about MEM_REGISTER_CHAINS chains the pointers no longer fit in
+ * registers.  Each step of a spilled chain then loads its pointer from
+ * the stack and stores the next one back, so a store-forwarding delay
+ * and extra load port traffic sit on the chain.  For data in the L1
+ * and L2 caches that is what gets measured, so only ask for widths
+ * above MEM_REGISTER_CHAINS when that is understood.
+ */
+int
+par_mem_curve(size_t len, int maxwidth, int warmup, int repetitions,
+	      struct mem_state* state, double* ns)
 {
-	int	i, j, k, n, __n;
-	double	baseline, max_par, par;
+	int	i, j, __n;
 
+	if (maxwidth > MAX_MEM_PARALLELISM) maxwidth = MAX_MEM_PARALLELISM;
 	state->width = 1;
-	max_par = 1.;
 	__n = 1;
 
 	for (state->addr = NULL; !state->addr && len; ) {
@@ -659,23 +1080,16 @@ par_mem(size_t len, int warmup, int repetitions, struct mem_state* state)
 		mem_initialize(0, state);
 		if (state->addr == NULL) len >>= 1;
 	}
-	if (state->addr == NULL) return -1.;
+	if (state->addr == NULL) return -1;
 
-	for (i = 0; i < MAX_MEM_PARALLELISM; ++i) {
-		n = len / state->line;
+	for (i = 0; i < maxwidth; ++i) {
 		for (j = 0; j <= i; j++) {
 			size_t nlines = len / state->line;
 			size_t lines_per_chunk = nlines / (i + 1);
 			size_t lines_per_page = state->pagesize / state->line;
-			size_t words_per_chunk = state->nwords / (i + 1);
 			size_t line = j * lines_per_chunk;
 			size_t word = (j * state->nwords) / (i + 1);
 
-			/*
-			if (state->len == 32768 && i == 7) {
-				fprintf(stderr, "\tj=%d, line=%d, word=%d, page=%d, _line=%d, _word=%d\n", j, line, word, line / lines_per_page, line % lines_per_page, word % state->nwords);
-			}
-			/**/
 			state->p[j] = state->base + 
 				state->pages[line / lines_per_page] + 
 				state->lines[line % lines_per_page] + 
@@ -684,22 +1098,68 @@ par_mem(size_t len, int warmup, int repetitions, struct mem_state* state)
 		mem_reset();
 		(*mem_benchmarks[i])((len / sizeof(char*) + 100) / 100, state);
 		BENCH((*mem_benchmarks[i])(__n, state); __n = 1;, 0);
-		if (i == 0) {
-			baseline = (double)gettime() / (double)get_n();
-		} else if (gettime() > 0) {
-			par = baseline;
-			par /= (double)gettime() / (double)((i + 1) * get_n());
-			/*
-			fprintf(stderr, "par_mem(%d): i=%d, p=%5.2f, l=%d, lpp=%d, lpc=%d, nl=%d, wpc=%d\n", len, i, par, state->line, state->pagesize / state->line, (len / state->line) / (i + 1), len / state->line, state->nwords / (i + 1));
-			/**/
-			if (par > max_par) {
-				max_par = par;
-			}
-		}
+		ns[i] = -1.;
+		if (gettime() > 0)
+			ns[i] = (double)gettime() * 10. / (double)get_n();
 	}
 	mem_cleanup(0, state);
 
-	return max_par;
+	return maxwidth;
 }
 
+double
+par_mem(size_t len, int warmup, int repetitions, struct mem_state* state)
+{
+	int	n;
+	double	ns[MAX_MEM_PARALLELISM];
+
+	n = par_mem_curve(len, MEM_REGISTER_CHAINS, 
+			  warmup, repetitions, state, ns);
+	if (n < 0) return -1.;
+	return par_mem_max(n, ns);
+}
 
+/*
+ * The most loads overlapped at any width in a par_mem_curve() result
+ */
+double
+par_mem_max(int n, double* ns)
+{
+	int	i;
+	double	max_par, par;
+
+	for (i = 1, max_par = 1.; i < n; ++i) {
+		if (ns[0] <= 0. || ns[i] <= 0.) continue;
+		par = ns[0] * (i + 1) / ns[i];
+		if (par > max_par) {
+			max_par = par;
+		}
+	}
+	return max_par;
+}
+
+/*
+ * Print a curve from par_mem_curve().  By Little's law the bandwidth
+ * is the number of lines in flight over the time each one takes.
+ * Widths whose pointers are probably spilled to the stack are marked.
+ */
+void
+par_mem_print(char* s, int n, double* ns, size_t line)
+{
+	int	i;
+	char	buf[128];
+
+	for (i = 0; i < n; ++i) {
+		if (ns[i] <= 0.) continue;
+		fprintf(stderr, "%s %d chain%s: %.2f nanoseconds latency "
+			"%.2f nanoseconds/load %.2f parallelism %.2f MB/sec%s\n",
+			s, i + 1, i ? "s" : "", ns[i], ns[i] / (i + 1),
+			ns[0] > 0. ? ns[0] * (i + 1) / ns[i] : 0.,
+			line * (i + 1) * 1000. / ns[i],
+			i >= MEM_REGISTER_CHAINS ? " (spilled)" : "");
+		if (json_output()) {
+			sprintf(buf, "%.100s %d chain%s", s, i + 1, i ? "s" : "");
+			json_result(buf, ns[i], "nanoseconds");
+		}
+	}
+}
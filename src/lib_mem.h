@@ -2,7 +2,9 @@
 #define LMBENCH_MEM_H
 
 
-#define MAX_MEM_PARALLELISM 16
+#define MAX_MEM_PARALLELISM 64
+/* about how many chain pointers the compiler can keep in registers */
+#define MEM_REGISTER_CHAINS 16
 #define MEM_BENCHMARK_DECL(N) \
 	void mem_benchmark_##N(iter_t iterations, void* cookie);
 
@@ -22,10 +24,60 @@
 #define REPEAT_13(m)	REPEAT_12(m) m(13)
 #define REPEAT_14(m)	REPEAT_13(m) m(14)
 #define REPEAT_15(m)	REPEAT_14(m) m(15)
+#define REPEAT_16(m)	REPEAT_15(m) m(16)
+#define REPEAT_17(m)	REPEAT_16(m) m(17)
+#define REPEAT_18(m)	REPEAT_17(m) m(18)
+#define REPEAT_19(m)	REPEAT_18(m) m(19)
+#define REPEAT_20(m)	REPEAT_19(m) m(20)
+#define REPEAT_21(m)	REPEAT_20(m) m(21)
+#define REPEAT_22(m)	REPEAT_21(m) m(22)
+#define REPEAT_23(m)	REPEAT_22(m) m(23)
+#define REPEAT_24(m)	REPEAT_23(m) m(24)
+#define REPEAT_25(m)	REPEAT_24(m) m(25)
+#define REPEAT_26(m)	REPEAT_25(m) m(26)
+#define REPEAT_27(m)	REPEAT_26(m) m(27)
+#define REPEAT_28(m)	REPEAT_27(m) m(28)
+#define REPEAT_29(m)	REPEAT_28(m) m(29)
+#define REPEAT_30(m)	REPEAT_29(m) m(30)
+#define REPEAT_31(m)	REPEAT_30(m) m(31)
+#define REPEAT_32(m)	REPEAT_31(m) m(32)
+#define REPEAT_33(m)	REPEAT_32(m) m(33)
+#define REPEAT_34(m)	REPEAT_33(m) m(34)
+#define REPEAT_35(m)	REPEAT_34(m) m(35)
+#define REPEAT_36(m)	REPEAT_35(m) m(36)
+#define REPEAT_37(m)	REPEAT_36(m) m(37)
+#define REPEAT_38(m)	REPEAT_37(m) m(38)
+#define REPEAT_39(m)	REPEAT_38(m) m(39)
+#define REPEAT_40(m)	REPEAT_39(m) m(40)
+#define REPEAT_41(m)	REPEAT_40(m) m(41)
+#define REPEAT_42(m)	REPEAT_41(m) m(42)
+#define REPEAT_43(m)	REPEAT_42(m) m(43)
+#define REPEAT_44(m)	REPEAT_43(m) m(44)
+#define REPEAT_45(m)	REPEAT_44(m) m(45)
+#define REPEAT_46(m)	REPEAT_45(m) m(46)
+#define REPEAT_47(m)	REPEAT_46(m) m(47)
+#define REPEAT_48(m)	REPEAT_47(m) m(48)
+#define REPEAT_49(m)	REPEAT_48(m) m(49)
+#define REPEAT_50(m)	REPEAT_49(m) m(50)
+#define REPEAT_51(m)	REPEAT_50(m) m(51)
+#define REPEAT_52(m)	REPEAT_51(m) m(52)
+#define REPEAT_53(m)	REPEAT_52(m) m(53)
+#define REPEAT_54(m)	REPEAT_53(m) m(54)
+#define REPEAT_55(m)	REPEAT_54(m) m(55)
+#define REPEAT_56(m)	REPEAT_55(m) m(56)
+#define REPEAT_57(m)	REPEAT_56(m) m(57)
+#define REPEAT_58(m)	REPEAT_57(m) m(58)
+#define REPEAT_59(m)	REPEAT_58(m) m(59)
+#define REPEAT_60(m)	REPEAT_59(m) m(60)
+#define REPEAT_61(m)	REPEAT_60(m) m(61)
+#define REPEAT_62(m)	REPEAT_61(m) m(62)
+#define REPEAT_63(m)	REPEAT_62(m) m(63)
 
 struct mem_state {
 	char*	addr;	/* raw pointer returned by malloc */
 	char*	base;	/* page-aligned pointer */
+	size_t	maplen;	/* length mmap'd at addr for huge pages, or 0 */
+	size_t	hugepage; /* huge page size backing addr, or 0 */
 	char*	p[MAX_MEM_PARALLELISM];
 	int	initialized;
 	int	width;
@@ -43,18 +95,27 @@ struct mem_state {
 
 void stride_initialize(iter_t iterations, void* cookie);
 void thrash_initialize(iter_t iterations, void* cookie);
+void streams_initialize(iter_t iterations, void* cookie);
+void growing_initialize(iter_t iterations, void* cookie);
+void backward_initialize(iter_t iterations, void* cookie);
+void pagerand_initialize(iter_t iterations, void* cookie);
+void tiled_initialize(iter_t iterations, void* cookie);
 void mem_initialize(iter_t iterations, void* cookie);
 void line_initialize(iter_t iterations, void* cookie);
 void tlb_initialize(iter_t iterations, void* cookie);
 void mem_cleanup(iter_t iterations, void* cookie);
 void tlb_cleanup(iter_t iterations, void* cookie);
 
-REPEAT_15(MEM_BENCHMARK_DECL)
+REPEAT_63(MEM_BENCHMARK_DECL)
 extern benchmp_f mem_benchmarks[];
 
 size_t	line_find(size_t l, int warmup, int repetitions, struct mem_state* state);
 double	line_test(size_t l, int warmup, int repetitions, struct mem_state* state);
 double	par_mem(size_t l, int warmup, int repetitions, struct mem_state* state);
+int	par_mem_curve(size_t l, int maxwidth, int warmup, int repetitions,
+		      struct mem_state* state, double* ns);
+double	par_mem_max(int n, double* ns);
+void	par_mem_print(char* s, int n, double* ns, size_t line);
 
 #endif /* LMBENCH_MEM_H */
 
@@ -0,0 +1,274 @@
+/*
+ * lib_perf.c - hardware performance counters around timed intervals
+ *
+ * If LMBENCH_PERF is set, each benchmark child opens the listed
+ * counters with perf_event_open() and reads them on either side of
+ * every timed interval.  The counts of the intervals that make it
+ * into the results are summed per child, handed back to the parent
+ * alongside the child's result_t, and reported per operation by
+ * perf_report().
+ *
+ * LMBENCH_PERF is a comma separated list of event names: cycles,
+ * instructions, llc-misses, dtlb-misses, branch-misses, page-faults,
+ * context-switches, or a raw event as rNNNN (hex, as for perf(1)).
+ * "default" selects the first five.
+ *
+ * Copyright (c) 2000 Carl Staelin and Larry McVoy.  Distributed under
+ * the FSF GPL with additional restriction that results may published
+ * only if (1) the benchmark is unmodified, and (2) the version in the
+ * sccsid below is included in the report.
+ */
+#include "bench.h"
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#if defined(SYS_perf_event_open)
+#include <linux/perf_event.h>
+#define	HAVE_PERF_EVENT
+#endif
+#endif
+
+#ifdef HAVE_PTHREAD
+#define	_PER_CHILD	__thread
+#else
+#define	_PER_CHILD
+#endif
+
+static _PER_CHILD perf_counts_t	perf_total;
+static perf_counts_t		perf_merged;
+extern FILE			*ftiming;
+
+#ifdef HAVE_PERF_EVENT
+
+struct perf_event_name {
+	char		*name;
+	uint32_t	type;
+	uint64_t	config;
+};
+
+static struct perf_event_name perf_names[] = {
+	{ "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ "llc-misses", PERF_TYPE_HW_CACHE,
+	  PERF_COUNT_HW_CACHE_LL
+	  | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+	  | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+	{ "dtlb-misses", PERF_TYPE_HW_CACHE,
+	  PERF_COUNT_HW_CACHE_DTLB
+	  | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+	  | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+	{ "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	{ "page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+	{ "context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+	{ NULL, 0, 0 }
+};
+
+/* value, time_enabled, time_running for each counter */
+typedef struct {
+	uint64	v[3];
+} perf_read_t;
+
+static _PER_CHILD int		perf_nfds = -1;
+static _PER_CHILD int		perf_fd[PERF_MAX_EVENTS];
+static _PER_CHILD perf_read_t	perf_before[PERF_MAX_EVENTS];
+static _PER_CHILD uint64	perf_delta[PERF_MAX_EVENTS];
+
+static int
+perf_open(struct perf_event_attr* attr)
+{
+	int	fd;
+
+	fd = syscall(SYS_perf_event_open, attr, 0, -1, -1, 0);
+	if (fd < 0 && !attr->exclude_kernel) {
+		/* not allowed to count the kernel; settle for user */
+		attr->exclude_kernel = 1;
+		fd = syscall(SYS_perf_event_open, attr, 0, -1, -1, 0);
+	}
+	return fd;
+}
+
+/*
+ * Open the counters named in LMBENCH_PERF for this child
+ */
+static void
+perf_init()
+{
+	int	i;
+	char	*p, *str;
+	struct perf_event_attr	attr;
+
+	perf_nfds = 0;
+	if (!(p = getenv("LMBENCH_PERF")) || !*p) return;
+	if (strcasecmp(p, "default") == 0 || strcmp(p, "1") == 0)
+		p = "cycles,instructions,llc-misses,dtlb-misses,branch-misses";
+	str = strdup(p);
+
+	for (p = strtok(str, ", "); p && perf_nfds < PERF_MAX_EVENTS;
+	     p = strtok(NULL, ", ")) {
+		bzero(&attr, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+			| PERF_FORMAT_TOTAL_TIME_RUNNING;
+		if (p[0] == 'r' && isxdigit(p[1])) {
+			attr.type = PERF_TYPE_RAW;
+			attr.config = strtoull(p + 1, NULL, 16);
+		} else {
+			for (i = 0; perf_names[i].name; ++i)
+				if (strcasecmp(p, perf_names[i].name) == 0)
+					break;
+			if (!perf_names[i].name) {
+				fprintf(stderr, "LMBENCH_PERF: unknown event %s\n", p);
+				continue;
+			}
+			attr.type = perf_names[i].type;
+			attr.config = perf_names[i].config;
+		}
+		if ((perf_fd[perf_nfds] = perf_open(&attr)) < 0) {
+#ifdef _DEBUG
+			perror(p);
+#endif
+			continue;
+		}
+		strncpy(perf_total.name[perf_nfds], p, PERF_NAME_LEN - 1);
+		perf_nfds++;
+	}
+	perf_total.nevents = perf_nfds;
+	free(str);
+}
+
+static void
+perf_read(perf_read_t* r)
+{
+	int	i;
+
+	for (i = 0; i < perf_nfds; ++i)
+		if (read(perf_fd[i], &r[i], sizeof(perf_read_t))
+		    != sizeof(perf_read_t))
+			bzero(&r[i], sizeof(perf_read_t));
+}
+#endif /* HAVE_PERF_EVENT */
+
+/*
+ * Snapshot the counters just before a timed interval starts
+ */
+void
+perf_begin()
+{
+#ifdef HAVE_PERF_EVENT
+	if (perf_nfds < 0) perf_init();
+	if (perf_nfds == 0) return;
+	perf_read(perf_before);
+#endif
+}
+
+/*
+ * Compute the counts for the interval that just stopped.  If the
+ * counters were multiplexed, scale them up to the whole interval.
+ */
+void
+perf_end()
+{
+#ifdef HAVE_PERF_EVENT
+	int		i;
+	double		enabled, running;
+	perf_read_t	after[PERF_MAX_EVENTS];
+
+	if (perf_nfds <= 0) return;
+	perf_read(after);
+	for (i = 0; i < perf_nfds; ++i) {
+		perf_delta[i] = after[i].v[0] - perf_before[i].v[0];
+		enabled = after[i].v[1] - perf_before[i].v[1];
+		running = after[i].v[2] - perf_before[i].v[2];
+		if (running > 0. && running < enabled)
+			perf_delta[i] = (uint64)(perf_delta[i] * enabled / running);
+	}
+#endif
+}
+
+/*
+ * Count the last interval, which ran iterations times, in the totals
+ */
+void
+perf_accumulate(uint64 iterations)
+{
+#ifdef HAVE_PERF_EVENT
+	int	i;
+
+	if (perf_nfds <= 0) return;
+	perf_total.iterations += iterations;
+	for (i = 0; i < perf_nfds; ++i)
+		perf_total.count[i] += perf_delta[i];
+#endif
+}
+
+void
+perf_close()
+{
+#ifdef HAVE_PERF_EVENT
+	int	i;
+
+	for (i = 0; i < perf_nfds; ++i)
+		close(perf_fd[i]);
+	perf_nfds = -1;
+#endif
+	bzero(&perf_total, sizeof(perf_total));
+}
+
+perf_counts_t*
+perf_get_counts()
+{
+	return (&perf_total);
+}
+
+/*
+ * Used by the parent to sum up the children's counts
+ */
+void
+perf_merge(perf_counts_t* p, int first)
+{
+	int	i;
+
+	if (first) bzero(&perf_merged, sizeof(perf_merged));
+	if (p->nevents == 0) return;
+	bcopy(p->name, perf_merged.name, sizeof(p->name));
+	perf_merged.nevents = p->nevents;
+	perf_merged.iterations += p->iterations;
+	for (i = 0; i < p->nevents; ++i)
+		perf_merged.count[i] += p->count[i];
+}
+
+/*
+ * Print the merged counts per operation, given the number of
+ * operations in each benchmark iteration.
+ */
+void
+perf_report(char *s, double ops)
+{
+	int	i, cycles = -1, instructions = -1;
+	double	n;
+	static int warned = 0;
+
+	if (!ftiming) ftiming = stderr;
+	if (perf_merged.nevents == 0 || perf_merged.iterations == 0) {
+		if (getenv("LMBENCH_PERF") && !warned++)
+			fprintf(ftiming,
+				"LMBENCH_PERF: no performance counters available\n");
+		return;
+	}
+	if (ops <= 0.) ops = 1.;
+	n = (double)perf_merged.iterations * ops;
+
+	fprintf(ftiming, "%s: per op", s ? s : "perf");
+	for (i = 0; i < perf_merged.nevents; ++i) {
+		fprintf(ftiming, " %s=%.4f",
+			perf_merged.name[i], perf_merged.count[i] / n);
+		if (!strcmp(perf_merged.name[i], "cycles")) cycles = i;
+		if (!strcmp(perf_merged.name[i], "instructions")) instructions = i;
+	}
+	if (cycles >= 0 && instructions >= 0 && perf_merged.count[cycles])
+		fprintf(ftiming, " IPC=%.3f",
+			perf_merged.count[instructions]
+			/ (double)perf_merged.count[cycles]);
+	fprintf(ftiming, "\n");
+}
@@ -25,10 +25,16 @@
 #include <sched.h>
 #endif
 
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
 extern int custom(char* str, int cpu);
 extern int reverse_bits(int cpu);
 extern int sched_ncpus();
 extern int sched_pin(int cpu);
+extern int numa_schedule(int pin);
+extern int topology(char* policy, int cpu);
 
 /*
  * The interface used by benchmp.
@@ -48,8 +54,12 @@ handle_scheduler(int childno, int benchproc, int nbenchprocs)
 	int	cpu = 0;
 	char*	sched = getenv("LMBENCH_SCHED");
 	
+	int	retval;
+	
 	if (!sched || strcasecmp(sched, "DEFAULT") == 0) {
 		/* do nothing.  Allow scheduler to control placement */
+		if (getenv("LMBENCH_NUMA"))
+			return numa_schedule(1);
 		return 0;
 	} else if (strcasecmp(sched, "SINGLE") == 0) {
 		/* assign all processes to CPU 0 */
@@ -84,6 +94,16 @@ handle_scheduler(int childno, int benchproc, int nbenchprocs)
 		 * or NUMA memory.
 		 */
 		cpu = reverse_bits(childno * (nbenchprocs + 1) + benchproc);
+	} else if (strcasecmp(sched, "CORES") == 0
+		   || strcasecmp(sched, "LLC_FILL") == 0
+		   || strcasecmp(sched, "SOCKETS") == 0
+		   || strcasecmp(sched, "SMT_PAIRS") == 0) {
+		/*
+		 * assign each benchmark and child process to its own
+		 * processor, in an order derived from the cache and
+		 * package topology; see topology() below.
+		 */
+		cpu = topology(sched, childno * (nbenchprocs + 1) + benchproc);
 	} else if (strncasecmp(sched, "CUSTOM ", strlen("CUSTOM ")) == 0) {
 		cpu = custom(sched + strlen("CUSTOM"), childno);
 	} else if (strncasecmp(sched, "CUSTOM_UNIQUE ", strlen("CUSTOM_UNIQUE ")) == 0) {
@@ -91,34 +111,424 @@ handle_scheduler(int childno, int benchproc, int nbenchprocs)
 			     childno * (nbenchprocs + 1) + benchproc);
 	} else {
 		/* default action: do nothing */
+		if (getenv("LMBENCH_NUMA"))
+			return numa_schedule(1);
 		return 0;
 	}
 
-	return sched_pin(cpu % sched_ncpus());
+	retval = sched_pin(cpu % sched_ncpus());
+	/* LMBENCH_SCHED decided the cpu, so only set the memory policy */
+	if (getenv("LMBENCH_NUMA"))
+		numa_schedule(0);
+	return retval;
+}
+
+/*
+ * NUMA placement, controlled by LMBENCH_NUMA, which is a list of
+ * keywords:
+ *
+ *	CPU <node>	run on the processors of <node>
+ *	MEM <node>	allocate memory only from <node>
+ *	INTERLEAVE	interleave memory across all nodes with memory
+ *	REMOTE		allocate memory from the next node with memory
+ *			after the one we are running on, i.e. never the
+ *			local node if there is another
+ *	LOCAL		allocate memory from the node we are running on
+ *
+ * e.g. LMBENCH_NUMA="CPU 0 MEM 1".  The memory policy is set with
+ * set_mempolicy() in each benchmark child after it is placed, so it
+ * covers everything the child allocates in initialize().  We make
+ * the system calls directly rather than depend on libnuma.
+ */
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+
+#define	NUMA_MAXNODES	1024
+#define	NUMA_LONGS	(NUMA_MAXNODES / (8 * sizeof(unsigned long)))
+
+/* from <linux/mempolicy.h> */
+#define	LM_MPOL_DEFAULT		0
+#define	LM_MPOL_BIND		2
+#define	LM_MPOL_INTERLEAVE	3
+
+/*
+ * Parse a sysfs list such as "0-3,8-11" into a bitmask
+ */
+static int
+numa_parse_list(char* str, unsigned long* mask, int nbits)
+{
+	int	lo, hi, n = 0;
+	char*	p = str;
+
+	bzero(mask, nbits / 8);
+	while (*p) {
+		if (!isdigit(*p)) { p++; continue; }
+		lo = hi = strtol(p, &p, 10);
+		if (*p == '-') hi = strtol(p + 1, &p, 10);
+		for (; lo <= hi && lo < nbits; ++lo, ++n)
+			mask[lo / (8 * sizeof(unsigned long))] 
+				|= 1UL << (lo % (8 * sizeof(unsigned long)));
+	}
+	return n;
+}
+
+static int
+numa_read_list(char* path, unsigned long* mask, int nbits)
+{
+	char	buf[4096];
+	int	fd, n;
+
+	bzero(mask, nbits / 8);
+	if ((fd = open(path, O_RDONLY)) < 0) return -1;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0) return -1;
+	buf[n] = 0;
+	return numa_parse_list(buf, mask, nbits);
+}
+
+static int
+numa_isset(unsigned long* mask, int bit)
+{
+	return (mask[bit / (8 * sizeof(unsigned long))] 
+		>> (bit % (8 * sizeof(unsigned long)))) & 1;
+}
+
+/*
+ * Return the number of nodes (the highest online node + 1)
+ */
+int
+numa_nodes()
+{
+	int	i, n = 1;
+	unsigned long	mask[NUMA_LONGS];
+
+	if (numa_read_list("/sys/devices/system/node/online", 
+			   mask, NUMA_MAXNODES) <= 0)
+		return 1;
+	for (i = 0; i < NUMA_MAXNODES; ++i)
+		if (numa_isset(mask, i)) n = i + 1;
+	return n;
+}
+
+/*
+ * Return non-zero if the given node has memory of its own
+ */
+int
+numa_has_memory(int node)
+{
+	unsigned long	mask[NUMA_LONGS];
+
+	if (node < 0 || node >= NUMA_MAXNODES
+	    || numa_read_list("/sys/devices/system/node/has_memory", 
+			      mask, NUMA_MAXNODES) <= 0)
+		return (node == 0);
+	return numa_isset(mask, node);
+}
+
+/*
+ * Return the node we are currently running on
+ */
+int
+numa_node()
+{
+	unsigned int	cpu = 0, node = 0;
+
+#ifdef SYS_getcpu
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) < 0) return 0;
+#endif
+	return (int)node;
+}
+
+/*
+ * Pin the current process to the processors of the given node
+ */
+int
+numa_pin_node(int node)
+{
+	int	retval = -1;
+#ifdef HAVE_SCHED_SETAFFINITY
+	char	path[128];
+	cpu_set_t	mask;
+
+	sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+	CPU_ZERO(&mask);
+	if (numa_read_list(path, (unsigned long*)&mask, 
+			   8 * sizeof(mask)) <= 0) {
+		fprintf(stderr, "numa_pin_node: no cpus on node %d\n", node);
+		return -1;
+	}
+	retval = sched_setaffinity(0, sizeof(mask), &mask);
+	if (retval < 0) perror("sched_setaffinity:");
+	/* make sure we are running there before asking numa_node() */
+	sched_yield();
+#endif
+	return retval;
+}
+
+/*
+ * Set the memory allocation policy of the current process.  
+ * node < 0 means interleave across all nodes with memory.
+ */
+int
+numa_mem_node(int node)
+{
+	int	mode = LM_MPOL_BIND;
+	int	retval;
+	unsigned long	mask[NUMA_LONGS];
+
+	if (node < 0) {
+		mode = LM_MPOL_INTERLEAVE;
+		if (numa_read_list("/sys/devices/system/node/has_memory", 
+				   mask, NUMA_MAXNODES) <= 0)
+			return -1;
+	} else {
+		bzero(mask, sizeof(mask));
+		mask[node / (8 * sizeof(unsigned long))] 
+			|= 1UL << (node % (8 * sizeof(unsigned long)));
+	}
+	retval = syscall(SYS_set_mempolicy, mode, mask, NUMA_MAXNODES + 1);
+	if (retval < 0) perror("set_mempolicy:");
+#ifdef _DEBUG
+	fprintf(stderr, "numa_mem_node(%d): pid=%d, returning %d\n", node, (int)getpid(), retval);
+#endif /* _DEBUG */
+	return retval;
+}
+
+int
+numa_schedule(int pin)
+{
+	int	i, n, node, retval = 0;
+	char	*p, *q, *str = strdup(getenv("LMBENCH_NUMA"));
+
+	for (p = strtok(str, " \t,"); p; p = strtok(NULL, " \t,")) {
+		if (strcasecmp(p, "CPU") == 0 && (q = strtok(NULL, " \t,"))) {
+			if (pin) retval |= numa_pin_node(atoi(q));
+		} else if (strcasecmp(p, "MEM") == 0 
+			   && (q = strtok(NULL, " \t,"))) {
+			retval |= numa_mem_node(atoi(q));
+		} else if (strcasecmp(p, "INTERLEAVE") == 0) {
+			retval |= numa_mem_node(-1);
+		} else if (strcasecmp(p, "REMOTE") == 0) {
+			/*
+			 * Skip memoryless nodes; if no other node has
+			 * memory we end up back on our own.
+			 */
+			n = numa_nodes();
+			node = numa_node();
+			for (i = 1; i < n; ++i) {
+				if (numa_has_memory((node + i) % n)) break;
+			}
+			retval |= numa_mem_node((node + i) % n);
+		} else if (strcasecmp(p, "LOCAL") == 0) {
+			retval |= numa_mem_node(numa_node());
+		}
+	}
+	free(str);
+	return retval;
+}
+
+#else
+
+int
+numa_nodes()
+{
+	return 1;
+}
+
+int
+numa_has_memory(int node)
+{
+	return (node == 0);
+}
+
+int
+numa_schedule(int pin)
+{
+	return 0;
 }
 
+#endif /* __linux__ && SYS_set_mempolicy */
+
 /*
  * Use to get sequentially created processes "far" away from
  * each other in an SMP.
  *
- * XXX: probably doesn't work for NCPUS not a power of two.
+ * When NCPUS is not a power of two, some bit-reversed values are
+ * too big; skip those so that the result is still a permutation
+ * of [0, NCPUS).
  */
 int
 reverse_bits(int cpu)
 {
-	int	i;
+	int	i, j, n;
 	int	nbits;
-	int	max = sched_ncpus() - 1;
-	int	cpu_reverse = 0;
+	int	ncpus = sched_ncpus();
+	int	max = ncpus - 1;
+	int	cpu_reverse;
 
 	for (i = max>>1, nbits = 1; i > 0; i >>= 1, nbits++)
 	  ;
-	/* now reverse the bits */
-	for (i = 0; i < nbits; i++) {
-		if (cpu & (1<<i))
-			cpu_reverse |= (1<<(nbits-i-1));
+	cpu %= ncpus;
+	for (n = 0, j = 0; ; ++j) {
+		/* now reverse the bits */
+		for (i = 0, cpu_reverse = 0; i < nbits; i++) {
+			if (j & (1<<i))
+				cpu_reverse |= (1<<(nbits-i-1));
+		}
+		if (cpu_reverse < ncpus && n++ == cpu)
+			return cpu_reverse;
+	}
+}
+
+/*
+ * Topology-aware placement.  We read each processor's SMT siblings,
+ * last level cache, and package from /sys/devices/system/cpu and
+ * sort the processors we may run on into the order the policy
+ * wants to hand them out:
+ *
+ *	CORES		one per physical core, SMT siblings only once
+ *			every core is in use
+ *	LLC_FILL	fill the cores of one last level cache (then
+ *			their SMT siblings) before moving to the next
+ *	SOCKETS		round-robin across packages, again using every
+ *			core before any SMT sibling
+ *	SMT_PAIRS	both SMT siblings of a core, then the next core
+ *
+ * The result is an index into the processors in our affinity mask,
+ * which is what sched_pin() expects.
+ */
+typedef struct {
+	int	index;		/* position in our affinity mask */
+	int	core;		/* lowest cpu id among SMT siblings */
+	int	smt;		/* position among SMT siblings */
+	int	llc;		/* lowest cpu id sharing the last level cache */
+	int	package;	/* physical package id */
+	int	rank;		/* position within the package */
+	int	order;		/* sort key for this policy */
+} sched_cpu;
+
+static sched_cpu*	sched_cpus = NULL;
+static int		sched_cpus_n = 0;
+
+#if defined(HAVE_SCHED_SETAFFINITY) && defined(CPU_ISSET)
+/*
+ * Read the first number in /sys/devices/system/cpu/cpu<cpu>/<file>
+ */
+static int
+sysfs_cpu_int(int cpu, char* file, int dflt)
+{
+	char	path[256];
+	FILE*	f;
+	int	val = dflt;
+
+	sprintf(path, "/sys/devices/system/cpu/cpu%d/%s", cpu, file);
+	if ((f = fopen(path, "r")) != NULL) {
+		if (fscanf(f, "%d", &val) != 1) val = dflt;
+		fclose(f);
+	}
+	return val;
+}
+#endif
+
+/*
+ * Read the topology of the processors in our affinity mask, once;
+ * after that the table is only read, so threads can share it.
+ */
+static void
+sched_topology_init()
+{
+#if defined(HAVE_SCHED_SETAFFINITY) && defined(CPU_ISSET)
+	sched_cpu*	cpus;
+	cpu_set_t	mask;
+	int		i, j, id, level, max_level, ncpus = 0;
+	char		file[64];
+
+	if (sched_cpus != NULL) return;
+	if (sched_getaffinity(0, sizeof(mask), &mask) < 0)
+		return;
+	cpus = (sched_cpu*)calloc(CPU_SETSIZE, sizeof(sched_cpu));
+	if (cpus == NULL) return;
+	for (id = 0; id < CPU_SETSIZE; ++id) {
+		sched_cpu* c;
+
+		if (!CPU_ISSET(id, &mask)) continue;
+		c = &cpus[ncpus];
+		c->index = ncpus++;
+		c->core = sysfs_cpu_int(id, 
+			"topology/thread_siblings_list", id);
+		c->package = sysfs_cpu_int(id, 
+			"topology/physical_package_id", 0);
+		c->llc = c->package;
+		for (i = 0, max_level = 0; ; ++i) {
+			sprintf(file, "cache/index%d/level", i);
+			if ((level = sysfs_cpu_int(id, file, -1)) < 0)
+				break;
+			if (level > max_level) {
+				sprintf(file, 
+					"cache/index%d/shared_cpu_list",
+					i);
+				c->llc = sysfs_cpu_int(id, file, id);
+				max_level = level;
+			}
+		}
+		for (j = 0; j < c->index; ++j) {
+			if (cpus[j].core == c->core) c->smt++;
+		}
+	}
+	/* number the first threads of each package, then the rest */
+	for (i = 0; i < ncpus; ++i) {
+		for (j = 0; j < ncpus; ++j) {
+			if (cpus[j].package == cpus[i].package
+			    && (cpus[j].smt < cpus[i].smt
+				|| (cpus[j].smt == cpus[i].smt && j < i)))
+				cpus[i].rank++;
+		}
 	}
-	return cpu_reverse;
+	sched_cpus_n = ncpus;
+	sched_cpus = cpus;
+#endif
+}
+
+static int
+sched_cpu_compare(const void* a, const void* b)
+{
+	const sched_cpu* x = (const sched_cpu*)a;
+	const sched_cpu* y = (const sched_cpu*)b;
+
+	if (x->order != y->order) return x->order - y->order;
+	return x->index - y->index;
+}
+
+int
+topology(char* policy, int cpu)
+{
+	sched_cpu*	cpus;
+	int		i, n;
+
+	sched_topology_init();
+	if ((n = sched_cpus_n) == 0) return cpu;
+
+	/* sort our own copy, since benchmp threads share the table */
+	cpus = (sched_cpu*)malloc(n * sizeof(sched_cpu));
+	if (cpus == NULL) return cpu;
+	bcopy(sched_cpus, cpus, n * sizeof(sched_cpu));
+	for (i = 0; i < n; ++i) {
+		sched_cpu* c = &cpus[i];
+
+		if (strcasecmp(policy, "CORES") == 0) {
+			c->order = c->smt;
+		} else if (strcasecmp(policy, "LLC_FILL") == 0) {
+			c->order = c->llc * 64 + c->smt;
+		} else if (strcasecmp(policy, "SOCKETS") == 0) {
+			c->order = c->rank;
+		} else if (strcasecmp(policy, "SMT_PAIRS") == 0) {
+			c->order = c->core;
+		}
+	}
+	qsort(cpus, n, sizeof(sched_cpu), sched_cpu_compare);
+	cpu = cpus[cpu % n].index;
+	free(cpus);
+	return cpu;
 }
 
 /*
@@ -168,6 +578,65 @@ sched_ncpus()
 	return 1;
 }
 
+#if defined(HAVE_SCHED_SETAFFINITY)
+/*
+ * The processors we were allowed to run on before anything was pinned
+ */
+static unsigned long* sched_cpumask = NULL;
+static int sched_cpumask_sz = 0;
+static int sched_cpumask_ncpus = 0;
+
+static int
+sched_cpumask_init()
+{
+	unsigned long* cpumask;
+	int i, sz, ncpus = 0;
+
+	if (sched_cpumask != NULL) return 0;
+
+	sz = 1 + (2 * sched_ncpus()) / (8 * sizeof(unsigned long));
+	if (sz<sizeof(cpu_set_t)/sizeof(unsigned long)) sz = sizeof(cpu_set_t)/sizeof(unsigned long);
+	cpumask = (unsigned long*)malloc(sz * sizeof(unsigned long));
+	if (cpumask == NULL) return -1;
+	if (sched_getaffinity(0, sz * sizeof(unsigned long), (cpu_set_t*)cpumask) < 0) {
+		perror("sched_getaffinity:");
+		free(cpumask);
+		return -1;
+	}
+	for (i = 0; i < sz * 8 * sizeof(unsigned long); ++i) {
+		int	word = i / (8 * sizeof(unsigned long));
+		int	bit = i % (8 * sizeof(unsigned long));
+		if (cpumask[word] & (1UL << bit)) ncpus++;
+	}
+	sched_cpumask_sz = sz;
+	sched_cpumask_ncpus = ncpus;
+	sched_cpumask = cpumask;
+	return 0;
+}
+#endif
+
+/*
+ * Do the lazy initialization of the tables handle_scheduler() uses.
+ * benchmp() calls this before it starts any threads, so that they
+ * only ever read them.
+ */
+void
+sched_init()
+{
+	char*	sched = getenv("LMBENCH_SCHED");
+
+#if defined(HAVE_SCHED_SETAFFINITY)
+	sched_cpumask_init();
+#endif
+	sched_topology_init();
+	if (!sched) return;
+	if (strncasecmp(sched, "CUSTOM ", strlen("CUSTOM ")) == 0) {
+		custom(sched + strlen("CUSTOM"), 0);
+	} else if (strncasecmp(sched, "CUSTOM_UNIQUE ", strlen("CUSTOM_UNIQUE ")) == 0) {
+		custom(sched + strlen("CUSTOM_UNIQUE"), 0);
+	}
+}
+
 /*
  * Pin the current process to the given CPU
  *
@@ -193,35 +662,20 @@ sched_pin(int cpu)
 	retval = processor_bind(P_PID, P_MYPID, cpu, NULL);
 #elif defined(HAVE_SCHED_SETAFFINITY)
 	/* Linux interface */
-	static unsigned long* mask = NULL;
-	static unsigned long* cpumask = NULL;
-	static int sz = 0;
-	static int ncpus = 0;
+	unsigned long* mask;
 	int i;
 	int j;
 	
-	if (cpumask == NULL) {
-		sz = 1 + (2 * sched_ncpus()) / (8 * sizeof(unsigned long));
-		if (sz<sizeof(cpu_set_t)/sizeof(unsigned long)) sz = sizeof(cpu_set_t)/sizeof(unsigned long);
-		mask = (unsigned long*)malloc(sz * sizeof(unsigned long));
-		cpumask = (unsigned long*)malloc(sz * sizeof(unsigned long));
-		retval = sched_getaffinity(0, sz * sizeof(unsigned long), (cpu_set_t*)cpumask);
-		if (retval < 0) perror("sched_getaffinity:");
-		if (retval < 0) return retval;
-
-		for (i = 0; i < sz * 8 * sizeof(unsigned long); ++i) {
-			int	word = i / (8 * sizeof(unsigned long));
-			int	bit = i % (8 * sizeof(unsigned long));
-			if (cpumask[word] & (1UL << bit)) ncpus++;
-		}
-	}
-	cpu %= ncpus;
+	if (sched_cpumask_init() < 0) return -1;
+	cpu %= sched_cpumask_ncpus;
 
-	bzero(mask, sz * sizeof(unsigned long));
-	for (i = 0, j = 0; i < sz * 8 * sizeof(unsigned long); ++i) {
+	/* our own mask, since benchmp threads may pin concurrently */
+	mask = (unsigned long*)calloc(sched_cpumask_sz, sizeof(unsigned long));
+	if (mask == NULL) return -1;
+	for (i = 0, j = 0; i < sched_cpumask_sz * 8 * sizeof(unsigned long); ++i) {
 		int	word = i / (8 * sizeof(unsigned long));
 		int	bit = i % (8 * sizeof(unsigned long));
-		if (cpumask[word] & (1UL << bit)) {
+		if (sched_cpumask[word] & (1UL << bit)) {
 			if (j >= cpu) {
 				mask[word] |= (1UL << bit);
 				break;
@@ -229,8 +683,9 @@ sched_pin(int cpu)
 			j++;
 		}
 	}
-	retval = sched_setaffinity(0, sz * sizeof(unsigned long), (cpu_set_t*)mask);
+	retval = sched_setaffinity(0, sched_cpumask_sz * sizeof(unsigned long), (cpu_set_t*)mask);
 	if (retval < 0) perror("sched_setaffinity:");
+	free(mask);
 #ifdef _DEBUG
 	fprintf(stderr, "sched_pin(%d): pid=%d, returning %d\n", cpu, (int)getpid(), retval);
 #endif /* _DEBUG */
@@ -0,0 +1,230 @@
+/*
+ * lib_shm.c - a shared memory ring for interprocess messages
+ *
+ * The ring lives in anonymous MAP_SHARED memory created before the
+ * fork, so both sides of a benchmark see it without going through the
+ * kernel to move data.  The kernel is only involved when one side has
+ * to sleep: with SHM_SPIN nobody ever sleeps, with SHM_FUTEX waiters
+ * sleep on a futex, and with SHM_EVENTFD they block in read() on an
+ * eventfd, which is what an event loop would use.
+ *
+ * A slot whose sequence number equals position p is free for the
+ * producer that claimed p; once filled it is set to p + 1 for the
+ * consumer, which hands it back as p + nslots.  This is Dmitry
+ * Vyukov's bounded queue, less the consumer side CAS since we only
+ * ever have one consumer.
+ *
+ * Copyright (c) 2000 Carl Staelin and Larry McVoy.  Distributed under
+ * the FSF GPL with additional restriction that results may published
+ * only if (1) the benchmark is unmodified, and (2) the version in the
+ * sccsid below is included in the report.
+ */
+#include "bench.h"
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/futex.h>
+#endif
+
+char	*shm_wait_modes[] = { "spin", "futex", "eventfd", NULL };
+
+typedef struct {
+	volatile uint64	seq;
+	int		len;
+} shm_slot_t;
+
+#define	SHM_ROUND(x)	(((x) + 63) & ~63)
+#define	SHM_SLOT(r, pos)	((shm_slot_t*)((char*)(r)		\
+			 + SHM_ROUND(sizeof(shm_ring_t))		\
+			 + ((pos) % (r)->nslots) * (r)->stride))
+
+static void
+shm_relax(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	__asm__ __volatile__("pause" ::: "memory");
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield" ::: "memory");
+#else
+	__sync_synchronize();
+#endif
+}
+
+int
+shm_wait_mode(char* name)
+{
+	int	i;
+
+	for (i = 0; shm_wait_modes[i]; ++i)
+		if (!strcmp(name, shm_wait_modes[i])) break;
+	if (!shm_wait_modes[i]) return (-1);
+#if !defined(__linux__)
+	if (i != SHM_SPIN) return (-1);
+#endif
+	return (i);
+}
+
+shm_ring_t*
+shm_ring_create(int nslots, int slotsize, int wait, int mp)
+{
+	int	i, stride = SHM_ROUND(sizeof(shm_slot_t) + slotsize);
+	size_t	size = SHM_ROUND(sizeof(shm_ring_t)) + (size_t)nslots * stride;
+	shm_ring_t* r;
+
+	r = (shm_ring_t*)mmap(0, size, PROT_READ|PROT_WRITE,
+			      MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (r == (shm_ring_t*)MAP_FAILED) {
+		perror("shm_ring_create: mmap");
+		return (NULL);
+	}
+	bzero(r, sizeof(*r));
+	r->nslots = nslots;
+	r->slotsize = slotsize;
+	r->stride = stride;
+	r->wait = wait;
+	r->mp = mp;
+	r->size = size;
+	r->data.efd = r->space.efd = -1;
+	for (i = 0; i < nslots; ++i)
+		SHM_SLOT(r, i)->seq = i;
+#if defined(__linux__)
+	if (wait == SHM_EVENTFD) {
+		r->data.efd = eventfd(0, 0);
+		r->space.efd = eventfd(0, 0);
+		if (r->data.efd < 0 || r->space.efd < 0) {
+			perror("shm_ring_create: eventfd");
+			shm_ring_destroy(r);
+			return (NULL);
+		}
+	}
+#endif
+	return (r);
+}
+
+void
+shm_ring_destroy(shm_ring_t* r)
+{
+	if (r->data.efd >= 0) close(r->data.efd);
+	if (r->space.efd >= 0) close(r->space.efd);
+	munmap((void*)r, r->size);
+}
+
+/*
+ * Producers sharing a ring wait for space on the futex even with
+ * SHM_EVENTFD: a woken producer whose slot is still busy goes back to
+ * sleep, and on an eventfd it could take the wakeup meant for the
+ * producer the consumer is waiting on.  FUTEX_WAKE wakes them all.
+ */
+static int
+shm_bell_mode(shm_ring_t* r, shm_bell_t* b)
+{
+	if (r->wait == SHM_EVENTFD && r->mp && b == &r->space)
+		return (SHM_FUTEX);
+	return (r->wait);
+}
+
+/*
+ * Wait for *seq to become want.  Sleepers announce themselves and
+ * re-check before sleeping; with full barriers on both sides either
+ * we see the new value or the other side sees us and rings.
+ */
+static void
+shm_wait(shm_ring_t* r, shm_bell_t* b, volatile uint64* seq, uint64 want)
+{
+	int	w, spins = 0;
+	int	wait = shm_bell_mode(r, b);
+
+	while (*seq != want) {
+		if (wait == SHM_SPIN) {
+			/* let the other side run if we share a CPU */
+			if (++spins % 1024 == 0) sched_yield();
+			else shm_relax();
+			continue;
+		}
+		w = b->word;
+		__sync_fetch_and_add(&b->sleepers, 1);
+		if (*seq != want) {
+#if defined(__linux__)
+			uint64	v;
+
+			if (wait == SHM_FUTEX) {
+				syscall(SYS_futex, (int*)&b->word, FUTEX_WAIT,
+					w, NULL, NULL, 0);
+			} else if (read(b->efd, &v, sizeof(v)) != sizeof(v)) {
+				perror("shm_wait: read eventfd");
+				exit(1);
+			}
+#endif
+		}
+		__sync_fetch_and_sub(&b->sleepers, 1);
+	}
+}
+
+static void
+shm_ring(shm_ring_t* r, shm_bell_t* b)
+{
+	int	wait = shm_bell_mode(r, b);
+
+	if (wait == SHM_SPIN) return;
+	__sync_synchronize();
+	if (b->sleepers == 0) return;
+#if defined(__linux__)
+	if (wait == SHM_FUTEX) {
+		__sync_fetch_and_add(&b->word, 1);
+		syscall(SYS_futex, (int*)&b->word, FUTEX_WAKE, 0x7fffffff,
+			NULL, NULL, 0);
+	} else {
+		uint64	v = 1;
+
+		write(b->efd, &v, sizeof(v));
+	}
+#endif
+}
+
+/*
+ * Copy a message of up to slotsize bytes into the ring, waiting
+ * for room if it is full.
+ */
+void
+shm_send(shm_ring_t* r, void* msg, int len)
+{
+	uint64	pos;
+	shm_slot_t* s;
+
+	if (r->mp) {
+		pos = __sync_fetch_and_add(&r->head, 1);
+	} else {
+		pos = r->head++;
+	}
+	s = SHM_SLOT(r, pos);
+	shm_wait(r, &r->space, &s->seq, pos);
+	if (len > r->slotsize) len = r->slotsize;
+	if (len > 0) bcopy(msg, (char*)(s + 1), len);
+	s->len = len;
+	__sync_synchronize();
+	s->seq = pos + 1;
+	shm_ring(r, &r->data);
+}
+
+/*
+ * Copy the next message out of the ring, waiting for one if it is
+ * empty, and return its length.  There must only be one reader.
+ */
+int
+shm_recv(shm_ring_t* r, void* msg)
+{
+	uint64	pos = r->tail;
+	shm_slot_t* s = SHM_SLOT(r, pos);
+	int	len;
+
+	shm_wait(r, &r->data, &s->seq, pos + 1);
+	__sync_synchronize();
+	len = s->len;
+	if (len > 0 && msg) bcopy((char*)(s + 1), msg, len);
+	__sync_synchronize();
+	s->seq = pos + r->nslots;
+	r->tail = pos + 1;
+	shm_ring(r, &r->space);
+	return (len);
+}
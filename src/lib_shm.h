@@ -0,0 +1,47 @@
+/* lib_shm.c */
+#ifndef	_LIB_SHM_H_
+#define	_LIB_SHM_H_
+
+/* how a reader or writer waits for the other side */
+enum { SHM_SPIN, SHM_FUTEX, SHM_EVENTFD };
+
+/*
+ * One side of the ring rings a doorbell when it has made progress, but
+ * only if the other side has said it is going to sleep on it.
+ */
+typedef struct {
+	volatile int	word;		/* futex word, bumped on every ring */
+	volatile int	sleepers;	/* how many are waiting on it */
+	int		efd;		/* eventfd for SHM_EVENTFD */
+	char		pad[64 - 3 * sizeof(int)];
+} shm_bell_t;
+
+/*
+ * A bounded ring of fixed size slots in MAP_SHARED memory.  Each slot
+ * carries a sequence number saying whose turn it is, so the producers
+ * and the consumer never touch each other's index, and producers can
+ * claim slots with an atomic add to share the ring.
+ */
+typedef struct {
+	volatile uint64	head;		/* next slot to fill */
+	char		pad1[64 - sizeof(uint64)];
+	volatile uint64	tail;		/* next slot to drain */
+	char		pad2[64 - sizeof(uint64)];
+	shm_bell_t	data;		/* rung when a slot is filled */
+	shm_bell_t	space;		/* rung when a slot is drained */
+	int		nslots;
+	int		slotsize;	/* largest message */
+	int		stride;		/* bytes from one slot to the next */
+	int		wait;		/* SHM_SPIN, SHM_FUTEX or SHM_EVENTFD */
+	int		mp;		/* more than one producer */
+	size_t		size;		/* of the whole mapping */
+} shm_ring_t;
+
+shm_ring_t*	shm_ring_create(int nslots, int slotsize, int wait, int mp);
+void	shm_ring_destroy(shm_ring_t* r);
+void	shm_send(shm_ring_t* r, void* msg, int len);
+int	shm_recv(shm_ring_t* r, void* msg);
+int	shm_wait_mode(char* name);
+
+extern char	*shm_wait_modes[];
+#endif
@@ -221,6 +221,15 @@ sock_optimize(int sock, int flags)
 			perror("SO_REUSEADDR");
 		}
 	}
+#ifdef	SO_REUSEPORT
+	if (flags & SOCKOPT_REUSEPORT) {
+		int	val = 1;
+		if (setsockopt(sock, SOL_SOCKET,
+		    SO_REUSEPORT, &val, sizeof(val)) == -1) {
+			perror("SO_REUSEPORT");
+		}
+	}
+#endif
 }
 
 int
@@ -28,25 +28,189 @@
 #define	MB	(1000*1000.0)
 #define	KB	(1000.0)
 
-static struct timeval 	start_tv, stop_tv;
+/*
+ * Timing state that benchmp() children each own.  When children are
+ * threads (see benchmp_threads()) it has to be thread-local.
+ */
+#ifdef HAVE_PTHREAD
+#define	_PER_CHILD	__thread
+#else
+#define	_PER_CHILD
+#endif
+
+static _PER_CHILD uint64	start_ns, stop_ns;
 FILE			*ftiming;
 static volatile uint64	use_result_dummy;
-static		uint64	iterations;
+static _PER_CHILD uint64	iterations;
 static		void	init_timing(void);
-static		double	avg_time_per_iter;
-static		double	stddev;
+static _PER_CHILD double	avg_time_per_iter;
+static _PER_CHILD double	stddev;
 static		stats_t*	child_stats = NULL;
+static		int		child_stats_n = 0;
 
 #if defined(hpux) || defined(__hpux)
 #include <sys/mman.h>
 #endif
 
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define	MAP_ANONYMOUS	MAP_ANON
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#define	HAVE_RDTSCP
+#endif
+
+/*
+ * Clock sources.
+ *
+ * Everything below start()/stop() is kept in nanoseconds.  The source
+ * is chosen the first time the clock is read, and may be forced with
+ * LMBENCH_CLOCK:
+ *
+ *	gettimeofday	the traditional microsecond clock
+ *	monotonic	clock_gettime(CLOCK_MONOTONIC_RAW) [default]
+ *	tsc		invariant TSC read with rdtscp, calibrated against
+ *			the monotonic clock
+ *
+ * If the requested source isn't available we silently fall back to
+ * the next best one.
+ */
+static	uint64	clock_select(void);
+static	uint64	(*clock_read)(void) = clock_select;
+static	int	clock_fine = 0;	/* sub-microsecond resolution? */
+
+static uint64
+clock_gtod(void)
+{
+	struct timeval t;
+
+	(void) gettimeofday(&t, (struct timezone *) 0);
+	return ((uint64)t.tv_sec * 1000000000 + (uint64)t.tv_usec * 1000);
+}
+
+#if defined(CLOCK_MONOTONIC_RAW) || defined(CLOCK_MONOTONIC)
+#ifdef CLOCK_MONOTONIC_RAW
+#define	LMBENCH_CLOCKID	CLOCK_MONOTONIC_RAW
+#else
+#define	LMBENCH_CLOCKID	CLOCK_MONOTONIC
+#endif
+
+static uint64
+clock_mono(void)
+{
+	struct timespec t;
+
+	(void) clock_gettime(LMBENCH_CLOCKID, &t);
+	return ((uint64)t.tv_sec * 1000000000 + (uint64)t.tv_nsec);
+}
+#endif
+
+#ifdef HAVE_RDTSCP
+static uint64	tsc_base;
+static uint64	tsc_base_ns;
+static double	tsc_ns_per_tick;
+
+static inline uint64
+rdtscp(void)
+{
+	unsigned int	lo, hi, aux;
+
+	__asm__ __volatile__("rdtscp" : "=a" (lo), "=d" (hi), "=c" (aux));
+	return (((uint64)hi << 32) | lo);
+}
+
+static uint64
+clock_tsc(void)
+{
+	return (tsc_base_ns + (uint64)((rdtscp() - tsc_base) * tsc_ns_per_tick));
+}
+
+/*
+ * We only trust the TSC if the processor claims it is invariant
+ * (constant rate across P- and C-states) and supports rdtscp.
+ */
+static int
+tsc_usable(void)
+{
+	unsigned int	a, b, c, d;
+
+	if (!__get_cpuid(0x80000000, &a, &b, &c, &d) || a < 0x80000007)
+		return (0);
+	__get_cpuid(0x80000001, &a, &b, &c, &d);
+	if (!(d & (1 << 27)))			/* rdtscp */
+		return (0);
+	__get_cpuid(0x80000007, &a, &b, &c, &d);
+	return ((d & (1 << 8)) != 0);		/* invariant TSC */
+}
+
+/*
+ * Calibrate the TSC against the monotonic clock over ~20ms.
+ */
+static int
+tsc_calibrate(void)
+{
+	uint64	t0, t1, c0, c1;
+
+	t0 = clock_mono();
+	c0 = rdtscp();
+	do {
+		t1 = clock_mono();
+		c1 = rdtscp();
+	} while (t1 - t0 < 20000000);
+	if (c1 <= c0)
+		return (0);
+	tsc_ns_per_tick = (double)(t1 - t0) / (double)(c1 - c0);
+	tsc_base = c1;
+	tsc_base_ns = t1;
+	return (1);
+}
+#endif /* HAVE_RDTSCP */
+
+static uint64
+clock_select(void)
+{
+	char	*s = getenv("LMBENCH_CLOCK");
+
+	clock_read = clock_gtod;
+	clock_fine = 0;
+	if (s && (strcasecmp(s, "gettimeofday") == 0 
+		  || strcasecmp(s, "gtod") == 0)) {
+		return ((*clock_read)());
+	}
+#ifdef LMBENCH_CLOCKID
+	{
+		struct timespec t;
+
+		if (clock_gettime(LMBENCH_CLOCKID, &t) == 0) {
+			clock_read = clock_mono;
+			if (clock_getres(LMBENCH_CLOCKID, &t) == 0
+			    && t.tv_sec == 0 && t.tv_nsec < 1000)
+				clock_fine = 1;
+		}
+	}
+#ifdef HAVE_RDTSCP
+	if (s && strcasecmp(s, "tsc") == 0 && clock_read == clock_mono
+	    && tsc_usable() && tsc_calibrate()) {
+		clock_read = clock_tsc;
+		clock_fine = 1;
+	}
+#endif /* HAVE_RDTSCP */
+#endif /* LMBENCH_CLOCKID */
+	return ((*clock_read)());
+}
+
 #ifdef	RUSAGE
 #include <sys/resource.h>
 #define	SECS(tv)	(tv.tv_sec + tv.tv_usec / 1000000.0)
 #define	mine(f)		(int)(ru_stop.f - ru_start.f)
 
-static struct rusage ru_start, ru_stop;
+static _PER_CHILD struct rusage ru_start, ru_stop;
 
 void
 rusage(void)
@@ -121,15 +285,124 @@ benchmp_sigalrm(int signo)
 	benchmp_sigalrm_timeout = 1;
 }
 
+/*
+ * benchmp() children are normally forked processes.  benchmp_threads()
+ * lets a benchmark run them as threads instead; each thread gets its
+ * own copy of the cookie.
+ */
+static int	benchmp_use_threads = 0;
+static size_t	benchmp_cookie_size = 0;
+
+void
+benchmp_threads(int enable, size_t cookie_size)
+{
+	char	*exec = getenv("LMBENCH_EXEC");
+
+	benchmp_cookie_size = cookie_size;
+	benchmp_use_threads = (enable 
+			       || (exec && strcasecmp(exec, "threads") == 0));
+#ifndef HAVE_PTHREAD
+	benchmp_use_threads = 0;
+#endif
+	if (cookie_size == 0)
+		benchmp_use_threads = 0;
+}
+
+/*
+ * The parent and its children coordinate through a shared control
+ * block rather than pipes, so that the children can check on the
+ * parent between timing intervals without making system calls.
+ * Waiting is done with futexes where we have them.
+ *
+ * Each child does its warmup, increments 'ready' and blocks until the
+ * parent sets 'start', so that they all start timing together.  After
+ * its last timing interval it copies its result_t into its own slot
+ * (which follow the control block) and increments 'done'.  Once
+ * everybody is done the parent collects the results and sets 'exit'.
+ */
+typedef struct {
+	volatile int	ready;
+	volatile int	start;
+	volatile int	done;
+	volatile int	exit;
+	int		parallel;
+	int		warmup;
+	int		r_size;
+	int		slot_size;
+} benchmp_control;
+
+/* each child's slot holds its result_t followed by its perf counts */
+#define	BENCHMP_RESULT(ctl, i)	\
+	((result_t*)((char*)((ctl) + 1) + (i) * (ctl)->slot_size))
+#define	BENCHMP_PERF(ctl, i)	\
+	((perf_counts_t*)((char*)BENCHMP_RESULT(ctl, i) + (ctl)->r_size))
+
+/*
+ * Sleep while *addr == val, for at most usecs (forever if zero).
+ * Spurious wakeups are fine; callers always re-check.
+ */
+static void
+benchmp_wait(volatile int* addr, int val, int usecs)
+{
+#if defined(__linux__) && defined(SYS_futex)
+	struct timespec	ts;
+
+	ts.tv_sec = usecs / 1000000;
+	ts.tv_nsec = (usecs % 1000000) * 1000;
+	syscall(SYS_futex, (int*)addr, FUTEX_WAIT, val, 
+		usecs ? &ts : NULL, NULL, 0);
+#else
+	struct timeval	tv;
+
+	if (*addr != val) return;
+	tv.tv_sec = 0;
+	tv.tv_usec = 1000;
+	select(0, NULL, NULL, NULL, &tv);
+#endif
+}
+
+static void
+benchmp_wake(volatile int* addr)
+{
+#if defined(__linux__) && defined(SYS_futex)
+	syscall(SYS_futex, (int*)addr, FUTEX_WAKE, 0x7fffffff, NULL, NULL, 0);
+#endif
+}
+
+/*
+ * Count ourselves in; the last one to arrive wakes the parent.
+ */
+static void
+benchmp_post(volatile int* counter, int n)
+{
+	if (__sync_add_and_fetch(counter, 1) >= n)
+		benchmp_wake(counter);
+}
+
+/*
+ * Wait for all n children to post to counter, giving up if one of
+ * them dies or we are told to go away.
+ */
+static int
+benchmp_wait_count(volatile int* counter, int n)
+{
+	int	v;
+
+	while ((v = *counter) < n) {
+		if (benchmp_sigchld_received || benchmp_sigterm_received)
+			return (-1);
+		benchmp_wait(counter, v, 1000000);
+	}
+	__sync_synchronize();
+	return (0);
+}
+
 void
 benchmp_child(benchmp_f initialize,
 	      benchmp_f benchmark,
 	      benchmp_f cleanup,
 	      int childid,
-	      int response,
-	      int start_signal,
-	      int result_signal,
-	      int exit_signal,
+	      benchmp_control* ctl,
 	      int enough,
 	      iter_t iterations,
 	      int parallel,
@@ -137,11 +410,9 @@ benchmp_child(benchmp_f initialize,
 	      int calibrate,
 	      void* cookie
 	      );
+void	benchmp_dump_samples(benchmp_control* ctl, int parallel);
 void
-benchmp_parent(int response, 
-	       int start_signal, 
-	       int result_signal, 
-	       int exit_signal, 
+benchmp_parent(benchmp_control* ctl,
 	       pid_t* pids,
 	       int parallel, 
 	       iter_t iterations,
@@ -153,6 +424,76 @@ benchmp_parent(int response,
 int
 sizeof_result(int repetitions);
 
+#ifdef HAVE_PTHREAD
+typedef struct {
+	pthread_t	tid;
+	int		running;
+	benchmp_f	initialize;
+	benchmp_f	benchmark;
+	benchmp_f	cleanup;
+	int		childid;
+	benchmp_control* ctl;
+	int		enough;
+	iter_t		iterations;
+	int		parallel;
+	int		repetitions;
+	int		calibrate;
+	void*		cookie;
+	uint64		n;
+} benchmp_thread_t;
+
+static benchmp_thread_t*	benchmp_thread_list = NULL;
+
+/*
+ * Threads can't be killed like processes, and the benchmark loops have
+ * no cancellation points, so benchmp_interval() checks this instead.
+ */
+static volatile int	benchmp_thread_abort = 0;
+
+static void*
+benchmp_thread_main(void* arg)
+{
+	benchmp_thread_t* t = (benchmp_thread_t*)arg;
+
+	/* the timing state is per-thread, so inherit the parent's N */
+	save_n(t->n);
+	handle_scheduler(t->childid, 0, 0);
+	benchmp_child(t->initialize, 
+		      t->benchmark, 
+		      t->cleanup, 
+		      t->childid,
+		      t->ctl,
+		      t->enough,
+		      t->iterations,
+		      t->parallel,
+		      t->repetitions,
+		      t->calibrate,
+		      t->cookie
+		);
+	return (NULL);
+}
+#endif /* HAVE_PTHREAD */
+
+/*
+ * Kill child i and wait for it to go away.
+ */
+static void
+benchmp_kill_child(pid_t* pids, int i)
+{
+#ifdef HAVE_PTHREAD
+	if (benchmp_use_threads) {
+		if (benchmp_thread_list[i].running) {
+			benchmp_thread_abort = 1;
+			pthread_join(benchmp_thread_list[i].tid, NULL);
+			benchmp_thread_list[i].running = 0;
+		}
+		return;
+	}
+#endif
+	kill(pids[i], SIGTERM);
+	waitpid(pids[i], NULL, 0);
+}
+
 static void
 __benchmp(benchmp_f initialize,
 	benchmp_f benchmark,
@@ -170,12 +511,8 @@ __benchmp(benchmp_f initialize,
 	long		i, j;
 	pid_t		pid;
 	pid_t		*pids = NULL;
-	int		response[2];
-	int		start_signal[2];
-	int		result_signal[2];
-	int		exit_signal[2];
-	fd_set		fds;
-	struct timeval	timeout;
+	benchmp_control	*ctl;
+	size_t		ctl_size;
 
 #ifdef _DEBUG
 	fprintf(stderr, "benchmp(%p, %p, %p, %d, %d, %d, %d, %p): entering\n", initialize, benchmark, cleanup, enough, parallel, warmup, repetitions, cookie);
@@ -209,25 +546,48 @@ __benchmp(benchmp_f initialize,
 		save_n(1);
 	}
 
-	/* Create the necessary pipes for control */
-	if (pipe(response) < 0
-	    || pipe(start_signal) < 0
-	    || pipe(result_signal) < 0
-	    || pipe(exit_signal) < 0) {
+	/* Create the shared control block */
+	ctl_size = sizeof(benchmp_control) + parallel
+		* (sizeof_result(repetitions) + sizeof(perf_counts_t));
+	ctl = (benchmp_control*)mmap(0, ctl_size, PROT_READ|PROT_WRITE,
+				     MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (ctl == (benchmp_control*)MAP_FAILED) {
 #ifdef _DEBUG
-		fprintf(stderr, "BENCHMP: Could not create control pipes\n");
+		fprintf(stderr, "BENCHMP: Could not create control block\n");
 #endif /* _DEBUG */
 		return;
 	}
+	bzero((void*)ctl, sizeof(benchmp_control));
+	ctl->parallel = parallel;
+	ctl->warmup = warmup;
+	ctl->r_size = sizeof_result(repetitions);
+	ctl->slot_size = ctl->r_size + sizeof(perf_counts_t);
 
 	/* fork the necessary children */
 	benchmp_sigchld_received = 0;
 	benchmp_sigterm_received = 0;
 	benchmp_sigterm_handler = signal(SIGTERM, benchmp_sigterm);
-	benchmp_sigchld_handler = signal(SIGCHLD, benchmp_sigchld);
+	if (!benchmp_use_threads)
+		benchmp_sigchld_handler = signal(SIGCHLD, benchmp_sigchld);
 	pids = (pid_t*)malloc(parallel * sizeof(pid_t));
-	if (!pids) return;
+	if (!pids) {
+		munmap((void*)ctl, ctl_size);
+		return;
+	}
 	bzero((void*)pids, parallel * sizeof(pid_t));
+#ifdef HAVE_PTHREAD
+	if (benchmp_use_threads) {
+		benchmp_thread_list = (benchmp_thread_t*)
+			calloc(parallel, sizeof(benchmp_thread_t));
+		if (!benchmp_thread_list) {
+			free(pids);
+			munmap((void*)ctl, ctl_size);
+			return;
+		}
+		benchmp_thread_abort = 0;
+		sched_init();
+	}
+#endif
 
 	for (i = 0; i < parallel; ++i) {
 		if (benchmp_sigterm_received)
@@ -235,6 +595,36 @@ __benchmp(benchmp_f initialize,
 #ifdef _DEBUG
 		fprintf(stderr, "benchmp(%p, %p, %p, %d, %d, %d, %d, %p): creating child %d\n", initialize, benchmark, cleanup, enough, parallel, warmup, repetitions, cookie, i);
 #endif
+#ifdef HAVE_PTHREAD
+		if (benchmp_use_threads) {
+			benchmp_thread_t* t = &benchmp_thread_list[i];
+
+			t->initialize = initialize;
+			t->benchmark = benchmark;
+			t->cleanup = cleanup;
+			t->childid = i;
+			t->ctl = ctl;
+			t->enough = enough;
+			t->iterations = iterations;
+			t->parallel = parallel;
+			t->repetitions = repetitions;
+			t->calibrate = calibrate;
+			t->n = get_n();
+			t->cookie = malloc(benchmp_cookie_size);
+			if (!t->cookie)
+				goto error_exit;
+			bcopy(cookie, t->cookie, benchmp_cookie_size);
+			if (pthread_create(&t->tid, NULL, 
+					   benchmp_thread_main, t) != 0) {
+#ifdef _DEBUG
+				fprintf(stderr, "BENCHMP: pthread_create() failed!\n");
+#endif /* _DEBUG */
+				goto error_exit;
+			}
+			t->running = 1;
+			continue;
+		}
+#endif /* HAVE_PTHREAD */
 		switch(pids[i] = fork()) {
 		case -1:
 			/* could not open enough children! */
@@ -244,19 +634,12 @@ __benchmp(benchmp_f initialize,
 			goto error_exit;
 		case 0:
 			/* If child */
-			close(response[0]);
-			close(start_signal[1]);
-			close(result_signal[1]);
-			close(exit_signal[1]);
 			handle_scheduler(i, 0, 0);
 			benchmp_child(initialize, 
 				      benchmark, 
 				      cleanup, 
 				      i,
-				      response[1], 
-				      start_signal[0], 
-				      result_signal[0], 
-				      exit_signal[0],
+				      ctl,
 				      enough,
 				      iterations,
 				      parallel,
@@ -269,14 +652,7 @@ __benchmp(benchmp_f initialize,
 			break;
 		}
 	}
-	close(response[1]);
-	close(start_signal[0]);
-	close(result_signal[0]);
-	close(exit_signal[0]);
-	benchmp_parent(response[0], 
-		       start_signal[1], 
-		       result_signal[1], 
-		       exit_signal[1],
+	benchmp_parent(ctl,
 		       pids,
 		       parallel, 
 		       iterations,
@@ -288,10 +664,10 @@ __benchmp(benchmp_f initialize,
 
 error_exit:
 	/* give the children a chance to clean up gracefully */
-	signal(SIGCHLD, SIG_DFL);
+	if (!benchmp_use_threads)
+		signal(SIGCHLD, SIG_DFL);
 	while (--i >= 0) {
-		kill(pids[i], SIGTERM);
-		waitpid(pids[i], NULL, 0);
+		benchmp_kill_child(pids, i);
 	}
 
 cleanup_exit:
@@ -307,10 +683,25 @@ cleanup_exit:
 	 *   for children to die.  If they haven't died by 
 	 *   that time, then we start killing them.
 	 */
+#ifdef HAVE_PTHREAD
+	if (benchmp_use_threads) {
+		/* threads exit once they are told to; just reap them */
+		for (i = 0; i < parallel; ++i) {
+			if (benchmp_thread_list[i].running)
+				pthread_join(benchmp_thread_list[i].tid, NULL);
+			if (benchmp_thread_list[i].cookie)
+				free(benchmp_thread_list[i].cookie);
+		}
+		free(benchmp_thread_list);
+		benchmp_thread_list = NULL;
+		i = 0;
+	}
+#endif /* HAVE_PTHREAD */
 	benchmp_sigalrm_timeout = (int)((2 * enough)/1000000) + 2;
 	if (benchmp_sigalrm_timeout < 5)
 		benchmp_sigalrm_timeout = 5;
-	signal(SIGCHLD, SIG_DFL);
+	if (!benchmp_use_threads)
+		signal(SIGCHLD, SIG_DFL);
 	while (i-- > 0) {
 		/* wait timeout seconds for child to die, then kill it */
 		benchmp_sigalrm_pid = pids[i];
@@ -323,6 +714,7 @@ cleanup_exit:
 		signal(SIGALRM, benchmp_sigalrm_handler);
 	}
 
+	munmap((void*)ctl, ctl_size);
 	if (pids) free(pids);
 #ifdef _DEBUG
 	fprintf(stderr, "benchmp(0x%x, 0x%x, 0x%x, %d, %d, 0x%x): exiting\n", (unsigned int)initialize, (unsigned int)benchmark, (unsigned int)cleanup, enough, parallel, (unsigned int)cookie);
@@ -344,10 +736,7 @@ benchmp(benchmp_f initialize,
 }
 
 void
-benchmp_parent(	int response, 
-		int start_signal, 
-		int result_signal, 
-		int exit_signal,
+benchmp_parent(	benchmp_control* ctl,
 		pid_t* pids,
 		int parallel, 
 	        iter_t iterations,
@@ -356,15 +745,10 @@ benchmp_parent(	int response,
 		int enough
 		)
 {
-	int		i,j,k,l;
-	int		bytes_read;
+	int		i,j;
 	result_t*	results = NULL;
 	result_t*	merged_results = NULL;
-	char*		signals = NULL;
 	stats_t*	child_stats = NULL;
-	unsigned char*	buf;
-	fd_set		fds_read, fds_error;
-	struct timeval	timeout;
 
 	if (benchmp_sigchld_received || benchmp_sigterm_received) {
 #ifdef _DEBUG
@@ -373,131 +757,37 @@ benchmp_parent(	int response,
 		goto error_exit;
 	}
 
-	results = (result_t*)malloc(sizeof_result(repetitions));
 	merged_results = (result_t*)malloc(sizeof_result(parallel * repetitions));
-	signals = (char*)malloc(parallel * sizeof(char));
 	child_stats = (stats_t*)malloc(parallel * sizeof(stats_t));
-	if (!results || !merged_results || !signals || !child_stats) return;
+	if (!merged_results || !child_stats) goto error_exit;
 
 	/* Collect 'ready' signals */
-	for (i = 0; i < parallel * sizeof(char); i += bytes_read) {
-		bytes_read = 0;
-		FD_ZERO(&fds_read);
-		FD_ZERO(&fds_error);
-		FD_SET(response, &fds_read);
-		FD_SET(response, &fds_error);
-
-		timeout.tv_sec = 1;
-		timeout.tv_usec = 0;
-		select(response+1, &fds_read, NULL, &fds_error, &timeout);
-		if (benchmp_sigchld_received 
-		    || benchmp_sigterm_received
-		    || FD_ISSET(response, &fds_error)) 
-		{
+	if (benchmp_wait_count(&ctl->ready, parallel) < 0) {
 #ifdef _DEBUG
-			fprintf(stderr, "benchmp_parent: ready, benchmp_sigchld_received=%d\n", benchmp_sigchld_received);
+		fprintf(stderr, "benchmp_parent: ready, benchmp_sigchld_received=%d\n", benchmp_sigchld_received);
 #endif
-			goto error_exit;
-		}
-		if (!FD_ISSET(response, &fds_read)) {
-			continue;
-		}
-
-		bytes_read = read(response, signals, parallel * sizeof(char) - i);
-		if (bytes_read < 0) {
-#ifdef _DEBUG
-			fprintf(stderr, "benchmp_parent: ready, bytes_read=%d, %s\n", bytes_read, strerror(errno));
-#endif
-			goto error_exit;
-		}
-	}
-
-	/* let the children run for warmup microseconds */
-	if (warmup > 0) {
-		struct timeval delay;
-		delay.tv_sec = warmup / 1000000;
-		delay.tv_usec = warmup % 1000000;
-
-		select(0, NULL, NULL, NULL, &delay);
+		goto error_exit;
 	}
 
-	/* send 'start' signal */
-	write(start_signal, signals, parallel * sizeof(char));
+	/* 
+	 * send 'start' signal; the children did their warmup before
+	 * saying they were ready, and are all waiting for this
+	 */
+	ctl->start = 1;
+	benchmp_wake(&ctl->start);
 
 	/* Collect 'done' signals */
-	for (i = 0; i < parallel * sizeof(char); i += bytes_read) {
-		bytes_read = 0;
-		FD_ZERO(&fds_read);
-		FD_ZERO(&fds_error);
-		FD_SET(response, &fds_read);
-		FD_SET(response, &fds_error);
-
-		timeout.tv_sec = 1;
-		timeout.tv_usec = 0;
-		select(response+1, &fds_read, NULL, &fds_error, &timeout);
-		if (benchmp_sigchld_received 
-		    || benchmp_sigterm_received
-		    || FD_ISSET(response, &fds_error)) 
-		{
+	if (benchmp_wait_count(&ctl->done, parallel) < 0) {
 #ifdef _DEBUG
-			fprintf(stderr, "benchmp_parent: done, benchmp_child_died=%d\n", benchmp_sigchld_received);
+		fprintf(stderr, "benchmp_parent: done, benchmp_child_died=%d\n", benchmp_sigchld_received);
 #endif
-			goto error_exit;
-		}
-		if (!FD_ISSET(response, &fds_read)) {
-			continue;
-		}
-
-		bytes_read = read(response, signals, parallel * sizeof(char) - i);
-		if (bytes_read < 0) {
-#ifdef _DEBUG
-			fprintf(stderr, "benchmp_parent: done, bytes_read=%d, %s\n", bytes_read, strerror(errno));
-#endif
-			goto error_exit;
-		}
+		goto error_exit;
 	}
 
 	/* collect results */
 	insertinit(merged_results);
 	for (i = 0; i < parallel; ++i) {
-		int n = sizeof_result(repetitions);
-		buf = (unsigned char*)results;
-
-		FD_ZERO(&fds_read);
-		FD_ZERO(&fds_error);
-
-		/* tell one child to report its results */
-		write(result_signal, buf, sizeof(char));
-
-		for (; n > 0; n -= bytes_read, buf += bytes_read) {
-			bytes_read = 0;
-			FD_SET(response, &fds_read);
-			FD_SET(response, &fds_error);
-
-			timeout.tv_sec = 1;
-			timeout.tv_usec = 0;
-			select(response+1, &fds_read, NULL, &fds_error, &timeout);
-			if (benchmp_sigchld_received 
-			    || benchmp_sigterm_received
-			    || FD_ISSET(response, &fds_error)) 
-			{
-#ifdef _DEBUG
-				fprintf(stderr, "benchmp_parent: results, benchmp_sigchld_received=%d\n", benchmp_sigchld_received);
-#endif
-				goto error_exit;
-			}
-			if (!FD_ISSET(response, &fds_read)) {
-				continue;
-			}
-
-			bytes_read = read(response, buf, n);
-			if (bytes_read < 0) {
-#ifdef _DEBUG
-				fprintf(stderr, "benchmp_parent: results, bytes_read=%d, %s\n", bytes_read, strerror(errno));
-#endif
-				goto error_exit;
-			}
-		}
+		results = BENCHMP_RESULT(ctl, i);
 
 		set_results(results);
 		record_stats(&child_stats[i]);
@@ -506,38 +796,70 @@ benchmp_parent(	int response,
 			insertsort(results->v[j].u, 
 				   results->v[j].n, merged_results);
 		}
+		perf_merge(BENCHMP_PERF(ctl, i), i == 0);
 	}
 
+	if (getenv("LMBENCH_SAMPLES"))
+		benchmp_dump_samples(ctl, parallel);
+
 	/* we allow children to die now, without it causing an error */
-	signal(SIGCHLD, SIG_DFL);
+	if (!benchmp_use_threads)
+		signal(SIGCHLD, SIG_DFL);
 
 	/* send 'exit' signals */
-	write(exit_signal, results, parallel * sizeof(char));
+	ctl->exit = 1;
+	benchmp_wake(&ctl->exit);
 
 	/* Compute median time; iterations is constant! */
 	set_results(merged_results);
 	set_child_stats(child_stats);
+	child_stats_n = parallel;
 
-	goto cleanup_exit;
+	return;
 error_exit:
 #ifdef _DEBUG
 	fprintf(stderr, "benchmp_parent: error_exit!\n");
 #endif
-	signal(SIGCHLD, SIG_DFL);
+	if (!benchmp_use_threads)
+		signal(SIGCHLD, SIG_DFL);
 	for (i = 0; i < parallel; ++i) {
-		kill(pids[i], SIGTERM);
-		waitpid(pids[i], NULL, 0);
+		benchmp_kill_child(pids, i);
 	}
-	free(merged_results);
-	free(child_stats);
-cleanup_exit:
-	close(response);
-	close(start_signal);
-	close(result_signal);
-	close(exit_signal);
+	if (merged_results) free(merged_results);
+	if (child_stats) free(child_stats);
+}
+
+/*
+ * Append every child's raw samples to the file named by
+ * LMBENCH_SAMPLES, one "<run> <child> <usecs> <iterations>" line
+ * per repetition.  Runs are numbered per process, so a benchmark
+ * that calls benchmp() several times can be split apart afterwards.
+ */
+void
+benchmp_dump_samples(benchmp_control* ctl, int parallel)
+{
+	int		i, j;
+	FILE*		f;
+	result_t*	r;
+	static int	run = 0;
 
-	if (results) free(results);
-	if (signals) free(signals);
+	if (!(f = fopen(getenv("LMBENCH_SAMPLES"), "a"))) {
+		perror(getenv("LMBENCH_SAMPLES"));
+		return;
+	}
+	if (run == 0)
+		fprintf(f, "# pid %d: run child usecs iterations\n", 
+			(int)getpid());
+	for (i = 0; i < parallel; ++i) {
+		r = BENCHMP_RESULT(ctl, i);
+		for (j = r->N - 1; j >= 0; --j) {
+			fprintf(f, "%d %d %llu %llu\n", run, i,
+				(unsigned long long)r->v[j].u, 
+				(unsigned long long)r->v[j].n);
+		}
+	}
+	fclose(f);
+	run++;
 }
 
 
@@ -549,10 +871,7 @@ typedef struct {
 	benchmp_f	benchmark;
 	benchmp_f	cleanup;
 	int		childid;
-	int		response;
-	int		start_signal;
-	int		result_signal;
-	int		exit_signal;
+	benchmp_control* ctl;
 	int		enough;
         iter_t		iterations;
 	int		parallel;
@@ -561,12 +880,13 @@ typedef struct {
 	void*		cookie;
 	iter_t		iterations_batch;
 	int		need_warmup;
+	uint64		warmup_end;	/* ns; when we are warm enough */
 	long		i;
 	int		r_size;
 	result_t*	r;
 } benchmp_child_state;
 
-static benchmp_child_state _benchmp_child_state;
+static _PER_CHILD benchmp_child_state _benchmp_child_state;
 
 int
 benchmp_childid()
@@ -574,6 +894,18 @@ benchmp_childid()
 	return _benchmp_child_state.childid;
 }
 
+/*
+ * Is the current call to the benchmark being timed, as opposed to
+ * calibrating, warming up or cooling down?  For benchmarks that keep
+ * their own statistics, such as latency histograms.
+ */
+int
+benchmp_timing()
+{
+	return (_benchmp_child_state.state == timing_interval
+		&& !_benchmp_child_state.calibrate);
+}
+
 void
 benchmp_child_sigchld(int signo)
 {
@@ -601,6 +933,23 @@ benchmp_child_sigterm(int signo)
 	exit(0);
 }
 
+/*
+ * A child is done: processes exit, threads just go away.
+ */
+static void
+benchmp_child_exit(benchmp_child_state* state, int status)
+{
+	perf_close();
+#ifdef HAVE_PTHREAD
+	if (benchmp_use_threads) {
+		if (state->r) free(state->r);
+		state->r = NULL;
+		pthread_exit(NULL);
+	}
+#endif
+	exit(status);
+}
+
 void*
 benchmp_getstate()
 {
@@ -612,10 +961,7 @@ benchmp_child(benchmp_f initialize,
 		benchmp_f benchmark,
 		benchmp_f cleanup,
 		int childid,
-		int response, 
-		int start_signal, 
-		int result_signal, 
-		int exit_signal,
+		benchmp_control* ctl,
 		int enough,
 	        iter_t iterations,
 		int parallel, 
@@ -629,18 +975,13 @@ benchmp_child(benchmp_f initialize,
 	double		usecs;
 	long		i = 0;
 	int		need_warmup;
-	fd_set		fds;
-	struct timeval	timeout;
 
 	_benchmp_child_state.state = warmup;
 	_benchmp_child_state.initialize = initialize;
 	_benchmp_child_state.benchmark = benchmark;
 	_benchmp_child_state.cleanup = cleanup;
 	_benchmp_child_state.childid = childid;
-	_benchmp_child_state.response = response;
-	_benchmp_child_state.start_signal = start_signal;
-	_benchmp_child_state.result_signal = result_signal;
-	_benchmp_child_state.exit_signal = exit_signal;
+	_benchmp_child_state.ctl = ctl;
 	_benchmp_child_state.enough = enough;
 	_benchmp_child_state.iterations = iterations;
 	_benchmp_child_state.iterations_batch = iterations_batch;
@@ -658,25 +999,28 @@ benchmp_child(benchmp_f initialize,
 	set_results(_benchmp_child_state.r);
 
 	need_warmup = 1;
-	timeout.tv_sec = 0;
-	timeout.tv_usec = 0;
 
-	if (benchmp_sigchld_handler != SIG_DFL) {
-		signal(SIGCHLD, benchmp_sigchld_handler);
-	} else {
-		signal(SIGCHLD, benchmp_child_sigchld);
+	/* signal dispositions are per-process, so threads leave them be */
+	if (!benchmp_use_threads) {
+		if (benchmp_sigchld_handler != SIG_DFL) {
+			signal(SIGCHLD, benchmp_sigchld_handler);
+		} else {
+			signal(SIGCHLD, benchmp_child_sigchld);
+		}
 	}
 
 	if (initialize)
 		(*initialize)(0, cookie);
 	
-	if (benchmp_sigterm_handler != SIG_DFL) {
-		signal(SIGTERM, benchmp_sigterm_handler);
-	} else {
-		signal(SIGTERM, benchmp_child_sigterm);
+	if (!benchmp_use_threads) {
+		if (benchmp_sigterm_handler != SIG_DFL) {
+			signal(SIGTERM, benchmp_sigterm_handler);
+		} else {
+			signal(SIGTERM, benchmp_child_sigterm);
+		}
+		if (benchmp_sigterm_received)
+			benchmp_child_sigterm(SIGTERM);
 	}
-	if (benchmp_sigterm_received)
-		benchmp_child_sigterm(SIGTERM);
 
 	/* start experiments, collecting results */
 	insertinit(_benchmp_child_state.r);
@@ -689,19 +1033,19 @@ benchmp_child(benchmp_f initialize,
 iter_t
 benchmp_interval(void* _state)
 {
-	char		c;
 	iter_t		iterations;
 	double		result;
-	fd_set		fds;
-	struct timeval	timeout;
+	benchmp_control* ctl;
 	benchmp_child_state* state = (benchmp_child_state*)_state;
 
 	iterations = (state->state == timing_interval ? state->iterations : state->iterations_batch);
 
 	if (!state->need_warmup) {
 		result = stop(0,0);
+		perf_end();
 		if (state->cleanup) {
-			if (benchmp_sigchld_handler == SIG_DFL)
+			if (!benchmp_use_threads 
+			    && benchmp_sigchld_handler == SIG_DFL)
 				signal(SIGCHLD, SIG_DFL);
 			(*state->cleanup)(iterations, state->cookie);
 		}
@@ -710,39 +1054,63 @@ benchmp_interval(void* _state)
 		settime(result >= 0. ? (uint64)result : 0.);
 	}
 
+#ifdef HAVE_PTHREAD
+	/* if benchmp gave up on us, then give up */
+	if (benchmp_use_threads && benchmp_thread_abort) {
+		if (state->cleanup)
+			(*state->cleanup)(0, state->cookie);
+		benchmp_child_exit(state, 0);
+	}
+#endif
+
 	/* if the parent died, then give up */
-	if (getppid() == 1 && state->cleanup) {
+	if (!benchmp_use_threads && getppid() == 1 && state->cleanup) {
 		if (benchmp_sigchld_handler == SIG_DFL)
 			signal(SIGCHLD, SIG_DFL);
 		(*state->cleanup)(0, state->cookie);
 		exit(0);
 	}
 
-	timeout.tv_sec = 0;
-	timeout.tv_usec = 0;
-	FD_ZERO(&fds);
+	ctl = state->ctl;
 
 	switch (state->state) {
 	case warmup:
 		iterations = state->iterations_batch;
-		FD_SET(state->start_signal, &fds);
-		select(state->start_signal+1, &fds, NULL,
-		       NULL, &timeout);
-		if (FD_ISSET(state->start_signal, &fds)) {
-			state->state = timing_interval;
-			read(state->start_signal, &c, sizeof(char));
-			iterations = state->iterations;
-		}
 		if (state->need_warmup) {
 			state->need_warmup = 0;
-			/* send 'ready' */
-			write(state->response, &c, sizeof(char));
+			state->warmup_end = now_ns() + (uint64)ctl->warmup * 1000;
 		}
+		if (now_ns() < state->warmup_end)
+			break;
+
+		/*
+		 * send 'ready', and block until everybody is, so that
+		 * all the children start timing together
+		 */
+		benchmp_post(&ctl->ready, ctl->parallel);
+		while (!ctl->start) {
+			benchmp_wait(&ctl->start, 0, 1000000);
+#ifdef HAVE_PTHREAD
+			if (benchmp_use_threads && benchmp_thread_abort) {
+				if (state->cleanup)
+					(*state->cleanup)(0, state->cookie);
+				benchmp_child_exit(state, 0);
+			}
+#endif
+			if (!benchmp_use_threads && getppid() == 1) {
+				if (state->cleanup)
+					(*state->cleanup)(0, state->cookie);
+				exit(0);
+			}
+		}
+		state->state = timing_interval;
+		iterations = state->iterations;
 		break;
 	case timing_interval:
 		iterations = state->iterations;
 		if (!state->calibrate || result > 0.95 * state->enough) {
 			insertsort(gettime(), get_n(), get_results());
+			perf_accumulate(get_n());
 			state->i++;
 			/* we completed all the experiments, return results */
 			if (state->i >= state->repetitions) {
@@ -765,38 +1133,38 @@ benchmp_interval(void* _state)
 		}
 		state->iterations = iterations;
 		if (state->state == cooldown) {
-			/* send 'done' */
-			write(state->response, (void*)&c, sizeof(char));
+			/* publish our results, then send 'done' */
+			bcopy((void*)get_results(), 
+			      (void*)BENCHMP_RESULT(ctl, state->childid),
+			      state->r_size);
+			bcopy((void*)perf_get_counts(),
+			      (void*)BENCHMP_PERF(ctl, state->childid),
+			      sizeof(perf_counts_t));
+			benchmp_post(&ctl->done, ctl->parallel);
 			iterations = state->iterations_batch;
 		}
 		break;
 	case cooldown:
 		iterations = state->iterations_batch;
-		FD_SET(state->result_signal, &fds);
-		select(state->result_signal+1, &fds, NULL, NULL, &timeout);
-		if (FD_ISSET(state->result_signal, &fds)) {
+		if (ctl->exit) {
 			/* 
 			 * At this point all children have stopped their
-			 * measurement loops, so we can block waiting for
-			 * the parent to tell us to send our results back.
+			 * measurement loops and the parent has our results.
 			 * From this point on, we will do no more "work".
 			 */
-			read(state->result_signal, (void*)&c, sizeof(char));
-			write(state->response, (void*)get_results(), state->r_size);
 			if (state->cleanup) {
-				if (benchmp_sigchld_handler == SIG_DFL)
+				if (!benchmp_use_threads
+				    && benchmp_sigchld_handler == SIG_DFL)
 					signal(SIGCHLD, SIG_DFL);
 				(*state->cleanup)(0, state->cookie);
 			}
-
-			/* Now wait for signal to exit */
-			read(state->exit_signal, (void*)&c, sizeof(char));
-			exit(0);
+			benchmp_child_exit(state, 0);
 		}
 	};
 	if (state->initialize) {
 		(*state->initialize)(iterations, state->cookie);
 	}
+	perf_begin();
 	start(0);
 	return (iterations);
 }
@@ -817,23 +1185,37 @@ timing(FILE *out)
 void
 start(struct timeval *tv)
 {
-	if (tv == NULL) {
-		tv = &start_tv;
-	}
 #ifdef	RUSAGE
 	getrusage(RUSAGE_SELF, &ru_start);
 #endif
-	(void) gettimeofday(tv, (struct timezone *) 0);
+	if (tv != NULL) {
+		(void) gettimeofday(tv, (struct timezone *) 0);
+		return;
+	}
+	start_ns = (*clock_read)();
 }
 
 /*
  * Stop timing and return real time in microseconds.
+ *
+ * The internal interval (begin == end == NULL) is kept in nanoseconds;
+ * the caller supplied timeval interface is the traditional microsecond
+ * gettimeofday() clock.
  */
 uint64
 stop(struct timeval *begin, struct timeval *end)
 {
+	struct timeval	tv;
+
+	if (begin == NULL && end == NULL) {
+		stop_ns = (*clock_read)();
+#ifdef	RUSAGE
+		getrusage(RUSAGE_SELF, &ru_stop);
+#endif
+		return (stop_ns > start_ns ? (stop_ns - start_ns) / 1000 : 0);
+	}
 	if (end == NULL) {
-		end = &stop_tv;
+		end = &tv;
 	}
 	(void) gettimeofday(end, (struct timezone *) 0);
 #ifdef	RUSAGE
@@ -841,7 +1223,7 @@ stop(struct timeval *begin, struct timeval *end)
 #endif
 
 	if (begin == NULL) {
-		begin = &start_tv;
+		return (0);
 	}
 	return (tvdelta(begin, end));
 }
@@ -849,40 +1231,31 @@ stop(struct timeval *begin, struct timeval *end)
 uint64
 now(void)
 {
-	struct timeval t;
-	uint64	m;
+	return ((*clock_read)() / 1000);
+}
 
-	(void) gettimeofday(&t, (struct timezone *) 0);
-	m = t.tv_sec;
-	m *= 1000000;
-	m += t.tv_usec;
-	return (m);
+uint64
+now_ns(void)
+{
+	return ((*clock_read)());
 }
 
 double
 Now(void)
 {
-	struct timeval t;
-
-	(void) gettimeofday(&t, (struct timezone *) 0);
-	return (t.tv_sec * 1000000.0 + t.tv_usec);
+	return ((*clock_read)() / 1000.0);
 }
 
 uint64
 delta(void)
 {
-	static struct timeval last;
-	struct timeval t;
-	struct timeval diff;
-	uint64	m;
+	static uint64	last;
+	uint64		t = (*clock_read)();
+	uint64		m;
 
-	(void) gettimeofday(&t, (struct timezone *) 0);
-	if (last.tv_usec) {
-		tvsub(&diff, &t, &last);
+	if (last) {
+		m = (t - last) / 1000;
 		last = t;
-		m = diff.tv_sec;
-		m *= 1000000;
-		m += diff.tv_usec;
 		return (m);
 	} else {
 		last = t;
@@ -893,12 +1266,7 @@ delta(void)
 double
 Delta(void)
 {
-	struct timeval t;
-	struct timeval diff;
-
-	(void) gettimeofday(&t, (struct timezone *) 0);
-	tvsub(&diff, &t, &start_tv);
-	return (diff.tv_sec + diff.tv_usec / 1000000.0);
+	return (((*clock_read)() - start_ns) / 1000000000.0);
 }
 
 void
@@ -919,22 +1287,26 @@ get_n(void)
 void
 settime(uint64 usecs)
 {
-	bzero((void*)&start_tv, sizeof(start_tv));
-	stop_tv.tv_sec = usecs / 1000000;
-	stop_tv.tv_usec = usecs % 1000000;
+	start_ns = 0;
+	stop_ns = usecs * 1000;
+}
+
+/*
+ * Length of the current interval in microseconds, keeping the
+ * sub-microsecond part.
+ */
+static double
+interval_usecs(void)
+{
+	return (stop_ns > start_ns ? (stop_ns - start_ns) / 1000.0 : 0.0);
 }
 
 void
 bandwidth(uint64 bytes, uint64 times, int verbose)
 {
-	struct timeval tdiff;
 	double  mb, secs;
 
-	tvsub(&tdiff, &stop_tv, &start_tv);
-	secs = tdiff.tv_sec;
-	secs *= 1000000;
-	secs += tdiff.tv_usec;
-	secs /= 1000000;
+	secs = timespent();
 	secs /= times;
 	mb = bytes / MB;
 	if (!ftiming) ftiming = stderr;
@@ -954,45 +1326,47 @@ bandwidth(uint64 bytes, uint64 times, int verbose)
 			(void) fprintf(ftiming, "%.2f\n", mb/secs);
 		}
 	}
+	if (json_output()) {
+		char	buf[64];
+
+		sprintf(buf, "%.6f", mb);
+		json_result(buf, mb/secs, "MB/sec");
+	}
 }
 
 void
 kb(uint64 bytes)
 {
-	struct timeval td;
 	double  s, bs;
 
-	tvsub(&td, &stop_tv, &start_tv);
-	s = td.tv_sec + td.tv_usec / 1000000.0;
+	s = timespent();
 	bs = bytes / nz(s);
 	if (s == 0.0) return;
 	if (!ftiming) ftiming = stderr;
 	(void) fprintf(ftiming, "%.0f KB/sec\n", bs / KB);
+	json_result(NULL, bs / KB, "KB/sec");
 }
 
 void
 mb(uint64 bytes)
 {
-	struct timeval td;
 	double  s, bs;
 
-	tvsub(&td, &stop_tv, &start_tv);
-	s = td.tv_sec + td.tv_usec / 1000000.0;
+	s = timespent();
 	bs = bytes / nz(s);
 	if (s == 0.0) return;
 	if (!ftiming) ftiming = stderr;
 	(void) fprintf(ftiming, "%.2f MB/sec\n", bs / MB);
+	json_result(NULL, bs / MB, "MB/sec");
 }
 
 void
 latency(uint64 xfers, uint64 size)
 {
-	struct timeval td;
 	double  s;
 
 	if (!ftiming) ftiming = stderr;
-	tvsub(&td, &stop_tv, &start_tv);
-	s = td.tv_sec + td.tv_usec / 1000000.0;
+	s = timespent();
 	if (s == 0.0) return;
 	if (xfers > 1) {
 		fprintf(ftiming, "%d %dKB xfers in %.2f secs, ",
@@ -1017,11 +1391,9 @@ latency(uint64 xfers, uint64 size)
 void
 context(uint64 xfers)
 {
-	struct timeval td;
 	double  s;
 
-	tvsub(&td, &stop_tv, &start_tv);
-	s = td.tv_sec + td.tv_usec / 1000000.0;
+	s = timespent();
 	if (s == 0.0) return;
 	if (!ftiming) ftiming = stderr;
 	fprintf(ftiming,
@@ -1032,29 +1404,31 @@ context(uint64 xfers)
 void
 nano(char *s, uint64 n)
 {
-	struct timeval td;
 	double  micro;
 
-	tvsub(&td, &stop_tv, &start_tv);
-	micro = td.tv_sec * 1000000 + td.tv_usec;
+	micro = interval_usecs();
 	micro *= 1000;
 	if (micro == 0.0) return;
 	if (!ftiming) ftiming = stderr;
 	fprintf(ftiming, "%s: %.2f nanoseconds\n", s, micro / n);
+	percentiles(s, 1000. * get_n() / n, 0.);
+	perf_report(s, (double)n / get_n());
+	json_result(s, micro / n, "nanoseconds");
 }
 
 void
 micro(char *s, uint64 n)
 {
-	struct timeval td;
 	double	micro;
 
-	tvsub(&td, &stop_tv, &start_tv);
-	micro = td.tv_sec * 1000000 + td.tv_usec;
+	micro = interval_usecs();
 	micro /= n;
 	if (micro == 0.0) return;
 	if (!ftiming) ftiming = stderr;
 	fprintf(ftiming, "%s: %.4f microseconds\n", s, micro);
+	percentiles(s, (double)get_n() / n, 0.);
+	perf_report(s, (double)n / get_n());
+	json_result(s, micro, "microseconds");
 #if 0
 	if (micro >= 100) {
 		fprintf(ftiming, "%s: %.1f microseconds\n", s, micro);
@@ -1069,11 +1443,9 @@ micro(char *s, uint64 n)
 void
 micromb(uint64 sz, uint64 n)
 {
-	struct timeval td;
 	double	mb, micro;
 
-	tvsub(&td, &stop_tv, &start_tv);
-	micro = td.tv_sec * 1000000 + td.tv_usec;
+	micro = interval_usecs();
 	micro /= n;
 	mb = sz;
 	mb /= MB;
@@ -1084,30 +1456,35 @@ micromb(uint64 sz, uint64 n)
 	} else {
 		fprintf(ftiming, "%.6f %.3f\n", mb, micro);
 	}
+	if (json_output()) {
+		char	buf[64];
+
+		sprintf(buf, "%.6f", mb);
+		json_result(buf, micro, "microseconds");
+	}
 }
 
 void
 milli(char *s, uint64 n)
 {
-	struct timeval td;
 	uint64 milli;
 
-	tvsub(&td, &stop_tv, &start_tv);
-	milli = td.tv_sec * 1000 + td.tv_usec / 1000;
+	milli = (uint64)(interval_usecs() / 1000);
 	milli /= n;
 	if (milli == 0.0) return;
 	if (!ftiming) ftiming = stderr;
 	fprintf(ftiming, "%s: %d milliseconds\n", s, (int)milli);
+	percentiles(s, get_n() / (1000. * n), 0.);
+	perf_report(s, (double)n / get_n());
+	json_result(s, (double)milli, "milliseconds");
 }
 
 void
 ptime(uint64 n)
 {
-	struct timeval td;
 	double  s;
 
-	tvsub(&td, &stop_tv, &start_tv);
-	s = td.tv_sec + td.tv_usec / 1000000.0;
+	s = timespent();
 	if (s == 0.0) return;
 	if (!ftiming) ftiming = stderr;
 	fprintf(ftiming,
@@ -1149,16 +1526,13 @@ tvsub(struct timeval * tdiff, struct timeval * t1, struct timeval * t0)
 uint64
 gettime(void)
 {
-	return (tvdelta(&start_tv, &stop_tv));
+	return (stop_ns > start_ns ? (stop_ns - start_ns) / 1000 : 0);
 }
 
 double
 timespent(void)
 {
-	struct timeval td;
-
-	tvsub(&td, &stop_tv, &start_tv);
-	return (td.tv_sec + td.tv_usec / 1000000.0);
+	return (interval_usecs() / 1000000.0);
 }
 
 static	char	p64buf[10][20];
@@ -1253,37 +1627,48 @@ insertinit(result_t *r)
 	r->N = 0;
 }
 
-/* biggest to smallest */
+/* 
+ * biggest to smallest; binary search for the slot so that runs
+ * with thousands of repetitions stay cheap between intervals.
+ */
 void
 insertsort(uint64 u, uint64 n, result_t *r)
 {
-	int	i, j;
+	int	i, lo, hi;
+	double	udn;
 
 	if (u == 0) return;
 
 #ifdef _DEBUG
 	fprintf(stderr, "\tinsertsort(%llu, %llu, %p)\n", u, n, r);
 #endif /* _DEBUG */
-	for (i = 0; i < r->N; ++i) {
-		if (u/(double)n > r->v[i].u/(double)r->v[i].n) {
-			for (j = r->N; j > i; --j) {
-				r->v[j] = r->v[j - 1];
-			}
-			break;
+	udn = u/(double)n;
+	lo = 0;
+	hi = r->N;
+	while (lo < hi) {
+		i = (lo + hi) / 2;
+		if (udn > r->v[i].udn) {
+			hi = i;
+		} else {
+			lo = i + 1;
 		}
 	}
+	i = lo;
+	if (i < r->N)
+		memmove(&r->v[i + 1], &r->v[i], (r->N - i) * sizeof(value_t));
 	r->v[i].u = u;
 	r->v[i].n = n;
 	r->v[i].udn = u/(double)n;
 	r->N++;
 }
 
-static result_t  _results;
-static result_t* results = &_results;
+static _PER_CHILD result_t  _results;
+static _PER_CHILD result_t* results = NULL;
 
 result_t*
 get_results()
 {
+	if (!results) results = &_results;
 	return (results);
 }
 
@@ -1329,6 +1714,193 @@ save_median()
 	save_n(n); settime(u);
 }
 
+/*
+ * Linear interpolation at fraction p of an ascending array.
+ */
+static double
+percentile_of(double* values, int size, double p)
+{
+	double	t = p * (size - 1);
+	int	i = (int)t;
+
+	if (i + 1 >= size) return (values[size - 1]);
+	return (values[i] + (t - i) * (values[i + 1] - values[i]));
+}
+
+/*
+ * If LMBENCH_PERCENTILES is set, print the spread of the current
+ * results rather than just their median: p50, p90, p99, p99.9 and
+ * max, along with the bootstrap standard error of the median.
+ * Each sample is the per-iteration time of one repetition, which
+ * is multiplied by scale and has offset subtracted, so the numbers
+ * are in the same units as the caller's main result.
+ */
+void
+percentiles(char *s, double scale, double offset)
+{
+	int	i, N;
+	double	*v, p50, err;
+
+	if (!getenv("LMBENCH_PERCENTILES")) return;
+	if (!results || (N = results->N) == 0) return;
+	if (!(v = (double*)malloc(N * sizeof(double)))) return;
+
+	/* results are sorted biggest to smallest */
+	for (i = 0; i < N; ++i)
+		v[i] = results->v[N - 1 - i].udn * scale - offset;
+	err = double_bootstrap_stderr(v, N, double_median);
+	p50 = double_median(v, N);
+
+	if (!ftiming) ftiming = stderr;
+	fprintf(ftiming, "%s: N=%d p50=%.4f p90=%.4f p99=%.4f "
+		"p99.9=%.4f max=%.4f stderr=%.4f\n",
+		s, N, p50, 
+		percentile_of(v, N, 0.90), 
+		percentile_of(v, N, 0.99),
+		percentile_of(v, N, 0.999), 
+		v[N - 1], err);
+	free(v);
+}
+
+int
+json_output(void)
+{
+	static int	json = -1;
+	char		*s;
+
+	if (json < 0) {
+		s = getenv("LMBENCH_OUTPUT");
+		json = (s && !strcmp(s, "json"));
+	}
+	return (json);
+}
+
+static void
+json_string(FILE *f, char *s)
+{
+	putc('"', f);
+	for (; s && *s; ++s) {
+		if (*s == '"' || *s == '\\') {
+			putc('\\', f);
+			putc(*s, f);
+		} else if ((unsigned char)*s < ' ') {
+			fprintf(f, "\\u%04x", (unsigned char)*s);
+		} else {
+			putc(*s, f);
+		}
+	}
+	putc('"', f);
+}
+
+/*
+ * JSON has no NaN or infinity
+ */
+static void
+json_number(FILE *f, char *fmt, double v)
+{
+	if (isfinite(v)) {
+		fprintf(f, fmt, v);
+	} else {
+		fprintf(f, "null");
+	}
+}
+
+/*
+ * Write the program name and its arguments, as the "benchmark" and
+ * "args" members, so that each record says what produced it.
+ */
+static void
+json_command(FILE *f)
+{
+#ifdef __linux__
+	static char	cmd[4096];
+	static int	len = -1;
+	char		*p, *name;
+	int		fd;
+
+	if (len < 0) {
+		len = 0;
+		if ((fd = open("/proc/self/cmdline", O_RDONLY)) >= 0) {
+			len = read(fd, cmd, sizeof(cmd) - 1);
+			if (len < 0) len = 0;
+			close(fd);
+		}
+		cmd[len] = 0;
+	}
+	name = (p = strrchr(cmd, '/')) ? p + 1 : cmd;
+	fprintf(f, "\"benchmark\":");
+	json_string(f, name);
+	fprintf(f, ",\"args\":[");
+	for (p = cmd + strlen(cmd) + 1; p < cmd + len; p += strlen(p) + 1) {
+		if (p > cmd + strlen(cmd) + 1) putc(',', f);
+		json_string(f, p);
+	}
+	putc(']', f);
+#else
+	fprintf(f, "\"benchmark\":\"\",\"args\":[]");
+#endif
+}
+
+/*
+ * If LMBENCH_OUTPUT is "json", write one JSON object per line on
+ * stdout describing the measurement just reported: the value and
+ * units as printed, the spread of the per-iteration times (usecs)
+ * over all repetitions, and the statistics of each child.  The text
+ * output on stderr is unchanged, so the scripts keep working.
+ */
+void
+json_result(char *name, double value, char *units)
+{
+	int	i, N;
+	double	median;
+
+	if (!json_output()) return;
+
+	N = results ? results->N : 0;
+	if (N == 0) {
+		median = 0.;
+	} else if (N % 2) {
+		median = results->v[N / 2].udn;
+	} else {
+		median = (results->v[N / 2].udn + results->v[N / 2 - 1].udn) / 2.;
+	}
+
+	putc('{', stdout);
+	json_command(stdout);
+	fprintf(stdout, ",\"name\":");
+	json_string(stdout, name);
+	fprintf(stdout, ",\"value\":");
+	json_number(stdout, "%.6g", value);
+	fprintf(stdout, ",\"units\":");
+	json_string(stdout, units);
+	fprintf(stdout, ",\"parallel\":%d,\"repetitions\":%d", 
+		child_stats ? child_stats_n : 1, N);
+	fprintf(stdout, ",\"time_per_iter\":{\"median\":");
+	json_number(stdout, "%.6g", median);
+	fprintf(stdout, ",\"min\":");
+	json_number(stdout, "%.6g", N ? results->v[N - 1].udn : 0.);
+	fprintf(stdout, ",\"max\":");
+	json_number(stdout, "%.6g", N ? results->v[0].udn : 0.);
+	fprintf(stdout, ",\"mean\":");
+	json_number(stdout, "%.6g", avg_time_per_iter);
+	fprintf(stdout, ",\"stddev_pct\":");
+	json_number(stdout, "%.4g", get_stddev_percent());
+	fprintf(stdout, "},\"children\":[");
+	for (i = 0; child_stats && i < child_stats_n; ++i) {
+		stats_t	*c = &child_stats[i];
+
+		fprintf(stdout, "%s{\"usecs\":%llu,\"n\":%llu,\"mean\":",
+			i ? "," : "",
+			(unsigned long long)c->time, (unsigned long long)c->n);
+		json_number(stdout, "%.6g", c->avg_time_per_iter);
+		fprintf(stdout, ",\"stddev_pct\":");
+		json_number(stdout, "%.4g", c->stddev);
+		putc('}', stdout);
+	}
+	fprintf(stdout, "]}\n");
+	fflush(stdout);
+}
+
 void
 save_avg_stddev()
 {
@@ -1468,14 +2040,16 @@ l_overhead(void)
 
 /*
  * Figure out the timing overhead.  This has to track bench.h
+ *
+ * The result is in (fractional) microseconds, so that the cost of a
+ * fine-grained clock isn't rounded away.
  */
-uint64
+double
 t_overhead(void)
 {
 	uint64		N_save, u_save;
 	static int	initialized = 0;
-	static uint64	overhead = 0;
-	struct timeval	tv;
+	static double	overhead = 0.;
 	result_t	*r_save;
 
 	init_timing();
@@ -1492,12 +2066,12 @@ t_overhead(void)
 		r_save = get_results(); N_save = get_n(); u_save = gettime(); 
 		insertinit(&r);
 		for (i = 0; i < TRIES; ++i) {
-			BENCH_INNER(gettimeofday(&tv, 0), 0);
+			BENCH_INNER(use_result_dummy += (*clock_read)(), 0);
 			insertsort(gettime(), get_n(), &r);
 		}
 		set_results(&r);
 		save_minimum();
-		overhead = gettime() / get_n();
+		overhead = gettime() / (double)get_n();
 
 		set_results(r_save); save_n(N_save); settime(u_save); 
 	}
@@ -1639,8 +2213,11 @@ test_time(int enough)
 
 /*
  * We want to find the smallest timing interval that has accurate timing
+ *
+ * The sub-5ms intervals are only worth trying with a clock that has
+ * better than microsecond resolution.
  */
-static int     possibilities[] = { 5000, 10000, 50000, 100000 };
+static int     possibilities[] = { 1000, 2000, 5000, 10000, 50000, 100000 };
 static int
 compute_enough()
 {
@@ -1649,7 +2226,10 @@ compute_enough()
 	if (getenv("ENOUGH")) {
 		return (atoi(getenv("ENOUGH")));
 	}
+	(void)(*clock_read)();	/* select the clock */
 	for (i = 0; i < sizeof(possibilities) / sizeof(int); ++i) {
+		if (possibilities[i] < 5000 && !clock_fine)
+			continue;
 		if (test_time(possibilities[i]))
 			return (possibilities[i]);
 	}
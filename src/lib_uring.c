@@ -0,0 +1,164 @@
+/*
+ * lib_uring.c - minimal io_uring support for the benchmarks
+ *
+ * Just enough of the ring to queue requests and reap completions,
+ * written against the kernel interface so that liburing is not
+ * needed.  Everything here is a no-op unless HAVE_IO_URING is set.
+ *
+ * Copyright (c) 2000 Carl Staelin and Larry McVoy.  Distributed under
+ * the FSF GPL with additional restriction that results may published
+ * only if (1) the benchmark is unmodified, and (2) the version in the
+ * sccsid below is included in the report.
+ */
+#include "bench.h"
+
+#ifdef HAVE_IO_URING
+#include <sys/syscall.h>
+
+#define	uring_load(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define	uring_store(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/*
+ * Set up a ring with room for entries submissions and cq_entries
+ * completions (0 for the kernel default of twice entries).
+ * Returns 0, or -1 with errno set.
+ */
+int
+uring_init(uring_t* r, unsigned entries, unsigned cq_entries)
+{
+	struct io_uring_params p;
+	char	*sq, *cq;
+
+	bzero(r, sizeof(*r));
+	bzero(&p, sizeof(p));
+	if (cq_entries > 2 * entries) {
+		p.flags |= IORING_SETUP_CQSIZE;
+		p.cq_entries = cq_entries;
+	}
+	r->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (r->fd < 0) return -1;
+
+	r->sq_entries = p.sq_entries;
+	r->cq_entries = p.cq_entries;
+	r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_ring_size = p.cq_off.cqes
+		+ p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_ring_size > r->sq_ring_size)
+			r->sq_ring_size = r->cq_ring_size;
+		r->cq_ring_size = r->sq_ring_size;
+	}
+	r->sq_ring = mmap(0, r->sq_ring_size, PROT_READ|PROT_WRITE,
+			  MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ring == MAP_FAILED) goto error;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		r->cq_ring = r->sq_ring;
+	} else {
+		r->cq_ring = mmap(0, r->cq_ring_size, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if (r->cq_ring == MAP_FAILED) goto error;
+	}
+	r->sqes = (struct io_uring_sqe*)mmap(0,
+		p.sq_entries * sizeof(struct io_uring_sqe),
+		PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+		r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) goto error;
+
+	sq = (char*)r->sq_ring;
+	r->sq_head = (unsigned*)(sq + p.sq_off.head);
+	r->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+	r->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+	r->sq_array = (unsigned*)(sq + p.sq_off.array);
+	cq = (char*)r->cq_ring;
+	r->cq_head = (unsigned*)(cq + p.cq_off.head);
+	r->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+	r->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+	return 0;
+error:
+	uring_exit(r);
+	return -1;
+}
+
+void
+uring_exit(uring_t* r)
+{
+	if (r->sqes && r->sqes != MAP_FAILED)
+		munmap(r->sqes, r->sq_entries * sizeof(struct io_uring_sqe));
+	if (r->cq_ring && r->cq_ring != MAP_FAILED && r->cq_ring != r->sq_ring)
+		munmap(r->cq_ring, r->cq_ring_size);
+	if (r->sq_ring && r->sq_ring != MAP_FAILED)
+		munmap(r->sq_ring, r->sq_ring_size);
+	if (r->fd > 0) close(r->fd);
+	bzero(r, sizeof(*r));
+	r->fd = -1;
+}
+
+/*
+ * Return the next free, zeroed, submission entry, or NULL if the
+ * submission queue is full (call uring_submit() and try again).
+ */
+struct io_uring_sqe*
+uring_sqe(uring_t* r)
+{
+	unsigned	tail = *r->sq_tail + r->sq_queued;
+	unsigned	idx;
+	struct io_uring_sqe *sqe;
+
+	if (tail - uring_load(r->sq_head) >= r->sq_entries)
+		return NULL;
+	idx = tail & *r->sq_mask;
+	sqe = &r->sqes[idx];
+	bzero(sqe, sizeof(*sqe));
+	r->sq_array[idx] = idx;
+	r->sq_queued++;
+	return sqe;
+}
+
+/*
+ * Submit everything queued, and wait until at least wait_nr
+ * completions are available.  Returns the number submitted.
+ */
+int
+uring_submit(uring_t* r, unsigned wait_nr)
+{
+	int	ret;
+	unsigned n = r->sq_queued;
+
+	uring_store(r->sq_tail, *r->sq_tail + n);
+	r->sq_queued = 0;
+	do {
+		ret = syscall(__NR_io_uring_enter, r->fd, n, wait_nr,
+			      wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	} while (ret < 0 && errno == EINTR);
+	return ret;
+}
+
+/*
+ * Return the oldest unread completion, or NULL if there is none
+ */
+struct io_uring_cqe*
+uring_cqe(uring_t* r)
+{
+	unsigned	head = *r->cq_head;
+
+	if (head == uring_load(r->cq_tail))
+		return NULL;
+	return &r->cqes[head & *r->cq_mask];
+}
+
+void
+uring_cqe_seen(uring_t* r)
+{
+	uring_store(r->cq_head, *r->cq_head + 1);
+}
+
+/*
+ * Register buffers, files, ... with the ring (see io_uring_register(2))
+ */
+int
+uring_register(uring_t* r, unsigned opcode, void* arg, unsigned nr)
+{
+	return syscall(__NR_io_uring_register, r->fd, opcode, arg, nr);
+}
+#endif /* HAVE_IO_URING */
@@ -0,0 +1,32 @@
+/* lib_uring.c */
+#ifndef	_LIB_URING_H_
+#define	_LIB_URING_H_
+#ifdef	HAVE_IO_URING
+#include <linux/io_uring.h>
+
+/*
+ * A minimal io_uring, driven with the raw system calls so that
+ * liburing is not required.
+ */
+typedef struct {
+	int		fd;
+	unsigned	sq_entries;
+	unsigned	cq_entries;
+	unsigned	*sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned	*cq_head, *cq_tail, *cq_mask;
+	unsigned	sq_queued;	/* sqes filled but not submitted */
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void		*sq_ring, *cq_ring;
+	size_t		sq_ring_size, cq_ring_size;
+} uring_t;
+
+int	uring_init(uring_t* r, unsigned entries, unsigned cq_entries);
+void	uring_exit(uring_t* r);
+struct io_uring_sqe* uring_sqe(uring_t* r);
+int	uring_submit(uring_t* r, unsigned wait_nr);
+struct io_uring_cqe* uring_cqe(uring_t* r);
+void	uring_cqe_seen(uring_t* r);
+int	uring_register(uring_t* r, unsigned opcode, void* arg, unsigned nr);
+#endif
+#endif
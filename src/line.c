@@ -62,6 +62,7 @@ main(int ac, char **av)
 		} else {
 			printf("%d\n", l);
 		}
+		json_result("cache line size", (double)l, "bytes");
 	}
 
 	return (0);
@@ -3,7 +3,15 @@
  *
  * Only implements the simplest GET operation.
  *
- * usage: http_srv [-f#] [-l] [-d] [port]
+ * usage: http_srv [-f#] [-l] [-d] [-e] [-s] [-p] [-c] [-r] [port]
+ *
+ * By default each worker serves one request per connection, one
+ * connection at a time.  With -e each worker is an epoll event loop
+ * which keeps HTTP/1.1 connections open for more requests.  -s and -p
+ * send files with sendfile() or splice() rather than copying them, -c
+ * keeps files open (and their stat) once they have been asked for, and
+ * -r gives each of the -f workers its own SO_REUSEPORT listener so the
+ * kernel spreads the connections between them.
  *
  * Copyright (c) 1994-6 Larry McVoy.  Distributed under the FSF GPL with
  * additional restriction that results may published only if
@@ -14,6 +22,10 @@
 char	*id = "$Id$\n";
 
 #include "bench.h"
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#endif
 #ifdef MAP_FILE
 #	define	MMAP_FLAGS	MAP_FILE|MAP_SHARED
 #else
@@ -21,13 +33,47 @@ char	*id = "$Id$\n";
 #endif
 #define	MMAPS_BETTER	(4<<10)	/* mmap is faster for sizes >= this */
 #define	LOGFILE		"/usr/tmp/lmhttp.log"
+#define	REQSIZE		4096	/* longest request with -e */
+#define	NCACHE		1024	/* hash buckets for -c */
+
+/* a connection being served by event_worker() */
+typedef struct _conn {
+	int	sock;
+	int	fd;		/* file being sent, or -1 */
+	off_t	off;		/* how much of it has been sent */
+	off_t	size;
+	int	keepalive;
+	int	events;		/* what epoll is waiting for */
+	int	pipe[2];	/* for splice() */
+	int	inpipe;
+	char	hdr[512];
+	int	hoff, hlen;	/* header sent so far, and its length */
+	char	req[REQSIZE];
+	int	nreq;
+	char	name[100];	/* for logging */
+} conn_t;
+
+/* an open file kept by -c */
+typedef struct _cached {
+	char	*name;
+	int	fd;
+	struct	stat sb;
+	struct	_cached *next;
+} cached_t;
+
+cached_t	*cache[NCACHE];
 
 char	*buf;
 char	*bufs[3];
 int	Dflg, dflg, nflg, lflg, fflg, zflg;
+int	eflg, sflg, pflg, cflg, rflg;
 int	data, logfile;
 void	die();
 void	worker();
+void	event_worker();
+int	file_open(char *name, struct stat *sb);
+void	file_close(int fd);
+int	zerocopy(int fd, int sock, int size);
 char	*http_time(void);
 char	*date(time_t *tt);
 char	*type(char *name);
@@ -60,6 +106,11 @@ main(int ac, char **av)
 		    case 'l': lflg = 1; break;	/* logging */
 		    case 'n': nflg = 1; break;	/* fake file i/o */
 		    case 'z': zflg = 1; break;	/* all files are 0 size */
+		    case 'e': eflg = 1; break;	/* epoll and keep-alive */
+		    case 's': sflg = 1; break;	/* sendfile() */
+		    case 'p': pflg = 1; break;	/* splice() */
+		    case 'c': cflg = 1; break;	/* cache open files */
+		    case 'r': rflg = 1; break;	/* SO_REUSEPORT per worker */
 		    default:
 			fprintf(stderr, "Barf.\n");
 			exit(1);
@@ -80,7 +131,13 @@ main(int ac, char **av)
 	 * Steve - why is this here?
 	 */
 	signal(SIGPIPE, SIG_IGN);
-	data = tcp_server(prog, SOCKOPT_REUSE);
+#ifndef __linux__
+	if (eflg || sflg || pflg) {
+		fprintf(stderr, "lmhttp: -e, -s and -p need Linux\n");
+		exit(1);
+	}
+#endif
+	if (!rflg) data = tcp_server(prog, SOCKOPT_REUSE);
 	bufs[0] = valloc(XFERSIZE);
 	bufs[1] = valloc(XFERSIZE);
 	bufs[2] = valloc(XFERSIZE);
@@ -93,8 +150,13 @@ main(int ac, char **av)
 			break;
 		}
 	}
+	if (rflg) data = tcp_server(prog, SOCKOPT_REUSE|SOCKOPT_REUSEPORT);
 	handle_scheduler(i, 0, 0);
-	worker();
+	if (eflg) {
+		event_worker();
+	} else {
+		worker();
+	}
 	return(0);
 }
 
@@ -113,6 +175,266 @@ worker()
 	}
 }
 
+#ifdef __linux__
+static	int	epfd;
+
+static void
+conn_close(conn_t *c)
+{
+	close(c->sock);
+	file_close(c->fd);
+	if (c->pipe[0] != -1) {
+		close(c->pipe[0]);
+		close(c->pipe[1]);
+	}
+	free(c);
+}
+
+static void
+conn_wait(conn_t *c, int events)
+{
+	struct	epoll_event ev;
+
+	if (c->events == events) return;
+	c->events = events;
+	ev.events = events;
+	ev.data.ptr = c;
+	epoll_ctl(epfd, EPOLL_CTL_MOD, c->sock, &ev);
+}
+
+/*
+ * Look for a whole request in c->req and set up the response to it.
+ * Returns 1 if there is a response to send, 0 if more of the request
+ * is needed, and -1 if the connection should be closed.
+ */
+static int
+conn_request(conn_t *c)
+{
+	int	n, fd;
+	char	*s, *end, *name, *version, *headers;
+	struct	stat sb;
+
+	/* lat_http sends a blank line after each request */
+	for (n = 0; n < c->nreq && isspace((unsigned char)c->req[n]); n++)
+		;
+	if (n) {
+		c->nreq -= n;
+		memmove(c->req, c->req + n, c->nreq);
+	}
+	c->req[c->nreq] = 0;
+	if (!strncmp(c->req, "EXIT", 4)) {
+		exit(0);
+	}
+	if (!(end = strstr(c->req, "\r\n\r\n")) 
+	    && !(end = strstr(c->req, "\n\n"))) {
+		return (c->nreq >= REQSIZE - 1 ? -1 : 0);
+	}
+	end += (*end == '\r') ? 4 : 2;
+	if (dflg) printf("%.*s\n", (int)(end - c->req), c->req);
+	if (zflg) {
+		return (-1);
+	}
+	if (strncmp(c->req, "GET /", 5)) {
+		fprintf(stderr, "lmhttp: bad request %.20s\n", c->req);
+		return (-1);
+	}
+
+	/* GET /name HTTP/1.x, then the headers */
+	for (s = c->req; *s != '\r' && *s != '\n'; s++)
+		;
+	*s = 0;
+	headers = s + 1;
+	name = &c->req[5];
+	for (s = name; *s && *s != ' '; s++) 
+		;
+	version = *s ? s + 1 : s;
+	*s = 0;
+	n = *end;
+	*end = 0;
+	c->keepalive = (strstr(version, "HTTP/1.1") != NULL);
+	if (strcasestr(headers, "Connection: close")) c->keepalive = 0;
+	if (strcasestr(headers, "Connection: keep-alive")) c->keepalive = 1;
+	*end = n;
+	strncpy(c->name, name, sizeof(c->name) - 1);
+	c->name[sizeof(c->name) - 1] = 0;
+	c->nreq -= end - c->req;
+	memmove(c->req, end, c->nreq);
+
+	if (dflg) printf("OPEN %s\n", c->name);
+	if (Dflg && isdir(c->name)) {
+		/* no length for these, so finish with the connection */
+		fcntl(c->sock, F_SETFL, 0);
+		n = sprintf(c->hdr, "HTTP/1.0 200 OK\r\nDate: %s\r\nServer: lmhttp/0.1\r\nContent-Type: text/html\r\n\r\n",
+		    http_time());
+		write(c->sock, c->hdr, n);
+		dodir(c->name, c->sock);
+		return (-1);
+	}
+	c->off = c->hoff = c->inpipe = 0;
+	if ((fd = file_open(c->name, &sb)) == -1) {
+		perror(c->name);
+		c->fd = -1;
+		c->size = 0;
+		c->hlen = sprintf(c->hdr, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: %s\r\n\r\n",
+		    c->keepalive ? "keep-alive" : "close");
+		return (1);
+	}
+	c->fd = fd;
+	c->size = sb.st_size;
+	c->hlen = sprintf(c->hdr, "HTTP/1.1 200 OK\r\nDate: %s\r\nServer: lmhttp/0.1\r\nContent-Type: %s\r\nContent-Length: %lld\r\nLast-Modified: %s\r\nConnection: %s\r\n\r\n",
+	    http_time(), type(c->name), (long long)c->size,
+	    date(&sb.st_mtime), c->keepalive ? "keep-alive" : "close");
+	return (1);
+}
+
+/*
+ * Send as much of the response as the socket will take.
+ * Returns 1 when it has all gone, 0 if the socket is full, -1 on error.
+ */
+static int
+conn_send(conn_t *c)
+{
+	int	n, len;
+	off_t	off;
+
+	while (c->hoff < c->hlen) {
+		n = send(c->sock, c->hdr + c->hoff, c->hlen - c->hoff,
+		    c->size ? MSG_MORE : 0);
+		if (n < 0) return (errno == EAGAIN ? 0 : -1);
+		c->hoff += n;
+	}
+	while (c->off < c->size) {
+		len = c->size - c->off > XFERSIZE ? XFERSIZE : c->size - c->off;
+		if (nflg) {
+			if ((n = write(c->sock, buf, len)) > 0) c->off += n;
+		} else if (pflg) {
+			if (c->pipe[0] == -1 && pipe(c->pipe) == -1) return (-1);
+			if (c->inpipe == 0) {
+				off = c->off;
+				n = splice(c->fd, &off, c->pipe[1], NULL, len,
+				    SPLICE_F_MOVE);
+				if (n <= 0) return (-1);
+				c->inpipe = n;
+			}
+			n = splice(c->pipe[0], NULL, c->sock, NULL, c->inpipe,
+			    SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+			if (n > 0) {
+				c->inpipe -= n;
+				c->off += n;
+			}
+		} else if (sflg) {
+			n = sendfile(c->sock, c->fd, &c->off, c->size - c->off);
+		} else {
+			if ((n = pread(c->fd, buf, len, c->off)) <= 0) return (-1);
+			if ((n = write(c->sock, buf, n)) > 0) c->off += n;
+		}
+		if (n < 0) return (errno == EAGAIN ? 0 : -1);
+		if (n == 0) return (-1);
+	}
+	if (lflg) logit(c->sock, c->name, (int)c->size);
+	file_close(c->fd);
+	c->fd = -1;
+	return (1);
+}
+
+/*
+ * Read requests and send responses on c until it would block
+ */
+static void
+conn_event(conn_t *c)
+{
+	int	n;
+
+	for (;;) {
+		if (c->hlen == 0) {
+			if ((n = conn_request(c)) < 0) {
+				conn_close(c);
+				return;
+			}
+			if (n == 0) {
+				n = read(c->sock, c->req + c->nreq,
+				    REQSIZE - 1 - c->nreq);
+				if (n < 0 && errno == EAGAIN) {
+					conn_wait(c, EPOLLIN);
+					return;
+				}
+				if (n <= 0) {
+					conn_close(c);
+					return;
+				}
+				c->nreq += n;
+				continue;
+			}
+		}
+		if ((n = conn_send(c)) < 0) {
+			conn_close(c);
+			return;
+		}
+		if (n == 0) {
+			conn_wait(c, EPOLLOUT);
+			return;
+		}
+		c->hlen = 0;
+		if (!c->keepalive) {
+			conn_close(c);
+			return;
+		}
+	}
+}
+#endif /* __linux__ */
+
+/*
+ * One process serving any number of connections with epoll
+ */
+void
+event_worker()
+{
+#ifdef __linux__
+	int	i, n, sock;
+	conn_t	*c;
+	struct	epoll_event ev, events[256];
+
+	morefds();
+	buf = bufs[0];
+	if ((epfd = epoll_create(256)) == -1) {
+		perror("epoll_create");
+		exit(1);
+	}
+	fcntl(data, F_SETFL, O_NONBLOCK);
+	ev.events = EPOLLIN;
+#ifdef EPOLLEXCLUSIVE
+	/* only wake one of the workers sharing the listener */
+	if (!rflg && fflg > 1) ev.events |= EPOLLEXCLUSIVE;
+#endif
+	ev.data.ptr = NULL;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, data, &ev) == -1) {
+		perror("epoll_ctl");
+		exit(1);
+	}
+	for (;;) {
+		n = epoll_wait(epfd, events, 256, -1);
+		for (i = 0; i < n; ++i) {
+			if ((c = (conn_t*)events[i].data.ptr)) {
+				conn_event(c);
+				continue;
+			}
+			while ((sock = accept4(data, 0, 0, SOCK_NONBLOCK)) >= 0) {
+				if (!(c = (conn_t*)calloc(1, sizeof(conn_t)))) {
+					close(sock);
+					continue;
+				}
+				c->sock = sock;
+				c->fd = c->pipe[0] = c->pipe[1] = -1;
+				c->events = EPOLLIN;
+				ev.events = EPOLLIN;
+				ev.data.ptr = c;
+				epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev);
+			}
+		}
+	}
+#endif
+}
+
 /*
  * "Tue, 28 Jan 97 01:20:30 GMT";
  *  012345678901234567890123456
@@ -218,19 +540,15 @@ source(int sock)
 	*s = 0;
 	if (lflg) strncpy(file, name, sizeof(file));
 	if (dflg) printf("OPEN %s\n", name);
-	fd = open(name, 0);
+	fd = file_open(name, &sb);
 	if (fd == -1) {
 error:		perror(name);
-		close(fd);
+		file_close(fd);
 		return (1);
 	}
-	if (fstat(fd, &sb) == -1) {
-		if (dflg) printf("Couldn't stat %s\n", name);
-		goto error;
-	}
 	size = sb.st_size;
-	n = sprintf(hbuf, "HTTP/1.0 200 OK\r\n%s\r\nServer: lmhttp/0.1\r\nContent-Type: %s\r\nLast-Modified: %s\r\n\r\n",
-	    http_time(), type(name), date(&sb.st_mtime));
+	n = sprintf(hbuf, "HTTP/1.0 200 OK\r\n%s\r\nServer: lmhttp/0.1\r\nContent-Type: %s\r\nContent-Length: %d\r\nLast-Modified: %s\r\n\r\n",
+	    http_time(), type(name), size, date(&sb.st_mtime));
 	if (write(sock, hbuf, n) != n) {
 		goto error;
 	}
@@ -238,6 +556,10 @@ error:		perror(name);
 		dodir(name, sock);
 	} else if (nflg) {
 		fake(sock, buf, size);
+	} else if (sflg || pflg) {
+		if (zerocopy(fd, sock, size) == -1) {
+			printf("%s sendfile failed\n", name);
+		}
 	} else if ((size > MMAPS_BETTER)) {	/* XXX */
 		if (mmap_rdwr(fd, sock, size) == -1) {
 			printf("%s mmap failed\n", name);
@@ -246,11 +568,55 @@ error:		perror(name);
 		rdwr(fd, sock, buf);
 	}
 	if (lflg) logit(sock, file, size);
-	close(fd);
+	file_close(fd);
 	return(0);
 }
 #undef	name
 
+/*
+ * Open a file and stat it.  With -c, files stay open once they have
+ * been asked for; DOCROOT is assumed not to change underneath us.
+ */
+int
+file_open(char *name, struct stat *sb)
+{
+	int	fd;
+	unsigned int h = 0;
+	char	*s;
+	cached_t *c;
+
+	if (cflg) {
+		for (s = name; *s; ++s) h = h * 31 + *s;
+		for (c = cache[h % NCACHE]; c; c = c->next) {
+			if (!strcmp(c->name, name)) {
+				*sb = c->sb;
+				lseek(c->fd, 0, SEEK_SET);
+				return (c->fd);
+			}
+		}
+	}
+	if ((fd = open(name, 0)) == -1) return (-1);
+	if (fstat(fd, sb) == -1) {
+		if (dflg) printf("Couldn't stat %s\n", name);
+		close(fd);
+		return (-1);
+	}
+	if (cflg && (c = (cached_t*)malloc(sizeof(cached_t)))) {
+		c->name = strdup(name);
+		c->fd = fd;
+		c->sb = *sb;
+		c->next = cache[h % NCACHE];
+		cache[h % NCACHE] = c;
+	}
+	return (fd);
+}
+
+void
+file_close(int fd)
+{
+	if (!cflg && fd != -1) close(fd);
+}
+
 
 int
 isdir(char *name)
@@ -360,6 +726,53 @@ mmap_rdwr(int from, int to, int size)
 	return (0);
 }
 
+/*
+ * Send size bytes of the file with sendfile(), or with -p by splicing
+ * it through a pipe, without copying it to user space.
+ */
+int
+zerocopy(int fd, int sock, int size)
+{
+#ifdef __linux__
+	off_t	off = 0;
+	int	n, p[2];
+
+	if (!pflg) {
+		while (off < size) {
+			if (sendfile(sock, fd, &off, size - off) <= 0) {
+				perror("sendfile");
+				return (-1);
+			}
+		}
+		return (0);
+	}
+	if (pipe(p) == -1) {
+		perror("pipe");
+		return (-1);
+	}
+	while (off < size) {
+		n = splice(fd, &off, p[1], NULL, size - off, SPLICE_F_MOVE);
+		if (n <= 0) break;
+		while (n > 0) {
+			int	m = splice(p[0], NULL, sock, NULL, n,
+					   SPLICE_F_MOVE);
+			if (m <= 0) {
+				perror("splice");
+				close(p[0]);
+				close(p[1]);
+				return (-1);
+			}
+			n -= m;
+		}
+	}
+	close(p[0]);
+	close(p[1]);
+	return (off < size ? -1 : 0);
+#else
+	return (-1);
+#endif
+}
+
 static	char logbuf[64<<10];	/* buffer into here */
 static	int nbytes;		/* bytes buffered */
 
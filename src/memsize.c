@@ -104,6 +104,7 @@ timeit(char *where, size_t size)
 	}
 	fprintf(stderr, "\n");
 	printf("%d\n", (size>>20));
+	json_result("memory size", (double)(size>>20), "MB");
 }
 
 static void
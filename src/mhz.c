@@ -482,6 +482,8 @@ main(int ac, char **av)
 		case 'c':
 			if (mhz > 0) {
 				printf("%.4f\n", 1000. / (double)mhz);
+				json_result("clock period", 1000. / (double)mhz,
+					    "nanoseconds");
 				mhz = 0;
 			}
 			break;
@@ -502,6 +504,7 @@ main(int ac, char **av)
 	if (mhz > 0) {
 		printf("%d MHz, %.4f nanosec clock\n", 
 		       mhz, 1000. / (double)mhz);
+		json_result("clock", (double)mhz, "MHz");
 	}
 	exit(0);
 }
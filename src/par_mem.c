@@ -1,7 +1,12 @@
 /*
  * par_mem.c - determine the memory hierarchy parallelism
  *
- * usage: par_mem [-L <line size>] [-M len[K|M]] [-W <warmup>] [-N <repetitions>]
+ * usage: par_mem [-w] [-L <line size>] [-M len[K|M]] [-W <warmup>] [-N <repetitions>]
+ *
+ * For each size prints the most loads that the memory hierarchy
+ * overlaps (with up to MEM_REGISTER_CHAINS chains), or with -w the
+ * latency, throughput and bandwidth with each number of independent
+ * load chains from 1 to MAX_MEM_PARALLELISM.
  *
  * Copyright (c) 2000 Carl Staelin.
  * Copyright (c) 1994 Larry McVoy.  Distributed under the FSF GPL with
@@ -32,20 +37,26 @@ main(int ac, char **av)
 	int	warmup = 0;
 	int	repetitions = TRIES;
 	int	print_cost = 0;
+	int	curve = 0;
 	size_t	len;
 	size_t	maxlen = 64 * 1024 * 1024;
 	double	par;
+	double	ns[MAX_MEM_PARALLELISM];
+	char	buf[64];
 	struct mem_state state;
-	char   *usage = "[-c] [-L <line size>] [-M len[K|M]] [-W <warmup>] [-N <repetitions>]\n";
+	char   *usage = "[-c] [-w] [-L <line size>] [-M len[K|M]] [-W <warmup>] [-N <repetitions>]\n";
 
 	state.line = getpagesize() / 16;
 	state.pagesize = getpagesize();
 
-	while (( c = getopt(ac, av, "cL:M:W:N:")) != EOF) {
+	while (( c = getopt(ac, av, "cwL:M:W:N:")) != EOF) {
 		switch(c) {
 		case 'c':
 			print_cost = 1;
 			break;
+		case 'w':
+			curve = 1;
+			break;
 		case 'L':
 			state.line = atoi(optarg);
 			if (state.line < sizeof(char*))
@@ -66,12 +77,21 @@ main(int ac, char **av)
 		}
 	}
 
-	for (i = MAX_MEM_PARALLELISM * state.line; i <= maxlen; i<<=1) { 
+	for (i = MEM_REGISTER_CHAINS * state.line; i <= maxlen; i<<=1) { 
+		if (curve) {
+			c = par_mem_curve(i, MAX_MEM_PARALLELISM, warmup,
+					  repetitions, &state, ns);
+			sprintf(buf, "%.6f", i / (1000. * 1000.));
+			par_mem_print(buf, c, ns, state.line);
+			continue;
+		}
 		par = par_mem(i, warmup, repetitions, &state);
 
 		if (par > 0.) {
 			fprintf(stderr, "%.6f %.2f\n", 
 				i / (1000. * 1000.), par);
+			sprintf(buf, "%.6f", i / (1000. * 1000.));
+			json_result(buf, par, "parallelism");
 		}
 	}
 
@@ -22,6 +22,7 @@ struct _state {
 
 void	initialize(iter_t iterations, void* cookie);
 void	cleanup(iter_t iterations, void* cookie);
+void	report(char* s, double par);
 
 #define	FIVE(m)		m m m m m
 #define	TEN(m)		FIVE(m) FIVE(m)
@@ -386,6 +387,15 @@ cleanup(iter_t iterations, void* cookie)
 	free(state->double_data);
 }
 
+void
+report(char* s, double par)
+{
+	char	buf[64];
+
+	fprintf(stderr, "%s parallelism: %.2f\n", s, par);
+	sprintf(buf, "%.50s parallelism", s);
+	json_result(buf, par, "parallelism");
+}
 
 int
 main(int ac, char **av)
@@ -418,82 +428,82 @@ main(int ac, char **av)
 	par = max_parallelism(integer_bit_benchmarks, 
 			      warmup, repetitions, &state);
 	if (par > 0.)
-		fprintf(stderr, "integer bit parallelism: %.2f\n", par);
+		report("integer bit", par);
 
 	par = max_parallelism(integer_add_benchmarks, 
 			      warmup, repetitions, &state);
 	if (par > 0.)
-		fprintf(stderr, "integer add parallelism: %.2f\n", par);
+		report("integer add", par);
 
 	par = max_parallelism(integer_mul_benchmarks, 
 			      warmup, repetitions, &state);
 	if (par > 0.)
-		fprintf(stderr, "integer mul parallelism: %.2f\n", par);
+		report("integer mul", par);
 
 	par = max_parallelism(integer_div_benchmarks, 
 			      warmup, repetitions, &state);
 	if (par > 0.)
-		fprintf(stderr, "integer div parallelism: %.2f\n", par);
+		report("integer div", par);
 
 	par = max_parallelism(integer_mod_benchmarks, 
 			      warmup, repetitions, &state);
 	if (par > 0.)
-		fprintf(stderr, "integer mod parallelism: %.2f\n", par);
+		report("integer mod", par);
 
 	par = max_parallelism(int64_bit_benchmarks, 
 			      warmup, repetitions, &state);
 	if (par > 0.)
-		fprintf(stderr, "int64 bit parallelism: %.2f\n", par);
+		report("int64 bit", par);
 
 	par = max_parallelism(int64_add_benchmarks, 
 			      warmup, repetitions, &state);
 	if (par > 0.)
-		fprintf(stderr, "int64 add parallelism: %.2f\n", par);
+		report("int64 add", par);
 
 	par = max_parallelism(int64_mul_benchmarks, 
 			      warmup, repetitions, &state);
 	if (par > 0.)
-		fprintf(stderr, "int64 mul parallelism: %.2f\n", par);
+		report("int64 mul", par);
 
 	par = max_parallelism(int64_div_benchmarks, 
 			      warmup, repetitions, &state);
 	if (par > 0.)
-		fprintf(stderr, "int64 div parallelism: %.2f\n", par);
+		report("int64 div", par);
 
 	par = max_parallelism(int64_mod_benchmarks, 
 			      warmup, repetitions, &state);
 	if (par > 0.)
-		fprintf(stderr, "int64 mod parallelism: %.2f\n", par);
+		report("int64 mod", par);
 
 	par = max_parallelism(float_add_benchmarks, 
 			      warmup, repetitions, &state);
 	if (par > 0.)
-		fprintf(stderr, "float add parallelism: %.2f\n", par);
+		report("float add", par);
 
 	par = max_parallelism(float_mul_benchmarks, 
 			      warmup, repetitions, &state);
 	if (par > 0.)
-		fprintf(stderr, "float mul parallelism: %.2f\n", par);
+		report("float mul", par);
 
 	par = max_parallelism(float_div_benchmarks, 
 			      warmup, repetitions, &state);
 	if (par > 0.)
-		fprintf(stderr, "float div parallelism: %.2f\n", par);
+		report("float div", par);
 
 	par = max_parallelism(double_add_benchmarks, 
 			      warmup, repetitions, &state);
 	if (par > 0.)
-		fprintf(stderr, "double add parallelism: %.2f\n", par);
+		report("double add", par);
 
 	par = max_parallelism(double_mul_benchmarks, 
 			      warmup, repetitions, &state);
 	if (par > 0.)
-		fprintf(stderr, "double mul parallelism: %.2f\n", par);
+		report("double mul", par);
 
 	par = max_parallelism(double_div_benchmarks, 
 			      warmup, repetitions, &state);
 	if (par > 0.)
-		fprintf(stderr, "double div parallelism: %.2f\n", par);
+		report("double div", par);
 
 
 	return(0);
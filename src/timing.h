@@ -15,6 +15,8 @@ void	context(uint64 xfers);
 uint64	delta(void);
 int	get_enough(int);
 uint64	get_n(void);
+int	json_output(void);
+void	json_result(char *name, double value, char *units);
 void	kb(uint64 bytes);
 double	l_overhead(void);
 char	last(char *s);
@@ -26,13 +28,15 @@ void	milli(char *s, uint64 n);
 void	morefds(void);
 void	nano(char *s, uint64 n);
 uint64	now(void);
+uint64	now_ns(void);
+void	percentiles(char *s, double scale, double offset);
 void	ptime(uint64 n);
 void	rusage(void);
 void	save_n(uint64);
 void	settime(uint64 usecs);
 void	start(struct timeval *tv);
 uint64	stop(struct timeval *begin, struct timeval *end);
-uint64	t_overhead(void);
+double	t_overhead(void);
 double	timespent(void);
 void	timing(FILE *out);
 uint64	tvdelta(struct timeval *, struct timeval *);
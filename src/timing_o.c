@@ -5,6 +5,6 @@ int
 main()
 {
 	putenv("LOOP_O=0.0");
-	printf("%lu\n", (unsigned long)t_overhead());
+	printf("%.4f\n", t_overhead());
 	return (0);
 }
@@ -78,9 +78,11 @@ main(int ac, char **av)
 		if (print_cost) {
 			compute_times(tlb * 2, warmup, repetitions, &tlb_time, &cache_time, &state);
 			fprintf(stderr, "tlb: %d pages %.5f nanoseconds\n", tlb, tlb_time - cache_time);
+			json_result("tlb miss", tlb_time - cache_time, "nanoseconds");
 		} else {
 			fprintf(stderr, "tlb: %d pages\n", tlb);
 		}
+		json_result("tlb", (double)tlb, "pages");
 	}
 
 	/*